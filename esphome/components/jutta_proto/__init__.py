@@ -1,16 +1,73 @@
 import esphome.codegen as cg
 import esphome.config_validation as cv
 from esphome import automation
-from esphome.components import uart
-from esphome.const import CONF_ID
+from esphome.components import sensor, uart
+from esphome.const import (
+    CONF_ID,
+    CONF_INTERVAL,
+    CONF_TRIGGER_ID,
+    ENTITY_CATEGORY_DIAGNOSTIC,
+    ICON_TIMER,
+    STATE_CLASS_MEASUREMENT,
+    STATE_CLASS_TOTAL_INCREASING,
+    UNIT_MILLISECOND,
+)
 
 DEPENDENCIES = ["uart"]
-AUTO_LOAD = ["uart"]
+AUTO_LOAD = ["uart", "sensor"]
 
 CONF_COFFEE = "coffee"
 CONF_GRIND_DURATION = "grind_duration"
 CONF_WATER_DURATION = "water_duration"
 CONF_PAGE = "page"
+CONF_FAULT_INJECTION = "fault_injection"
+CONF_BIT_FLIP_RATE = "bit_flip_rate"
+CONF_DROP_RATE = "drop_rate"
+CONF_DUPLICATE_RATE = "duplicate_rate"
+CONF_GAP_RATE = "gap_rate"
+CONF_GAP_DURATION = "gap_duration"
+CONF_LOST_OK_RATE = "lost_ok_rate"
+CONF_SEED = "seed"
+CONF_FAST_RESUME = "fast_resume"
+CONF_BOOT_TO_READY = "boot_to_ready"
+CONF_KEEP_ALIVE = "keep_alive"
+CONF_MAX_INTERVAL = "max_interval"
+CONF_ACK_TIMEOUT = "ack_timeout"
+CONF_MIN = "min"
+CONF_MAX = "max"
+CONF_RETRIES = "retries"
+CONF_COMMAND_LATENCY = "command_latency"
+CONF_TIMEOUTS = "timeouts"
+CONF_LOOP_PROFILER = "loop_profiler"
+CONF_BUDGET = "budget"
+CONF_MAX_LOOP_TIME = "max_loop_time"
+CONF_LOOPS_OVER_BUDGET = "loops_over_budget"
+CONF_LINK_QUALITY = "link_quality"
+CONF_TRAFFIC_RECORDER = "traffic_recorder"
+CONF_SIZE = "size"
+CONF_PROTOCOL_TASK = "protocol_task"
+CONF_CORE = "core"
+CONF_PRIORITY = "priority"
+CONF_STACK_SIZE = "stack_size"
+CONF_TX_THROUGHPUT = "tx_throughput"
+CONF_BRIDGE = "bridge"
+CONF_DONGLE_UART_ID = "dongle_uart_id"
+CONF_COMMAND = "command"
+CONF_HEAP_FREE = "heap_free"
+CONF_BYTE_GAP = "byte_gap"
+CONF_MESSAGE_IDLE_GAPS = "message_idle_gaps"
+CONF_FRAME_TOLERANCE = "frame_tolerance"
+BYTE_GAP_CALIBRATE = "calibrate"
+UNIT_BYTES_PER_SECOND = "B/s"
+# Link quality counters and the JuraComponent setter of their sensors.
+LINK_QUALITY_SENSORS = {
+    "frames_decoded": "set_frames_decoded_sensor",
+    "stray_bytes": "set_stray_bytes_sensor",
+    "resync_events": "set_resync_events_sensor",
+    "undersized_reads": "set_undersized_reads_sensor",
+    "tx_failures": "set_tx_failures_sensor",
+    "corrected_bits": "set_corrected_bits_sensor",
+}
 
 jutta_component_ns = cg.esphome_ns.namespace("jutta_component")
 jutta_proto_ns = cg.global_ns.namespace("jutta_proto")
@@ -26,6 +83,23 @@ CancelCustomBrewAction = jutta_component_ns.class_(
     "CancelCustomBrewAction", automation.Action
 )
 SwitchPageAction = jutta_component_ns.class_("SwitchPageAction", automation.Action)
+DumpTrafficAction = jutta_component_ns.class_("DumpTrafficAction", automation.Action)
+InjectCommandAction = jutta_component_ns.class_("InjectCommandAction", automation.Action)
+IsAliveCondition = jutta_component_ns.class_("IsAliveCondition", automation.Condition)
+WaitUntilIdleAction = jutta_component_ns.class_("WaitUntilIdleAction", automation.Action)
+NotificationTrigger = jutta_component_ns.class_(
+    "NotificationTrigger", automation.Trigger.template()
+)
+Notification = JuraComponent.enum("Notification", is_class=True)
+
+# Automation triggers and what fires them.
+NOTIFICATION_TRIGGERS = {
+    "on_brew_started": Notification.BREW_STARTED,
+    "on_brew_finished": Notification.BREW_FINISHED,
+    "on_brew_cancelled": Notification.BREW_CANCELLED,
+    "on_brew_failed": Notification.BREW_FAILED,
+    "on_handshake_complete": Notification.HANDSHAKE_COMPLETE,
+}
 
 COFFEE_TYPES = {
     "espresso": CoffeeType.ESPRESSO,
@@ -38,16 +112,192 @@ COFFEE_TYPES = {
     "macchiato": CoffeeType.MACCHIATO,
 }
 
+# Command classes, latency phases and percentiles as understood by JuraComponent::set_latency_sensor().
+COMMAND_CLASSES = {"fn": 0, "fa": 1, "other": 2}
+LATENCY_PHASES = {"tx": 0, "ack": 1, "delay": 2}
+LATENCY_PERCENTILES = {"p50": 50, "p95": 95, "p99": 99}
+
 DEFAULT_GRIND_DURATION = cv.TimePeriod(milliseconds=3600)
 DEFAULT_WATER_DURATION = cv.TimePeriod(milliseconds=40000)
 
 JURA_COMPONENT_IDS = []
 
 
-CONFIG_SCHEMA = (
-    cv.Schema({cv.GenerateID(): cv.declare_id(JuraComponent)})
+FAULT_INJECTION_SCHEMA = cv.Schema(
+    {
+        cv.Optional(CONF_BIT_FLIP_RATE, default=0.0): cv.percentage,
+        cv.Optional(CONF_DROP_RATE, default=0.0): cv.percentage,
+        cv.Optional(CONF_DUPLICATE_RATE, default=0.0): cv.percentage,
+        cv.Optional(CONF_GAP_RATE, default=0.0): cv.percentage,
+        cv.Optional(CONF_GAP_DURATION, default="50ms"): cv.positive_time_period_milliseconds,
+        cv.Optional(CONF_LOST_OK_RATE, default=0.0): cv.percentage,
+        cv.Optional(CONF_SEED, default=1): cv.uint32_t,
+    }
+)
+
+
+ACK_TIMEOUT_SCHEMA = cv.Schema(
+    {
+        cv.Optional(CONF_MIN, default="250ms"): cv.positive_time_period_milliseconds,
+        cv.Optional(CONF_MAX, default="5s"): cv.positive_time_period_milliseconds,
+        # Only FN: commands get resent, repeating a button press could brew twice.
+        cv.Optional(CONF_RETRIES, default=2): cv.int_range(min=0, max=10),
+    }
+)
+
+KEEP_ALIVE_SCHEMA = cv.Schema(
+    {
+        cv.Optional(CONF_INTERVAL, default="30s"): cv.positive_time_period_milliseconds,
+        cv.Optional(CONF_MAX_INTERVAL, default="5min"): cv.positive_time_period_milliseconds,
+    }
+)
+
+
+LATENCY_SENSOR_SCHEMA = sensor.sensor_schema(
+    unit_of_measurement=UNIT_MILLISECOND,
+    icon=ICON_TIMER,
+    accuracy_decimals=0,
+    state_class=STATE_CLASS_MEASUREMENT,
+    entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+)
+
+COMMAND_CLASS_LATENCY_SCHEMA = cv.Schema(
+    {
+        **{
+            cv.Optional(f"{phase}_{percentile}"): LATENCY_SENSOR_SCHEMA
+            for phase in LATENCY_PHASES
+            for percentile in LATENCY_PERCENTILES
+        },
+        cv.Optional(CONF_TIMEOUTS): sensor.sensor_schema(
+            accuracy_decimals=0,
+            state_class=STATE_CLASS_TOTAL_INCREASING,
+            entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+        ),
+    }
+)
+
+COMMAND_LATENCY_SCHEMA = cv.Schema(
+    {cv.Optional(command_class): COMMAND_CLASS_LATENCY_SCHEMA for command_class in COMMAND_CLASSES}
+)
+
+
+def byte_gap(value):
+    """Either "calibrate" or the pause after every encoded byte sent."""
+    if isinstance(value, str) and value.strip().lower() == BYTE_GAP_CALIBRATE:
+        return BYTE_GAP_CALIBRATE
+    value = cv.positive_time_period_microseconds(value)
+    if not 250 <= value.total_microseconds <= 50000:
+        raise cv.Invalid("byte_gap must be between 250us and 50ms")
+    return value
+
+
+LOOP_PROFILER_SCHEMA = cv.Schema(
+    {
+        cv.Optional(CONF_BUDGET, default="30ms"): cv.positive_time_period_microseconds,
+        cv.Optional(CONF_MAX_LOOP_TIME): sensor.sensor_schema(
+            unit_of_measurement=UNIT_MILLISECOND,
+            icon=ICON_TIMER,
+            accuracy_decimals=1,
+            state_class=STATE_CLASS_MEASUREMENT,
+            entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+        ),
+        cv.Optional(CONF_LOOPS_OVER_BUDGET): sensor.sensor_schema(
+            accuracy_decimals=0,
+            state_class=STATE_CLASS_TOTAL_INCREASING,
+            entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+        ),
+    }
+)
+
+
+LINK_QUALITY_SCHEMA = cv.Schema(
+    {
+        cv.Optional(key): sensor.sensor_schema(
+            accuracy_decimals=0,
+            state_class=STATE_CLASS_TOTAL_INCREASING,
+            entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+        )
+        for key in LINK_QUALITY_SENSORS
+    }
+).extend(
+    {
+        cv.Optional(CONF_TX_THROUGHPUT): sensor.sensor_schema(
+            unit_of_measurement=UNIT_BYTES_PER_SECOND,
+            accuracy_decimals=1,
+            state_class=STATE_CLASS_MEASUREMENT,
+            entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+        ),
+    }
+)
+
+
+TRAFFIC_RECORDER_SCHEMA = cv.Schema(
+    {
+        cv.Optional(CONF_SIZE, default=4096): cv.int_range(min=64, max=65536),
+    }
+)
+
+
+PROTOCOL_TASK_SCHEMA = cv.All(
+    cv.Schema(
+        {
+            cv.Optional(CONF_CORE): cv.int_range(min=0, max=1),
+            cv.Optional(CONF_PRIORITY, default=2): cv.int_range(min=1, max=20),
+            cv.Optional(CONF_STACK_SIZE, default=8192): cv.int_range(min=4096, max=65536),
+        }
+    ),
+    cv.only_on(["esp32", "host"]),
+)
+
+
+BRIDGE_SCHEMA = cv.Schema(
+    {
+        cv.Required(CONF_DONGLE_UART_ID): cv.use_id(uart.UARTComponent),
+    }
+)
+
+
+CONFIG_SCHEMA = cv.All(
+    cv.Schema(
+        {
+            cv.GenerateID(): cv.declare_id(JuraComponent),
+            cv.Optional(CONF_FAULT_INJECTION): FAULT_INJECTION_SCHEMA,
+            cv.Optional(CONF_TRAFFIC_RECORDER): TRAFFIC_RECORDER_SCHEMA,
+            cv.Optional(CONF_PROTOCOL_TASK): PROTOCOL_TASK_SCHEMA,
+            cv.Optional(CONF_BRIDGE): BRIDGE_SCHEMA,
+            cv.Optional(CONF_FAST_RESUME, default=True): cv.boolean,
+            cv.Optional(CONF_BYTE_GAP): byte_gap,
+            # Byte gaps of silence that end a reply without "\r\n", at least 20 ms.
+            cv.Optional(CONF_MESSAGE_IDLE_GAPS, default=4): cv.int_range(min=2, max=50),
+            # Filler bits per received frame that may read as 0, every frame has 20 of them.
+            cv.Optional(CONF_FRAME_TOLERANCE, default=0): cv.int_range(min=0, max=4),
+            # Replaces the global operator new to count allocations, which the ESP8266 core does not allow.
+            cv.Optional(CONF_HEAP_FREE): cv.All(cv.boolean, cv.only_on(["esp32", "host"])),
+            cv.Optional(CONF_ACK_TIMEOUT, default={}): ACK_TIMEOUT_SCHEMA,
+            cv.Optional(CONF_KEEP_ALIVE, default={}): KEEP_ALIVE_SCHEMA,
+            cv.Optional(CONF_COMMAND_LATENCY): COMMAND_LATENCY_SCHEMA,
+            cv.Optional(CONF_LOOP_PROFILER): LOOP_PROFILER_SCHEMA,
+            cv.Optional(CONF_LINK_QUALITY): LINK_QUALITY_SCHEMA,
+            cv.Optional(CONF_BOOT_TO_READY): sensor.sensor_schema(
+                unit_of_measurement=UNIT_MILLISECOND,
+                icon=ICON_TIMER,
+                accuracy_decimals=0,
+                state_class=STATE_CLASS_MEASUREMENT,
+                entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+            ),
+            **{
+                cv.Optional(key): automation.validate_automation(
+                    {cv.GenerateID(CONF_TRIGGER_ID): cv.declare_id(NotificationTrigger)}
+                )
+                for key in NOTIFICATION_TRIGGERS
+            },
+        }
+    )
     .extend(uart.UART_DEVICE_SCHEMA)
-    .extend(cv.COMPONENT_SCHEMA)
+    .extend(cv.COMPONENT_SCHEMA),
+    # A bridge only forwards, it neither runs the protocol nor reads through the fault injector.
+    cv.has_at_most_one_key(CONF_BRIDGE, CONF_PROTOCOL_TASK),
+    cv.has_at_most_one_key(CONF_BRIDGE, CONF_FAULT_INJECTION),
 )
 
 
@@ -82,6 +332,14 @@ def _normalize_cancel(value):
     return cv.Schema({cv.Optional(CONF_ID): cv.use_id(JuraComponent)})(value)
 
 
+def _normalize_parent(value):
+    if value is None:
+        value = {}
+    if isinstance(value, str):
+        value = {CONF_ID: value}
+    return cv.Schema({cv.Optional(CONF_ID): cv.use_id(JuraComponent)})(value)
+
+
 def _normalize_switch_page(value):
     if isinstance(value, int):
         value = {CONF_PAGE: value}
@@ -93,12 +351,120 @@ def _normalize_switch_page(value):
     )(value)
 
 
+def _normalize_inject_command(value):
+    if isinstance(value, str):
+        value = {CONF_COMMAND: value}
+    return cv.Schema(
+        {
+            cv.Optional(CONF_ID): cv.use_id(JuraComponent),
+            cv.Required(CONF_COMMAND): cv.string_strict,
+        }
+    )(value)
+
+
 async def to_code(config):
     var = cg.new_Pvariable(config[CONF_ID])
     JURA_COMPONENT_IDS.append(config[CONF_ID])
+    if len(JURA_COMPONENT_IDS) > 1:
+        # Several coffee makers on one node share the TX slots instead of spinning through each other's gaps.
+        cg.add_define("USE_JUTTA_TX_SCHEDULER")
     await cg.register_component(var, config)
     await uart.register_uart_device(var, config)
 
+    cg.add(var.set_preference_id(str(config[CONF_ID])))
+    cg.add(var.set_fast_resume(config[CONF_FAST_RESUME]))
+    cg.add(var.set_message_idle_gaps(config[CONF_MESSAGE_IDLE_GAPS]))
+    cg.add(var.set_frame_tolerance(config[CONF_FRAME_TOLERANCE]))
+    for key, notification in NOTIFICATION_TRIGGERS.items():
+        for conf in config.get(key, []):
+            trigger = cg.new_Pvariable(conf[CONF_TRIGGER_ID], var, notification)
+            await automation.build_automation(trigger, [], conf)
+    if config.get(CONF_BYTE_GAP) == BYTE_GAP_CALIBRATE:
+        cg.add_define("USE_JUTTA_BYTE_GAP_CALIBRATION")
+        cg.add(var.set_calibrate_byte_gap(True))
+    elif CONF_BYTE_GAP in config:
+        cg.add(var.set_byte_gap(config[CONF_BYTE_GAP].total_microseconds))
+    ack_timeout = config[CONF_ACK_TIMEOUT]
+    cg.add(
+        var.set_ack_timeout(
+            ack_timeout[CONF_MIN].total_milliseconds,
+            max(ack_timeout[CONF_MIN], ack_timeout[CONF_MAX]).total_milliseconds,
+            ack_timeout[CONF_RETRIES],
+        )
+    )
+    keep_alive = config[CONF_KEEP_ALIVE]
+    cg.add(
+        var.set_keep_alive(
+            keep_alive[CONF_INTERVAL].total_milliseconds,
+            max(keep_alive[CONF_INTERVAL], keep_alive[CONF_MAX_INTERVAL]).total_milliseconds,
+        )
+    )
+    if CONF_BOOT_TO_READY in config:
+        sens = await sensor.new_sensor(config[CONF_BOOT_TO_READY])
+        cg.add(var.set_boot_to_ready_sensor(sens))
+    for command_class, class_index in COMMAND_CLASSES.items():
+        class_config = config.get(CONF_COMMAND_LATENCY, {}).get(command_class, {})
+        for phase, phase_index in LATENCY_PHASES.items():
+            for percentile, percent in LATENCY_PERCENTILES.items():
+                key = f"{phase}_{percentile}"
+                if key in class_config:
+                    sens = await sensor.new_sensor(class_config[key])
+                    cg.add(var.set_latency_sensor(class_index, phase_index, percent, sens))
+        if CONF_TIMEOUTS in class_config:
+            sens = await sensor.new_sensor(class_config[CONF_TIMEOUTS])
+            cg.add(var.set_timeout_sensor(class_index, sens))
+
+    for key, setter in LINK_QUALITY_SENSORS.items():
+        if key in config.get(CONF_LINK_QUALITY, {}):
+            sens = await sensor.new_sensor(config[CONF_LINK_QUALITY][key])
+            cg.add(getattr(var, setter)(sens))
+    if CONF_TX_THROUGHPUT in config.get(CONF_LINK_QUALITY, {}):
+        sens = await sensor.new_sensor(config[CONF_LINK_QUALITY][CONF_TX_THROUGHPUT])
+        cg.add(var.set_tx_throughput_sensor(sens))
+
+    if CONF_LOOP_PROFILER in config:
+        profiler = config[CONF_LOOP_PROFILER]
+        cg.add_define("USE_JUTTA_LOOP_PROFILER")
+        cg.add(var.set_loop_budget(profiler[CONF_BUDGET].total_microseconds))
+        if CONF_MAX_LOOP_TIME in profiler:
+            sens = await sensor.new_sensor(profiler[CONF_MAX_LOOP_TIME])
+            cg.add(var.set_max_loop_time_sensor(sens))
+        if CONF_LOOPS_OVER_BUDGET in profiler:
+            sens = await sensor.new_sensor(profiler[CONF_LOOPS_OVER_BUDGET])
+            cg.add(var.set_loops_over_budget_sensor(sens))
+
+    if CONF_TRAFFIC_RECORDER in config:
+        cg.add_define("USE_JUTTA_TRAFFIC_RECORDER")
+        cg.add(var.set_traffic_recorder_size(config[CONF_TRAFFIC_RECORDER][CONF_SIZE]))
+
+    if CONF_BRIDGE in config:
+        dongle = await cg.get_variable(config[CONF_BRIDGE][CONF_DONGLE_UART_ID])
+        cg.add_define("USE_JUTTA_BRIDGE")
+        cg.add(var.set_bridge_dongle(dongle))
+
+    if config.get(CONF_HEAP_FREE, False):
+        cg.add_define("USE_JUTTA_HEAP_FREE")
+
+    if CONF_PROTOCOL_TASK in config:
+        task = config[CONF_PROTOCOL_TASK]
+        cg.add_define("USE_JUTTA_PROTOCOL_TASK")
+        cg.add(var.set_protocol_task(task[CONF_STACK_SIZE], task[CONF_PRIORITY], task.get(CONF_CORE, -1)))
+
+    if CONF_FAULT_INJECTION in config:
+        faults = config[CONF_FAULT_INJECTION]
+        cg.add_define("USE_JUTTA_FAULT_INJECTION")
+        cg.add(
+            var.set_fault_profile(
+                faults[CONF_BIT_FLIP_RATE],
+                faults[CONF_DROP_RATE],
+                faults[CONF_DUPLICATE_RATE],
+                faults[CONF_GAP_RATE],
+                faults[CONF_GAP_DURATION].total_milliseconds,
+                faults[CONF_LOST_OK_RATE],
+                faults[CONF_SEED],
+            )
+        )
+
 
 async def _get_parent(config):
     if CONF_ID in config:
@@ -147,3 +513,32 @@ async def switch_page_action_to_code(config, action_id, template_args, args):
     cg.add(var.set_page(config[CONF_PAGE]))
     return var
 
+
+@automation.register_action("jutta_proto.dump_traffic", DumpTrafficAction, _normalize_parent)
+async def dump_traffic_action_to_code(config, action_id, template_args, args):
+    _ = args
+    parent = await _get_parent(config)
+    return cg.new_Pvariable(action_id, parent)
+
+
+@automation.register_action("jutta_proto.wait_until_idle", WaitUntilIdleAction, _normalize_parent)
+async def wait_until_idle_action_to_code(config, action_id, template_args, args):
+    _ = args
+    parent = await _get_parent(config)
+    return cg.new_Pvariable(action_id, parent)
+
+
+@automation.register_action("jutta_proto.inject_command", InjectCommandAction, _normalize_inject_command)
+async def inject_command_action_to_code(config, action_id, template_args, args):
+    _ = args
+    parent = await _get_parent(config)
+    var = cg.new_Pvariable(action_id, parent)
+    cg.add(var.set_command(config[CONF_COMMAND]))
+    return var
+
+
+@automation.register_condition("jutta_proto.is_alive", IsAliveCondition, _normalize_parent)
+async def is_alive_condition_to_code(config, condition_id, template_arg, args):
+    _ = args
+    parent = await _get_parent(config)
+    return cg.new_Pvariable(condition_id, parent)
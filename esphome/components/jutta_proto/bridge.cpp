@@ -0,0 +1,287 @@
+#include "bridge.hpp"
+
+#ifdef USE_JUTTA_BRIDGE
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <utility>
+
+#include "esphome/core/log.h"
+
+//---------------------------------------------------------------------------
+namespace jutta_proto {
+//---------------------------------------------------------------------------
+static const char* const TAG = "jutta_bridge";
+
+// Raw bytes read from a UART at once and chunks read per direction and forward() call.
+static constexpr size_t PUMP_CHUNK_SIZE = 32;
+static constexpr size_t PUMP_MAX_CHUNKS = 4;
+
+Bridge::Bridge(esphome::uart::UARTComponent* machine, esphome::uart::UARTComponent* dongle) {
+    this->lanes_[static_cast<size_t>(Side::MACHINE)].from = machine;
+    this->lanes_[static_cast<size_t>(Side::MACHINE)].to = dongle;
+    this->lanes_[static_cast<size_t>(Side::DONGLE)].from = dongle;
+    this->lanes_[static_cast<size_t>(Side::DONGLE)].to = machine;
+    for (auto& lane : this->lanes_) {
+        lane.message.reserve(MAX_MESSAGE_SIZE);
+    }
+    this->inject_reply_.message.reserve(MAX_MESSAGE_SIZE);
+}
+
+#ifdef USE_JUTTA_TRAFFIC_RECORDER
+void Bridge::enable_traffic_recorder(size_t capacity) {
+    this->recorder_ = std::make_unique<TrafficRecorder>(capacity);
+    ESP_LOGI(TAG, "Recording raw bridged traffic into a %zu byte ring buffer.", this->recorder_->capacity());
+}
+#endif
+
+void Bridge::record(trace::Direction direction, const uint8_t* data, size_t size, uint32_t now_us) {
+#ifdef USE_JUTTA_TRAFFIC_RECORDER
+    if (this->recorder_) {
+        for (size_t i = 0; i < size; i++) {
+            this->recorder_->record(direction, data[i], now_us);
+        }
+    }
+#else
+    (void) direction;
+    (void) data;
+    (void) size;
+    (void) now_us;
+#endif
+}
+
+void Bridge::forward(uint32_t now_us) {
+    const bool received = this->pump(Side::DONGLE, now_us) | this->pump(Side::MACHINE, now_us);
+    if (received && this->last_poll_us_ != 0) {
+        this->stats_.max_poll_gap_us = std::max(this->stats_.max_poll_gap_us, now_us - this->last_poll_us_);
+    }
+    this->last_poll_us_ = now_us;
+    this->run_injection(now_us);
+}
+
+bool Bridge::pump(Side from, uint32_t now_us) {
+    Lane& lane = this->lanes_[static_cast<size_t>(from)];
+    DirectionStats& stats = this->stats_.directions[static_cast<size_t>(from)];
+    std::array<uint8_t, PUMP_CHUNK_SIZE> chunk{};
+    bool received = false;
+    for (size_t i = 0; i < PUMP_MAX_CHUNKS; i++) {
+        const int available = lane.from->available();
+        if (available <= 0) {
+            break;
+        }
+        const size_t count = std::min(static_cast<size_t>(available), chunk.size());
+        if (!lane.from->read_array(chunk.data(), count)) {
+            break;
+        }
+        received = true;
+
+        // The coffee maker's answer to an injected command is ours, the dongle has to wait until it got it:
+        const bool swallow = from == Side::MACHINE && (this->inject_state_ == InjectState::SENDING ||
+                                                        this->inject_state_ == InjectState::AWAITING_REPLY);
+        const bool hold = from == Side::DONGLE && this->inject_state_ != InjectState::IDLE;
+        // Forward first, everything else happens on the copy:
+        if (hold) {
+            const size_t fits = std::min(count, this->hold_.size() - this->hold_size_);
+            std::memcpy(this->hold_.data() + this->hold_size_, chunk.data(), fits);
+            this->hold_size_ += fits;
+            this->stats_.hold_dropped += count - fits;
+        } else if (!swallow) {
+            lane.to->write_array(chunk.data(), count);
+            stats.forwarded += count;
+        }
+
+        lane.last_rx_us = now_us;
+        this->record(from == Side::DONGLE ? trace::Direction::TX : trace::Direction::RX, chunk.data(), count, now_us);
+        if (swallow) {
+            for (size_t j = 0; j < count && this->inject_state_ != InjectState::RELEASING; j++) {
+                std::string reply;
+                if (feed(&this->inject_reply_, chunk[j], &reply)) {
+                    this->inject_result_ = std::move(reply);
+                    this->finish_injection(now_us);
+                }
+            }
+            continue;
+        }
+        for (size_t j = 0; j < count; j++) {
+            if (lane.head - lane.tail == lane.capture.size()) {
+                stats.capture_dropped += count - j;
+                break;
+            }
+            lane.capture[lane.head % lane.capture.size()] = chunk[j];
+            ++lane.head;
+        }
+    }
+    return received;
+}
+
+void Bridge::decode(size_t max_bytes, const MessageCallback& on_message) {
+    for (size_t side = 0; side < this->lanes_.size(); side++) {
+        Lane& lane = this->lanes_[side];
+        DirectionStats& stats = this->stats_.directions[side];
+        for (size_t i = 0; i < max_bytes && lane.tail != lane.head; i++) {
+            const uint8_t byte = lane.capture[lane.tail % lane.capture.size()];
+            ++lane.tail;
+            std::string message;
+            if (!feed(&lane, byte, &message)) {
+                continue;
+            }
+            const Kind kind = classify(message);
+            ++stats.messages;
+            ++stats.kinds[static_cast<size_t>(kind)];
+            on_message(static_cast<Side>(side), kind, message);
+        }
+    }
+}
+
+bool Bridge::feed(Lane* lane, uint8_t byte, std::string* complete) {
+    lane->raw[lane->raw_size++] = byte;
+    bool done = false;
+    const size_t consumed = codec::decode_stream(lane->raw.data(), lane->raw_size, [&](size_t /*offset*/, uint8_t data) {
+        if (data != '\n') {
+            lane->message.push_back(static_cast<char>(data));
+        }
+        if (data == '\n' || lane->message.size() >= MAX_MESSAGE_SIZE) {
+            done = true;
+        }
+    });
+    std::memmove(lane->raw.data(), lane->raw.data() + consumed, lane->raw_size - consumed);
+    lane->raw_size -= consumed;
+    if (!done) {
+        return false;
+    }
+    if (!lane->message.empty() && lane->message.back() == '\r') {
+        lane->message.pop_back();
+    }
+    // Hand out a copy and keep the reserved buffer:
+    complete->assign(lane->message);
+    lane->message.clear();
+    return true;
+}
+
+void Bridge::take_injection_result(const InjectionCallback& on_result) {
+    if (!this->inject_result_ready_) {
+        return;
+    }
+    this->inject_result_ready_ = false;
+    // Without the "\r\n":
+    const std::string command = this->inject_command_.substr(0, this->inject_command_.size() - 2);
+    on_result(command, this->inject_timed_out_ ? std::string() : this->inject_result_);
+}
+
+void Bridge::inject(const std::string& command) {
+    this->inject_queue_.push_back(command + "\r\n");
+}
+
+void Bridge::run_injection(uint32_t now_us) {
+    switch (this->inject_state_) {
+        case InjectState::IDLE: {
+            if (this->inject_queue_.empty()) {
+                return;
+            }
+            const Lane& machine = this->lanes_[static_cast<size_t>(Side::MACHINE)];
+            const Lane& dongle = this->lanes_[static_cast<size_t>(Side::DONGLE)];
+            if (now_us - machine.last_rx_us < INJECT_IDLE_US || now_us - dongle.last_rx_us < INJECT_IDLE_US) {
+                return;
+            }
+            this->inject_command_ = std::move(this->inject_queue_.front());
+            this->inject_queue_.pop_front();
+            this->inject_pos_ = 0;
+            this->inject_reply_.raw_size = 0;
+            this->inject_reply_.message.clear();
+            this->inject_result_.clear();
+            this->inject_timed_out_ = false;
+            this->inject_state_ = InjectState::SENDING;
+            // The gap since the last byte of either side has long passed:
+            this->inject_tx_us_ = now_us - GAP_US;
+            ++this->stats_.injected;
+        }
+            [[fallthrough]];
+        case InjectState::SENDING: {
+            if (now_us - this->inject_tx_us_ < GAP_US) {
+                return;
+            }
+            const auto frame = codec::encode(static_cast<uint8_t>(this->inject_command_[this->inject_pos_ / 4]));
+            const uint8_t byte = frame[this->inject_pos_ % 4];
+            this->lanes_[static_cast<size_t>(Side::DONGLE)].to->write_array(&byte, 1);
+            this->record(trace::Direction::TX, &byte, 1, now_us);
+            this->inject_tx_us_ = now_us;
+            if (++this->inject_pos_ == this->inject_command_.size() * 4) {
+                this->inject_state_ = InjectState::AWAITING_REPLY;
+            }
+            return;
+        }
+        case InjectState::AWAITING_REPLY:
+            if (now_us - this->inject_tx_us_ >= INJECT_REPLY_TIMEOUT_US) {
+                ++this->stats_.injection_timeouts;
+                this->inject_timed_out_ = true;
+                this->finish_injection(now_us);
+            }
+            return;
+        case InjectState::RELEASING: {
+            // Pass the held back dongle bytes on with the usual gap, new ones queue up behind them:
+            if (now_us - this->inject_tx_us_ < GAP_US) {
+                return;
+            }
+            if (this->hold_pos_ < this->hold_size_) {
+                this->lanes_[static_cast<size_t>(Side::DONGLE)].to->write_array(&this->hold_[this->hold_pos_++], 1);
+                ++this->stats_.directions[static_cast<size_t>(Side::DONGLE)].forwarded;
+                this->inject_tx_us_ = now_us;
+            }
+            if (this->hold_pos_ == this->hold_size_) {
+                this->hold_pos_ = 0;
+                this->hold_size_ = 0;
+                this->inject_state_ = InjectState::IDLE;
+            }
+            return;
+        }
+    }
+}
+
+void Bridge::finish_injection(uint32_t now_us) {
+    this->inject_result_ready_ = true;
+    this->inject_state_ = InjectState::RELEASING;
+    this->inject_tx_us_ = now_us;
+    this->hold_pos_ = 0;
+}
+
+Bridge::Kind Bridge::classify(const std::string& message) {
+    if (!message.empty() && message[0] == '@') {
+        return Kind::KEY_EXCHANGE;
+    }
+    // Commands start with two upper case characters and a colon ("TY:", "FA:04"), answers with lower case ones ("ok:").
+    if (message.size() >= 3 && message[2] == ':') {
+        const auto first = static_cast<unsigned char>(message[0]);
+        const auto second = static_cast<unsigned char>(message[1]);
+        if (std::isupper(first) && (std::isupper(second) || std::isdigit(second))) {
+            return Kind::COMMAND;
+        }
+        if (std::islower(first) && (std::islower(second) || std::isdigit(second))) {
+            return Kind::RESPONSE;
+        }
+    }
+    return Kind::OTHER;
+}
+
+const char* Bridge::side_name(Side side) {
+    return side == Side::MACHINE ? "machine" : "dongle";
+}
+
+const char* Bridge::kind_name(Kind kind) {
+    switch (kind) {
+        case Kind::COMMAND:
+            return "command";
+        case Kind::RESPONSE:
+            return "response";
+        case Kind::KEY_EXCHANGE:
+            return "key exchange";
+        case Kind::OTHER:
+            break;
+    }
+    return "other";
+}
+//---------------------------------------------------------------------------
+}  // namespace jutta_proto
+//---------------------------------------------------------------------------
+
+#endif
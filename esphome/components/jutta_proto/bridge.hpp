@@ -0,0 +1,167 @@
+#pragma once
+
+#include "esphome/core/defines.h"
+
+#ifdef USE_JUTTA_BRIDGE
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "esphome/components/uart/uart.h"
+
+#include "jutta_codec.hpp"
+#include "jutta_trace.hpp"
+#include "traffic_recorder.hpp"
+
+//---------------------------------------------------------------------------
+namespace jutta_proto {
+//---------------------------------------------------------------------------
+/**
+ * Transparent bridge between the original JURA dongle and the coffee maker, one UART each.
+ *
+ * forward() copies every raw byte to the other side right away and only keeps a copy in a fixed size capture ring per
+ * direction. decode() turns the captured bytes into messages later on, so the forwarding path never waits on decoding.
+ * In case decoding falls behind, captured bytes get dropped (and counted) but the traffic itself is not affected.
+ *
+ * Commands can be injected while both sides are quiet. The dongle's bytes are held back until the coffee maker answered
+ * the injected command and its answer is not forwarded to the dongle.
+ **/
+class Bridge {
+ public:
+    enum class Side : uint8_t { MACHINE = 0, DONGLE = 1 };
+    enum class Kind : uint8_t { COMMAND = 0, RESPONSE = 1, KEY_EXCHANGE = 2, OTHER = 3 };
+    static constexpr size_t NUM_KINDS = 4;
+
+    // Captured bytes per direction that were not decoded yet.
+    static constexpr size_t CAPTURE_SIZE = 256;
+    // Longest message, longer ones get split.
+    static constexpr size_t MAX_MESSAGE_SIZE = 64;
+    // Dongle bytes held back during an injection.
+    static constexpr size_t HOLD_SIZE = 128;
+    // Minimum time between two encoded bytes written by the bridge itself.
+    static constexpr uint32_t GAP_US = 8000;
+    // Both sides have to be quiet for this long before a command gets injected, so no dongle command is waiting for its
+    // answer.
+    static constexpr uint32_t INJECT_IDLE_US = 250000;
+    static constexpr uint32_t INJECT_REPLY_TIMEOUT_US = 1000000;
+
+    struct DirectionStats {
+        uint32_t forwarded{0};
+        // Captured bytes dropped because decode() fell behind.
+        uint32_t capture_dropped{0};
+        uint32_t messages{0};
+        std::array<uint32_t, NUM_KINDS> kinds{};
+    };
+
+    struct Stats {
+        std::array<DirectionStats, 2> directions{};
+        // Longest time between two forward() calls that found bytes waiting, an upper bound for the added latency.
+        uint32_t max_poll_gap_us{0};
+        uint32_t injected{0};
+        uint32_t injection_timeouts{0};
+        // Dongle bytes dropped because the hold buffer overflowed during an injection.
+        uint32_t hold_dropped{0};
+    };
+
+    using MessageCallback = std::function<void(Side from, Kind kind, const std::string& message)>;
+    /**
+     * Called with the injected command and the coffee maker's answer, which is empty in case it timed out.
+     **/
+    using InjectionCallback = std::function<void(const std::string& command, const std::string& reply)>;
+
+    Bridge(esphome::uart::UARTComponent* machine, esphome::uart::UARTComponent* dongle);
+
+#ifdef USE_JUTTA_TRAFFIC_RECORDER
+    void enable_traffic_recorder(size_t capacity);
+    /**
+     * Returns the traffic recorder or nullptr in case recording is disabled.
+     * Bytes from the dongle and injected ones are recorded as TX, bytes from the coffee maker as RX.
+     **/
+    [[nodiscard]] TrafficRecorder* get_traffic_recorder() const { return this->recorder_.get(); }
+#endif
+
+    /**
+     * Forwards everything available in both directions and advances a running injection. Never blocks.
+     * Should be called as often as possible.
+     **/
+    void forward(uint32_t now_us);
+    /**
+     * Decodes at most max_bytes captured bytes per direction and reports every complete message.
+     **/
+    void decode(size_t max_bytes, const MessageCallback& on_message);
+    /**
+     * Reports the result of the last injection, in case it finished since the last call.
+     **/
+    void take_injection_result(const InjectionCallback& on_result);
+
+    /**
+     * Queues the given decoded command (e.g. "FA:04") for injection. "\r\n" gets appended.
+     **/
+    void inject(const std::string& command);
+    [[nodiscard]] bool is_injecting() const { return this->inject_state_ != InjectState::IDLE; }
+    [[nodiscard]] size_t injections_queued() const { return this->inject_queue_.size(); }
+
+    [[nodiscard]] const Stats& stats() const { return this->stats_; }
+
+    static Kind classify(const std::string& message);
+    static const char* side_name(Side side);
+    static const char* kind_name(Kind kind);
+
+ private:
+    enum class InjectState : uint8_t { IDLE, SENDING, AWAITING_REPLY, RELEASING };
+
+    // Traffic from one side to the other.
+    struct Lane {
+        esphome::uart::UARTComponent* from{nullptr};
+        esphome::uart::UARTComponent* to{nullptr};
+        uint32_t last_rx_us{0};
+        // Free running capture ring positions, only forward() writes head and only decode() writes tail.
+        std::array<uint8_t, CAPTURE_SIZE> capture{};
+        size_t head{0};
+        size_t tail{0};
+        // Encoded bytes that did not form a complete frame yet.
+        std::array<uint8_t, codec::FRAME_SIZE * 2> raw{};
+        size_t raw_size{0};
+        std::string message;
+    };
+
+    // Reassembles decoded messages from raw bytes, frame alignment like the JuttaConnection.
+    static bool feed(Lane* lane, uint8_t byte, std::string* complete);
+    // Returns true in case any bytes were received.
+    bool pump(Side from, uint32_t now_us);
+    void record(trace::Direction direction, const uint8_t* data, size_t size, uint32_t now_us);
+    void run_injection(uint32_t now_us);
+    void finish_injection(uint32_t now_us);
+
+    std::array<Lane, 2> lanes_;
+#ifdef USE_JUTTA_TRAFFIC_RECORDER
+    std::unique_ptr<TrafficRecorder> recorder_{};
+#endif
+    uint32_t last_poll_us_{0};
+    Stats stats_{};
+
+    InjectState inject_state_{InjectState::IDLE};
+    std::deque<std::string> inject_queue_{};
+    // Decoded command including "\r\n" and the next encoded byte to write.
+    std::string inject_command_{};
+    size_t inject_pos_{0};
+    uint32_t inject_tx_us_{0};
+    // The coffee maker's answer to the injected command, not forwarded.
+    Lane inject_reply_{};
+    std::string inject_result_{};
+    bool inject_result_ready_{false};
+    bool inject_timed_out_{false};
+    std::array<uint8_t, HOLD_SIZE> hold_{};
+    size_t hold_size_{0};
+    size_t hold_pos_{0};
+};
+//---------------------------------------------------------------------------
+}  // namespace jutta_proto
+//---------------------------------------------------------------------------
+
+#endif
@@ -3,9 +3,9 @@
 #include "esphome/core/log.h"
 #include "esphome/core/time.h"
 #include "jutta_commands.hpp"
+#include "model_profiles.hpp"
 #include <cassert>
 #include <cstddef>
-#include <limits>
 #include <string>
 #include <utility>
 
@@ -17,18 +17,39 @@ static const char* TAG = "coffee_maker";
 
 void CoffeeMaker::CommandState::reset() {
     this->active = false;
-    this->command.clear();
+    this->command = nullptr;
+    this->command_class = CommandClass::OTHER;
     this->delay_ms = 0;
     this->delay_target = 0;
+    this->queued = false;
     this->sent = false;
-    this->timeout = std::chrono::milliseconds{5000};
+    this->acked = false;
+    this->attempts = 0;
+    this->fixed_timeout = std::chrono::milliseconds{0};
+    this->timeout = std::chrono::milliseconds{RttEstimator::DEFAULT_MAX_TIMEOUT_MS};
+    this->start_time = 0;
+    this->sent_time = 0;
+    this->ack_time = 0;
 }
 
-CoffeeMaker::CoffeeMaker(std::unique_ptr<JuttaConnection>&& connection) : connection(std::move(connection)) {
+CoffeeMaker::CoffeeMaker(std::unique_ptr<JuttaConnection>&& connection)
+    : connection(std::move(connection)), profile_(&DEFAULT_MODEL_PROFILE) {
     this->reset_states();
 }
 
-void CoffeeMaker::switch_page() { this->switch_page((this->pageNum + 1) % NUM_PAGES); }
+void CoffeeMaker::set_profile(const ModelProfile& profile) {
+    this->profile_ = &profile;
+    this->connection->set_byte_gap(profile.byte_gap_us);
+}
+
+void CoffeeMaker::set_ack_timeout(uint32_t min_timeout_ms, uint32_t max_timeout_ms, uint8_t max_retries) {
+    for (CommandLatency& latency : this->command_latency_) {
+        latency.rtt.set_limits(min_timeout_ms, max_timeout_ms);
+    }
+    this->max_retries_ = max_retries;
+}
+
+void CoffeeMaker::switch_page() { this->switch_page((this->pageNum + 1) % this->profile_->num_pages); }
 
 void CoffeeMaker::switch_page(size_t pageNum) {
     if (this->locked) {
@@ -36,7 +57,7 @@ void CoffeeMaker::switch_page(size_t pageNum) {
         return;
     }
 
-    size_t target_page = pageNum % NUM_PAGES;
+    size_t target_page = pageNum % this->profile_->num_pages;
     if (this->pageNum == target_page) {
         return;
     }
@@ -93,24 +114,21 @@ void CoffeeMaker::loop() {
     }
 }
 
-size_t CoffeeMaker::get_page_num(coffee_t coffee) const {
-    for (const std::pair<const coffee_t, size_t>& c : this->coffee_page_map) {
-        if (c.first == coffee) {
-            return c.second;
-        }
+void CoffeeMaker::abort() {
+    if (this->current_operation_ != OperationType::Idle) {
+        ESP_LOGW(TAG, "Aborting current operation.");
+        this->operation_failed_ = true;
+        this->finish_operation();
     }
-    assert(false);  // Should not happen
-    return std::numeric_limits<size_t>::max();
+    this->reset_states();
+    this->pageNum = 0;
+    this->consecutive_timeouts_ = 0;
 }
 
+size_t CoffeeMaker::get_page_num(coffee_t coffee) const { return this->profile_->drink(coffee).page; }
+
 CoffeeMaker::jutta_button_t CoffeeMaker::get_button_num(coffee_t coffee) const {
-    for (const std::pair<const coffee_t, jutta_button_t>& c : this->coffee_button_map) {
-        if (c.first == coffee) {
-            return c.second;
-        }
-    }
-    assert(false);  // Should not happen
-    return jutta_button_t::BUTTON_6;
+    return this->profile_->drink(coffee).button;
 }
 
 const std::string& CoffeeMaker::command_for_button(jutta_button_t button) const {
@@ -132,52 +150,109 @@ const std::string& CoffeeMaker::command_for_button(jutta_button_t button) const
     return JUTTA_BUTTON_6;
 }
 
+CoffeeMaker::CommandClass CoffeeMaker::classify_command(const std::string& command) {
+    if (command.compare(0, 3, "FN:") == 0) {
+        return CommandClass::FN;
+    }
+    if (command.compare(0, 3, "FA:") == 0) {
+        return CommandClass::FA;
+    }
+    return CommandClass::OTHER;
+}
+
 CoffeeMaker::CommandResult CoffeeMaker::run_command(const std::string& command, uint32_t delay_ms,
                                                     const std::chrono::milliseconds& timeout) {
     if (!this->command_state_.active) {
         this->command_state_.active = true;
-        this->command_state_.command = command;
+        this->command_state_.command = &command;
+        this->command_state_.command_class = classify_command(command);
         this->command_state_.delay_ms = delay_ms;
         this->command_state_.delay_target = 0;
+        this->command_state_.queued = false;
         this->command_state_.sent = false;
-        this->command_state_.timeout = timeout;
+        this->command_state_.acked = false;
+        this->command_state_.attempts = 0;
+        this->command_state_.fixed_timeout = timeout;
+        this->command_state_.start_time = esphome::millis();
     }
+    CommandLatency& latency = this->command_latency_[static_cast<size_t>(this->command_state_.command_class)];
 
     if (!this->command_state_.sent) {
-        if (!this->connection->write_decoded(this->command_state_.command)) {
+        if (!this->command_state_.queued) {
+            // Picked per transmission, so a resend waits for the backed off timeout:
+            this->command_state_.timeout = this->command_state_.fixed_timeout.count() > 0
+                                               ? this->command_state_.fixed_timeout
+                                               : std::chrono::milliseconds{latency.rtt.timeout_ms()};
+            if (!this->connection->write_decoded(*this->command_state_.command)) {
+                return CommandResult::InProgress;
+            }
+            this->command_state_.queued = true;
+            ++this->command_state_.attempts;
+        }
+        if (this->connection->tx_pending()) {
             return CommandResult::InProgress;
         }
         this->command_state_.sent = true;
+        this->command_state_.sent_time = esphome::millis();
+        latency.tx.record(this->command_state_.sent_time - this->command_state_.start_time);
     }
 
-    auto wait_result = this->connection->wait_for_ok(this->command_state_.timeout);
-    if (wait_result == JuttaConnection::WaitResult::Pending) {
-        return CommandResult::InProgress;
-    }
-
-    if (wait_result == JuttaConnection::WaitResult::Success) {
-        if (this->command_state_.delay_ms > 0) {
-            uint32_t now = esphome::millis();
-            if (this->command_state_.delay_target == 0) {
-                this->command_state_.delay_target = now + this->command_state_.delay_ms;
-            }
-            if (!time_reached(now, this->command_state_.delay_target)) {
+    if (!this->command_state_.acked) {
+        auto wait_result = this->connection->wait_for_ok(this->command_state_.timeout);
+        if (wait_result == JuttaConnection::WaitResult::Pending) {
+            return CommandResult::InProgress;
+        }
+        if (wait_result == JuttaConnection::WaitResult::Timeout) {
+            ++latency.timeouts;
+            latency.rtt.on_timeout();
+            if (is_idempotent(this->command_state_.command_class) &&
+                this->command_state_.attempts <= this->max_retries_) {
+                ESP_LOGD(TAG, "No ok: for %.*s within %lld ms, resending.",
+                         static_cast<int>(this->command_state_.command->size() - 2),
+                         this->command_state_.command->c_str(),
+                         static_cast<long long>(this->command_state_.timeout.count()));
+                ++latency.retries;
+                this->command_state_.queued = false;
+                this->command_state_.sent = false;
                 return CommandResult::InProgress;
             }
         }
-        this->command_state_.reset();
-        return CommandResult::Success;
+        if (wait_result != JuttaConnection::WaitResult::Success) {
+            this->command_state_.reset();
+            if (wait_result == JuttaConnection::WaitResult::Timeout) {
+                ++this->consecutive_timeouts_;
+                return CommandResult::Timeout;
+            }
+            return CommandResult::Error;
+        }
+        this->consecutive_timeouts_ = 0;
+        this->command_state_.acked = true;
+        this->command_state_.ack_time = esphome::millis();
+        const uint32_t ack_ms = this->command_state_.ack_time - this->command_state_.sent_time;
+        latency.ack.record(ack_ms);
+        // The "ok:" to a resent command might belong to an earlier transmission:
+        if (this->command_state_.attempts == 1) {
+            latency.rtt.record(ack_ms);
+        }
     }
 
-    this->command_state_.reset();
-    if (wait_result == JuttaConnection::WaitResult::Timeout) {
-        return CommandResult::Timeout;
+    // Do not wait for another "ok:" while delaying:
+    if (this->command_state_.delay_ms > 0) {
+        uint32_t now = esphome::millis();
+        if (this->command_state_.delay_target == 0) {
+            this->command_state_.delay_target = this->command_state_.ack_time + this->command_state_.delay_ms;
+        }
+        if (!time_reached(now, this->command_state_.delay_target)) {
+            return CommandResult::InProgress;
+        }
+        latency.delay.record(now - this->command_state_.ack_time);
     }
-    return CommandResult::Error;
+    this->command_state_.reset();
+    return CommandResult::Success;
 }
 
 CoffeeMaker::CommandResult CoffeeMaker::run_press_button(jutta_button_t button) {
-    return this->run_command(this->command_for_button(button), 500);
+    return this->run_command(this->command_for_button(button), this->profile_->button_delay_ms);
 }
 
 bool CoffeeMaker::handle_command(CommandResult result, const char* description) {
@@ -205,7 +280,7 @@ CoffeeMaker::StepResult CoffeeMaker::ensure_page(size_t target_page) {
 
     CommandResult result = this->run_press_button(jutta_button_t::BUTTON_6);
     if (result == CommandResult::Success) {
-        this->pageNum = (this->pageNum + 1) % NUM_PAGES;
+        this->pageNum = (this->pageNum + 1) % this->profile_->num_pages;
         if (this->pageNum == target_page) {
             return StepResult::Done;
         }
@@ -569,9 +644,25 @@ void CoffeeMaker::start_operation(OperationType operation) {
     this->command_state_.reset();
     this->hot_water_state_ = {};
     this->locked = true;
+    if (this->brew_listener_ &&
+        (operation == OperationType::BrewCoffee || operation == OperationType::BrewCustomCoffee)) {
+        this->brew_listener_(BrewEvent::STARTED);
+    }
 }
 
 void CoffeeMaker::finish_operation() {
+    const bool brewing = this->current_operation_ == OperationType::BrewCoffee ||
+                         this->current_operation_ == OperationType::BrewCustomCoffee;
+    BrewEvent event = BrewEvent::FINISHED;
+    if (brewing) {
+        ++this->brew_stats_.finished;
+        if (this->operation_failed_) {
+            ++this->brew_stats_.failed;
+            event = BrewEvent::FAILED;
+        } else if (this->custom_state_.stage == CustomBrewState::Stage::Cancelled) {
+            event = BrewEvent::CANCELLED;
+        }
+    }
     this->command_state_.reset();
     this->hot_water_state_ = {};
     this->custom_state_.stage = CustomBrewState::Stage::Idle;
@@ -581,6 +672,10 @@ void CoffeeMaker::finish_operation() {
     this->current_operation_ = OperationType::Idle;
     this->operation_failed_ = false;
     this->locked = false;
+    // Last, so the listener sees the coffee maker unlocked:
+    if (brewing && this->brew_listener_) {
+        this->brew_listener_(event);
+    }
 }
 
 void CoffeeMaker::reset_states() {
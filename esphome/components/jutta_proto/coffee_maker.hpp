@@ -1,17 +1,23 @@
 #pragma once
 
+#include <array>
 #include <chrono>
 #include <cstdint>
-#include <map>
+#include <functional>
 #include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "jutta_connection.hpp"
+#include "latency_histogram.hpp"
+#include "rtt_estimator.hpp"
 
 //---------------------------------------------------------------------------
 namespace jutta_proto {
 //---------------------------------------------------------------------------
+struct ModelProfile;
+
 class CoffeeMaker {
  public:
     /**
@@ -27,6 +33,7 @@ class CoffeeMaker {
         ESPRESSO_DOPPIO = 6,
         MACCHIATO = 7,
     };
+    static constexpr size_t NUM_COFFEES = 8;
     enum jutta_button_t {
         BUTTON_1 = 1,
         BUTTON_2 = 2,
@@ -36,18 +43,48 @@ class CoffeeMaker {
         BUTTON_6 = 6,
     };
 
-    std::unique_ptr<JuttaConnection> connection;
+    /**
+     * Outcome counters for all brew operations since boot.
+     **/
+    struct BrewStats {
+        uint32_t finished{0};
+        uint32_t failed{0};
+    };
 
- private:
-    static constexpr size_t NUM_PAGES = 2;
     /**
-     * Mapping of all coffee types to page.
+     * Commands are grouped by their prefix for the latency statistics.
      **/
-    std::map<coffee_t, size_t> coffee_page_map{{coffee_t::ESPRESSO, 0}, {coffee_t::COFFEE, 0}, {coffee_t::CAPPUCCINO, 0}, {coffee_t::MILK_FOAM, 0}, {coffee_t::CAFFE_BARISTA, 1}, {coffee_t::LUNGO_BARISTA, 1}, {coffee_t::ESPRESSO_DOPPIO, 1}, {coffee_t::MACCHIATO, 1}};
+    enum class CommandClass : uint8_t { FN = 0, FA = 1, OTHER = 2 };
+
     /**
-     * Mapping of all coffee types to their button.
+     * Lifecycle of a brew operation, reported to the listener set with set_brew_listener().
      **/
-    std::map<coffee_t, jutta_button_t> coffee_button_map{{coffee_t::ESPRESSO, jutta_button_t::BUTTON_1}, {coffee_t::COFFEE, jutta_button_t::BUTTON_2}, {coffee_t::CAPPUCCINO, jutta_button_t::BUTTON_4}, {coffee_t::MILK_FOAM, jutta_button_t::BUTTON_5}, {coffee_t::CAFFE_BARISTA, jutta_button_t::BUTTON_1}, {coffee_t::LUNGO_BARISTA, jutta_button_t::BUTTON_2}, {coffee_t::ESPRESSO_DOPPIO, jutta_button_t::BUTTON_4}, {coffee_t::MACCHIATO, jutta_button_t::BUTTON_5}};
+    enum class BrewEvent : uint8_t { STARTED, FINISHED, CANCELLED, FAILED };
+    using BrewListener = std::function<void(BrewEvent event)>;
+    static constexpr size_t NUM_COMMAND_CLASSES = 3;
+
+    /**
+     * Timing of all commands of one class since boot.
+     * tx: Writing the command, ack: From the last written byte until the "ok:", delay: Waiting after the "ok:".
+     * rtt: Learns how long to wait for the "ok:" from the ack times.
+     **/
+    struct CommandLatency {
+        LatencyHistogram tx{};
+        LatencyHistogram ack{};
+        LatencyHistogram delay{};
+        RttEstimator rtt{};
+        // Every "ok:" that did not arrive in time, including the ones a resend made up for.
+        uint32_t timeouts{0};
+        uint32_t retries{0};
+    };
+
+    std::unique_ptr<JuttaConnection> connection;
+
+ private:
+    /**
+     * Layout and timing of the connected model, see model_profiles.hpp.
+     **/
+    const ModelProfile* profile_;
 
     /**
      * The current page we are on.
@@ -65,6 +102,26 @@ class CoffeeMaker {
      **/
     explicit CoffeeMaker(std::unique_ptr<JuttaConnection>&& connection);
 
+    /**
+     * Selects the layout and timing of the connected model and applies its byte gap to the connection.
+     * Starts with DEFAULT_MODEL_PROFILE. Has to be called again after replacing the connection.
+     **/
+    void set_profile(const ModelProfile& profile);
+    [[nodiscard]] const ModelProfile& get_profile() const { return *this->profile_; }
+
+    /**
+     * Sets the bounds of the learned "ok:" timeouts and how often commands that are safe to repeat get resent
+     * after a timeout.
+     **/
+    void set_ack_timeout(uint32_t min_timeout_ms, uint32_t max_timeout_ms, uint8_t max_retries);
+
+    /**
+     * Gets called when a brew starts and once it finished, got cancelled or failed.
+     * Called from within brew_coffee(), brew_custom_coffee(), loop() and abort(), so it must not start a new
+     * operation itself.
+     **/
+    void set_brew_listener(BrewListener listener) { this->brew_listener_ = std::move(listener); }
+
     /**
      * Switches to the next page.
      * 0 -> 1
@@ -93,12 +150,35 @@ class CoffeeMaker {
      * Has to be called regularly from the ESPHome loop.
      **/
     void loop();
+    /**
+     * Gives up on the current operation, e.g. because the connection to the coffee maker got lost.
+     * A running brew counts as failed. Since the coffee maker starts on the first page again once it restarts, the
+     * page gets reset as well.
+     **/
+    void abort();
 
     /**
      * Returns true in case the coffee maker is locked due to it currently interacting with the coffee maker e.g. brewing a coffee.
      **/
     [[nodiscard]] bool is_locked() const;
 
+    /**
+     * Returns how many brew operations finished and how many of them failed.
+     **/
+    [[nodiscard]] const BrewStats& get_brew_stats() const { return this->brew_stats_; }
+
+    /**
+     * Returns the number of commands in a row that did not get acknowledged in time.
+     **/
+    [[nodiscard]] uint32_t get_consecutive_timeouts() const { return this->consecutive_timeouts_; }
+
+    /**
+     * Returns the latency statistics for the given command class.
+     **/
+    [[nodiscard]] const CommandLatency& get_command_latency(CommandClass command_class) const {
+        return this->command_latency_[static_cast<size_t>(command_class)];
+    }
+
  private:
     enum class CommandResult { InProgress, Success, Timeout, Error };
     enum class StepResult { InProgress, Done, Failed };
@@ -106,11 +186,24 @@ class CoffeeMaker {
 
     struct CommandState {
         bool active{false};
-        std::string command{};
+        // One of the constants from jutta_commands.hpp, so no copy is needed.
+        const std::string* command{nullptr};
+        CommandClass command_class{CommandClass::OTHER};
         uint32_t delay_ms{0};
         uint32_t delay_target{0};
+        // Written, but maybe still queued for the TX scheduler.
+        bool queued{false};
         bool sent{false};
-        std::chrono::milliseconds timeout{std::chrono::milliseconds{5000}};
+        bool acked{false};
+        // Transmissions so far, more than one means the command got resent.
+        uint8_t attempts{0};
+        // Zero for the learned timeout of the command class.
+        std::chrono::milliseconds fixed_timeout{0};
+        std::chrono::milliseconds timeout{std::chrono::milliseconds{RttEstimator::DEFAULT_MAX_TIMEOUT_MS}};
+        // millis() when the command got started, completely written and acknowledged.
+        uint32_t start_time{0};
+        uint32_t sent_time{0};
+        uint32_t ack_time{0};
 
         void reset();
     };
@@ -203,11 +296,16 @@ class CoffeeMaker {
     void finish_operation();
     [[nodiscard]] static bool time_reached(uint32_t now, uint32_t target);
     [[nodiscard]] StepResult ensure_page(size_t target_page);
+    // The command gets referenced until it finished, pass one of the constants from jutta_commands.hpp.
+    // Without a timeout the one learned for the command class is used.
     [[nodiscard]] CommandResult run_command(const std::string& command, uint32_t delay_ms = 0,
-                                            const std::chrono::milliseconds& timeout = std::chrono::milliseconds{5000});
+                                            const std::chrono::milliseconds& timeout = std::chrono::milliseconds{0});
     [[nodiscard]] CommandResult run_press_button(jutta_button_t button);
     [[nodiscard]] bool handle_command(CommandResult result, const char* description);
     [[nodiscard]] const std::string& command_for_button(jutta_button_t button) const;
+    [[nodiscard]] static CommandClass classify_command(const std::string& command);
+    // Button presses must not be repeated, a lost "ok:" does not mean the coffee maker missed the press.
+    [[nodiscard]] static bool is_idempotent(CommandClass command_class) { return command_class == CommandClass::FN; }
     void handle_switch_page();
     void handle_brew_coffee();
     void handle_custom_brew();
@@ -223,6 +321,11 @@ class CoffeeMaker {
     HotWaterState hot_water_state_{};
     CommandState command_state_{};
     bool operation_failed_{false};
+    BrewStats brew_stats_{};
+    BrewListener brew_listener_{};
+    uint32_t consecutive_timeouts_{0};
+    uint8_t max_retries_{2};
+    std::array<CommandLatency, NUM_COMMAND_CLASSES> command_latency_{};
 };
 
 // Backwards-compatible aliases for generated ESPHome code that still references
@@ -0,0 +1,151 @@
+#include "fault_injection.hpp"
+
+#ifdef USE_JUTTA_FAULT_INJECTION
+
+#include <algorithm>
+#include <cstddef>
+#include <utility>
+
+#include "esphome/core/time.h"
+#include "jutta_codec.hpp"
+
+//---------------------------------------------------------------------------
+namespace serial {
+//---------------------------------------------------------------------------
+namespace {
+// A complete "ok:\r\n" takes 20 encoded bytes with 8 ms in between.
+// Partial replies get released again after this time.
+constexpr uint32_t OK_HOLD_MS = 250;
+}  // namespace
+
+FaultInjectingTransport::FaultInjectingTransport(const Transport& inner, const FaultProfile& profile,
+                                                 std::vector<uint8_t> ok_pattern)
+    : inner_(inner), profile_(profile), ok_pattern_(std::move(ok_pattern)), rng_state_(profile.seed == 0 ? 1 : profile.seed) {}
+
+size_t FaultInjectingTransport::read_serial(std::array<uint8_t, 4>& buffer) const {
+    uint32_t now = esphome::millis();
+    if (this->gap_active_) {
+        if (now - this->gap_start_ < this->profile_.gap_ms) {
+            return 0;
+        }
+        this->gap_active_ = false;
+    }
+
+    size_t received = this->pull();
+    if (received > 0 && this->roll(this->profile_.gap_rate)) {
+        // Keep the bytes but pretend the line is silent for a while:
+        this->gap_active_ = true;
+        this->gap_start_ = now;
+        ++this->stats_.gaps_stretched;
+        return 0;
+    }
+
+    this->release_pending();
+    size_t count = std::min(buffer.size(), this->cleared_);
+    std::copy_n(this->pending_.begin(), count, buffer.begin());
+    this->pending_.erase(this->pending_.begin(), this->pending_.begin() + static_cast<std::ptrdiff_t>(count));
+    this->cleared_ -= count;
+    return count;
+}
+
+bool FaultInjectingTransport::write_serial_byte(uint8_t byte) const {
+    return this->inner_.write_serial_byte(byte);
+}
+
+void FaultInjectingTransport::flush() const {
+    this->inner_.flush();
+}
+
+void FaultInjectingTransport::wait_for_gap(uint32_t gap_us) const {
+    this->inner_.wait_for_gap(gap_us);
+}
+
+bool FaultInjectingTransport::roll(float rate) const {
+    if (rate <= 0) {
+        return false;
+    }
+    // xorshift32, good enough for fault injection and reproducible by seed:
+    uint32_t x = this->rng_state_;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    this->rng_state_ = x;
+    return static_cast<float>(x) < rate * 4294967296.0f;
+}
+
+size_t FaultInjectingTransport::pull() const {
+    std::array<uint8_t, 4> chunk{};
+    size_t size = this->inner_.read_serial(chunk);
+    size = std::min(size, chunk.size());
+
+    for (size_t i = 0; i < size; i++) {
+        uint8_t byte = chunk[i];
+        ++this->stats_.bytes_seen;
+        if (this->roll(this->profile_.drop_rate)) {
+            ++this->stats_.bytes_dropped;
+            continue;
+        }
+        if (this->roll(this->profile_.bit_flip_rate)) {
+            byte ^= static_cast<uint8_t>(1U << (this->rng_state_ % 8));
+            ++this->stats_.bits_flipped;
+        }
+        this->pending_.push_back(byte);
+        if (this->roll(this->profile_.duplicate_rate)) {
+            this->pending_.push_back(byte);
+            ++this->stats_.bytes_duplicated;
+        }
+    }
+    return size;
+}
+
+void FaultInjectingTransport::release_pending() const {
+    if (this->profile_.lost_ok_rate <= 0 || this->ok_pattern_.empty()) {
+        this->cleared_ = this->pending_.size();
+        return;
+    }
+
+    const size_t pattern_size = this->ok_pattern_.size();
+    while (this->cleared_ < this->pending_.size()) {
+        size_t matched = 0;
+        while (matched < pattern_size && this->cleared_ + matched < this->pending_.size() &&
+               jutta_proto::codec::normalize_encoded_byte(this->pending_[this->cleared_ + matched]) ==
+                   jutta_proto::codec::normalize_encoded_byte(this->ok_pattern_[matched])) {
+            ++matched;
+        }
+
+        if (matched == pattern_size) {
+            this->holding_ = false;
+            if (this->roll(this->profile_.lost_ok_rate)) {
+                auto start = this->pending_.begin() + static_cast<std::ptrdiff_t>(this->cleared_);
+                this->pending_.erase(start, start + static_cast<std::ptrdiff_t>(pattern_size));
+                ++this->stats_.oks_dropped;
+            } else {
+                this->cleared_ += pattern_size;
+            }
+            continue;
+        }
+
+        if (matched > 0 && this->cleared_ + matched == this->pending_.size()) {
+            // Might become an "ok:\r\n" - hold it back until it completes or the line stays quiet for too long:
+            uint32_t now = esphome::millis();
+            if (!this->holding_) {
+                this->holding_ = true;
+                this->hold_start_ = now;
+            }
+            if (now - this->hold_start_ < OK_HOLD_MS) {
+                return;
+            }
+            this->holding_ = false;
+            this->cleared_ = this->pending_.size();
+            return;
+        }
+
+        this->holding_ = false;
+        ++this->cleared_;
+    }
+}
+//---------------------------------------------------------------------------
+}  // namespace serial
+//---------------------------------------------------------------------------
+
+#endif  // USE_JUTTA_FAULT_INJECTION
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "esphome/core/defines.h"
+
+#ifdef USE_JUTTA_FAULT_INJECTION
+
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "serial_connection.hpp"
+
+//---------------------------------------------------------------------------
+namespace serial {
+//---------------------------------------------------------------------------
+/**
+ * Fault rates applied by the FaultInjectingTransport.
+ * All rates are probabilities in the range [0, 1].
+ **/
+struct FaultProfile {
+    // Chance of flipping a random bit in a received byte.
+    float bit_flip_rate{0};
+    // Chance of dropping a received byte.
+    float drop_rate{0};
+    // Chance of delivering a received byte twice.
+    float duplicate_rate{0};
+    // Chance of the line going silent for gap_ms after a read.
+    float gap_rate{0};
+    uint32_t gap_ms{0};
+    // Chance of swallowing a complete "ok:\r\n" reply.
+    float lost_ok_rate{0};
+    uint32_t seed{1};
+};
+
+/**
+ * Counts of the faults actually injected so far.
+ **/
+struct FaultStats {
+    uint32_t bytes_seen{0};
+    uint32_t bits_flipped{0};
+    uint32_t bytes_dropped{0};
+    uint32_t bytes_duplicated{0};
+    uint32_t gaps_stretched{0};
+    uint32_t oks_dropped{0};
+};
+
+/**
+ * Transport decorator that corrupts the receive path of the wrapped transport.
+ * Used to exercise frame alignment, handshake restarts and command timeouts on the bench.
+ * Writes are passed through untouched.
+ **/
+class FaultInjectingTransport : public Transport {
+ public:
+    /**
+     * ok_pattern has to hold the encoded representation of "ok:\r\n".
+     **/
+    FaultInjectingTransport(const Transport& inner, const FaultProfile& profile, std::vector<uint8_t> ok_pattern);
+
+    [[nodiscard]] size_t read_serial(std::array<uint8_t, 4>& buffer) const override;
+    [[nodiscard]] bool write_serial_byte(uint8_t byte) const override;
+    void flush() const override;
+    void wait_for_gap(uint32_t gap_us) const override;
+
+    [[nodiscard]] const Transport& inner() const { return this->inner_; }
+    [[nodiscard]] const FaultProfile& profile() const { return this->profile_; }
+    [[nodiscard]] const FaultStats& stats() const { return this->stats_; }
+
+ private:
+    /**
+     * Returns true with the given probability.
+     **/
+    [[nodiscard]] bool roll(float rate) const;
+    /**
+     * Reads from the wrapped transport and applies the per byte faults.
+     * Returns the number of bytes received from the wrapped transport.
+     **/
+    size_t pull() const;
+    /**
+     * Advances the number of pending bytes that may be handed out.
+     * Holds back bytes that could still turn into an "ok:\r\n" reply.
+     **/
+    void release_pending() const;
+
+    const Transport& inner_;
+    FaultProfile profile_;
+    std::vector<uint8_t> ok_pattern_;
+
+    mutable std::deque<uint8_t> pending_{};
+    // Number of bytes at the front of pending_ that passed the "ok:" filter.
+    mutable size_t cleared_{0};
+    mutable uint32_t hold_start_{0};
+    mutable bool holding_{false};
+    mutable uint32_t gap_start_{0};
+    mutable bool gap_active_{false};
+    mutable uint32_t rng_state_;
+    mutable FaultStats stats_{};
+};
+//---------------------------------------------------------------------------
+}  // namespace serial
+//---------------------------------------------------------------------------
+
+#endif  // USE_JUTTA_FAULT_INJECTION
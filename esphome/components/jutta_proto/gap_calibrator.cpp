@@ -0,0 +1,143 @@
+#include "gap_calibrator.hpp"
+
+#ifdef USE_JUTTA_BYTE_GAP_CALIBRATION
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <string_view>
+
+#include "esphome/core/log.h"
+#include "esphome/core/time.h"
+#include "jutta_commands.hpp"
+#include "jutta_connection.hpp"
+
+//---------------------------------------------------------------------------
+namespace jutta_proto {
+//---------------------------------------------------------------------------
+static const char* const TAG = "jutta_gap_calibrator";
+
+// Longer replies are garbage, "ty:EF532M V02.03\r\n" has 18 characters.
+static constexpr size_t MAX_REPLY_SIZE = 64;
+
+static std::string_view without_terminator(std::string_view reply) {
+    while (!reply.empty() && (reply.back() == '\r' || reply.back() == '\n')) {
+        reply.remove_suffix(1);
+    }
+    return reply;
+}
+
+void GapCalibrator::start(uint32_t start_gap_us, const std::string& reference) {
+    this->stage_ = Stage::Search;
+    this->start_gap_us_ = start_gap_us;
+    this->gap_us_ = start_gap_us;
+    this->fastest_ok_us_ = 0;
+    this->probes_passed_ = 0;
+    this->probes_sent_ = 0;
+    this->sent_ = false;
+    this->reading_ = false;
+    this->reference_ = std::string(without_terminator(reference));
+    this->reply_.reserve(MAX_REPLY_SIZE);
+}
+
+GapCalibrator::Result GapCalibrator::step(JuttaConnection* connection) {
+    if (this->stage_ == Stage::Idle) {
+        return Result::Failed;
+    }
+    bool ok = false;
+    if (!this->poll_probe(connection, &ok)) {
+        return Result::Pending;
+    }
+    if (!ok) {
+        ESP_LOGD(TAG, "No valid reply with a %" PRIu32 " us gap: '%s'", this->gap_us_, this->reply_.c_str());
+        return this->next_gap(connection, false);
+    }
+    if (++this->probes_passed_ < PROBES_PER_GAP) {
+        return Result::Pending;
+    }
+    ESP_LOGD(TAG, "Coffee maker keeps up with a %" PRIu32 " us gap.", this->gap_us_);
+    return this->next_gap(connection, true);
+}
+
+bool GapCalibrator::poll_probe(JuttaConnection* connection, bool* ok) {
+    if (!this->sent_) {
+        connection->set_byte_gap(this->gap_us_);
+        this->reply_.clear();
+        this->sent_ = true;
+        this->reading_ = false;
+        ++this->probes_sent_;
+    }
+
+    if (!this->reading_) {
+        std::string_view chunk;
+        auto result =
+            connection->write_decoded_with_response(JUTTA_GET_TYPE, &chunk, std::chrono::milliseconds{PROBE_TIMEOUT_MS});
+        if (result == JuttaConnection::WaitResult::Pending) {
+            return false;
+        }
+        if (result != JuttaConnection::WaitResult::Success) {
+            this->sent_ = false;
+            *ok = false;
+            return true;
+        }
+        this->reply_.append(chunk.data(), std::min(chunk.size(), MAX_REPLY_SIZE));
+        this->reading_ = true;
+        this->probe_start_ms_ = esphome::millis();
+    } else {
+        uint8_t byte = 0;
+        while (this->reply_.size() < MAX_REPLY_SIZE && connection->read_decoded(&byte)) {
+            this->reply_.push_back(static_cast<char>(byte));
+            this->probe_start_ms_ = esphome::millis();
+        }
+    }
+
+    const bool complete = this->reply_.find("\r\n") != std::string::npos || connection->rx_idle();
+    if (!complete) {
+        // Give up once the coffee maker stopped sending:
+        if (this->reply_.size() < MAX_REPLY_SIZE && esphome::millis() - this->probe_start_ms_ < PROBE_TIMEOUT_MS) {
+            return false;
+        }
+        this->sent_ = false;
+        *ok = false;
+        return true;
+    }
+
+    this->sent_ = false;
+    *ok = without_terminator(this->reply_) == this->reference_;
+    return true;
+}
+
+GapCalibrator::Result GapCalibrator::next_gap(JuttaConnection* connection, bool passed) {
+    this->probes_passed_ = 0;
+    if (this->stage_ == Stage::Verify) {
+        return this->finish(connection, passed ? Result::Done : Result::Failed);
+    }
+    if (passed) {
+        this->fastest_ok_us_ = this->gap_us_;
+        if (this->gap_us_ / 2 >= MIN_GAP_US) {
+            this->gap_us_ /= 2;
+            return Result::Pending;
+        }
+    } else if (this->fastest_ok_us_ == 0) {
+        // Not even the start gap worked, there is nothing to compare against:
+        return this->finish(connection, Result::Failed);
+    }
+    this->gap_us_ =
+        std::min(this->start_gap_us_, this->fastest_ok_us_ + this->fastest_ok_us_ * SAFETY_MARGIN_PERCENT / 100);
+    this->stage_ = Stage::Verify;
+    return Result::Pending;
+}
+
+GapCalibrator::Result GapCalibrator::finish(JuttaConnection* connection, Result result) {
+    this->stage_ = Stage::Idle;
+    if (result != Result::Done) {
+        this->gap_us_ = this->start_gap_us_;
+    }
+    connection->set_byte_gap(this->gap_us_);
+    return result;
+}
+//---------------------------------------------------------------------------
+}  // namespace jutta_proto
+//---------------------------------------------------------------------------
+
+#endif
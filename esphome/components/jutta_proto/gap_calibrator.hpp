@@ -0,0 +1,86 @@
+#pragma once
+
+#include "esphome/core/defines.h"
+
+#ifdef USE_JUTTA_BYTE_GAP_CALIBRATION
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+//---------------------------------------------------------------------------
+namespace jutta_proto {
+//---------------------------------------------------------------------------
+class JuttaConnection;
+
+/**
+ * Finds the shortest pause after every encoded byte the coffee maker still keeps up with.
+ * Sends harmless "TY:" requests with the byte gap halved step by step and compares every reply to the one received
+ * during the handshake. The first gap that gets a wrong, incomplete or no reply ends the search. The result is the shortest gap
+ * that worked plus a safety margin, confirmed with a few more requests. Never longer than the start gap.
+ *
+ * Runs a few seconds, during which the connection must not be used for anything else.
+ **/
+class GapCalibrator {
+ public:
+    enum class Result : uint8_t { Pending, Done, Failed };
+
+    // Shortest gap tried.
+    static constexpr uint32_t MIN_GAP_US = 250;
+    // Requests every gap has to pass.
+    static constexpr size_t PROBES_PER_GAP = 3;
+    static constexpr uint32_t PROBE_TIMEOUT_MS = 500;
+    // Added to the shortest gap that worked.
+    static constexpr uint32_t SAFETY_MARGIN_PERCENT = 50;
+
+    /**
+     * Starts a new calibration from the given gap, which is known to work.
+     * reference is the "ty:" reply every probe has to get. A trailing "\r\n" is ignored on both sides, since some
+     * coffee makers leave it out and the reply then ends once the line goes idle.
+     **/
+    void start(uint32_t start_gap_us, const std::string& reference);
+    [[nodiscard]] bool is_running() const { return this->stage_ != Stage::Idle; }
+    /**
+     * Sends the next request or checks the reply to the last one. Call regularly until it stops returning Pending.
+     * Afterwards the connection uses the calibrated gap (Done) or the start gap again (Failed).
+     **/
+    Result step(JuttaConnection* connection);
+
+    /**
+     * The calibrated gap, valid once step() returned Done.
+     **/
+    [[nodiscard]] uint32_t get_gap() const { return this->gap_us_; }
+    [[nodiscard]] uint32_t get_probes_sent() const { return this->probes_sent_; }
+    /**
+     * Shortest gap the coffee maker answered correctly to, 0 in case even the start gap failed.
+     **/
+    [[nodiscard]] uint32_t get_fastest_gap() const { return this->fastest_ok_us_; }
+
+ private:
+    enum class Stage : uint8_t { Idle, Search, Verify };
+
+    // Returns true once the current request got its reply or failed, with the outcome in ok.
+    bool poll_probe(JuttaConnection* connection, bool* ok);
+    // Moves on after all probes of the current gap passed or one failed.
+    Result next_gap(JuttaConnection* connection, bool passed);
+    Result finish(JuttaConnection* connection, Result result);
+
+    Stage stage_{Stage::Idle};
+    uint32_t start_gap_us_{0};
+    // Gap currently being tried.
+    uint32_t gap_us_{0};
+    uint32_t fastest_ok_us_{0};
+    size_t probes_passed_{0};
+    uint32_t probes_sent_{0};
+    // The request has been written and the first part of its reply is in.
+    bool sent_{false};
+    bool reading_{false};
+    uint32_t probe_start_ms_{0};
+    std::string reference_{};
+    std::string reply_{};
+};
+//---------------------------------------------------------------------------
+}  // namespace jutta_proto
+//---------------------------------------------------------------------------
+
+#endif
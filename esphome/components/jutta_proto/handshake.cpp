@@ -0,0 +1,236 @@
+#include "handshake.hpp"
+
+#include <chrono>
+#include <string_view>
+
+#include "esphome/core/log.h"
+#include "esphome/core/time.h"
+#include "jutta_commands.hpp"
+#include "jutta_connection.hpp"
+
+//---------------------------------------------------------------------------
+namespace jutta_proto {
+//---------------------------------------------------------------------------
+static const char* const TAG = "jutta_handshake";
+
+// How long to wait for the reply to "TY:" and "IC:" while resuming, and for "@T2" and "@T3".
+static constexpr uint32_t RESUME_TIMEOUT_MS = 1000;
+static constexpr uint32_t KEY_TIMEOUT_MS = 5000;
+
+Handshake::Handshake() {
+    // Reserved once, so the strings do not grow later on:
+    this->buffer_.reserve(BUFFER_SIZE + 1);
+    this->device_type_.reserve(DEVICE_TYPE_SIZE);
+    this->t2_response_.reserve(RESPONSE_SIZE);
+    this->t3_response_.reserve(RESPONSE_SIZE);
+    this->cached_device_type_.reserve(DEVICE_TYPE_SIZE);
+    this->cached_t2_response_.reserve(RESPONSE_SIZE);
+    this->cached_t3_response_.reserve(RESPONSE_SIZE);
+}
+
+void Handshake::start() {
+    this->cached_device_type_.clear();
+    this->cached_t2_response_.clear();
+    this->cached_t3_response_.clear();
+    this->restarts_ = 0;
+    this->resumed_ = false;
+    this->buffer_.clear();
+    this->deadline_ = 0;
+    this->stage_ = Stage::HELLO;
+}
+
+void Handshake::resume(const char* device_type, const char* t2_response, const char* t3_response) {
+    this->start();
+    this->cached_device_type_ = device_type;
+    this->cached_t2_response_ = t2_response;
+    this->cached_t3_response_ = t3_response;
+    this->stage_ = Stage::RESUME;
+}
+
+Handshake::Result Handshake::step(JuttaConnection* connection) {
+    switch (this->stage_) {
+        case Stage::IDLE:
+        case Stage::DONE:
+            break;
+        case Stage::RESUME: {
+            // In case the coffee maker still reports the same type, it is the one we exchanged keys with last time.
+            if (this->deadline_ == 0) {
+                this->deadline_ = esphome::millis() + RESUME_TIMEOUT_MS;
+            }
+            std::string_view response;
+            auto wait_result = connection->write_decoded_with_response(JUTTA_GET_TYPE, &response,
+                                                                       std::chrono::milliseconds{RESUME_TIMEOUT_MS});
+            if (wait_result == JuttaConnection::WaitResult::Success) {
+                this->device_type_.assign(response.data(), response.size());
+                this->deadline_ = 0;
+                if (this->device_type_ == this->cached_device_type_) {
+                    this->stage_ = Stage::RESUME_SESSION;
+                } else {
+                    ESP_LOGI(TAG, "Coffee maker reported %s, running the full handshake.", this->device_type_.c_str());
+                    this->buffer_.clear();
+                    this->stage_ = Stage::SEND_T1;
+                }
+            } else if (time_reached(esphome::millis(), this->deadline_)) {
+                this->restart("no answer to the fast resume probe");
+            }
+            break;
+        }
+        case Stage::RESUME_SESSION: {
+            // "TY:" gets answered without a session as well. Only a command that needs one tells whether the coffee
+            // maker still has the session, a power cycle ends it.
+            if (this->deadline_ == 0) {
+                this->deadline_ = esphome::millis() + RESUME_TIMEOUT_MS;
+            }
+            std::string_view response;
+            auto wait_result = connection->write_decoded_with_response(JUTTA_READ_INPUTS, &response,
+                                                                       std::chrono::milliseconds{RESUME_TIMEOUT_MS});
+            if (wait_result == JuttaConnection::WaitResult::Pending &&
+                !time_reached(esphome::millis(), this->deadline_)) {
+                break;
+            }
+            this->deadline_ = 0;
+            if (wait_result == JuttaConnection::WaitResult::Success && response.substr(0, 3) == "ic:") {
+                this->t2_response_ = this->cached_t2_response_;
+                this->t3_response_ = this->cached_t3_response_;
+                return this->finish(true);
+            }
+            ESP_LOGI(TAG, "Coffee maker no longer has the cached session, running the key exchange.");
+            this->buffer_.clear();
+            this->stage_ = Stage::SEND_T1;
+            break;
+        }
+        case Stage::HELLO: {
+            std::string_view response;
+            auto wait_result = connection->write_decoded_with_response(JUTTA_GET_TYPE, &response,
+                                                                       std::chrono::milliseconds{RESUME_TIMEOUT_MS});
+            if (wait_result == JuttaConnection::WaitResult::Success) {
+                this->device_type_.assign(response.data(), response.size());
+                ESP_LOGI(TAG, "Detected coffee maker response: %s", this->device_type_.c_str());
+                this->buffer_.clear();
+                this->stage_ = Stage::SEND_T1;
+            }
+            break;
+        }
+        case Stage::SEND_T1: {
+            auto wait_result = connection->write_decoded_wait_for(JUTTA_KEY_EXCHANGE_T1, JUTTA_KEY_EXCHANGE_T1_ACK,
+                                                                  std::chrono::milliseconds{RESUME_TIMEOUT_MS});
+            if (wait_result == JuttaConnection::WaitResult::Success) {
+                ESP_LOGD(TAG, "Received @t1 acknowledgment.");
+                this->buffer_.clear();
+                this->deadline_ = 0;
+                this->stage_ = Stage::WAIT_T2;
+            } else if (wait_result == JuttaConnection::WaitResult::Timeout) {
+                this->restart("timeout waiting for @t1");
+            } else if (wait_result == JuttaConnection::WaitResult::Error) {
+                this->restart("failed to send @T1");
+            }
+            break;
+        }
+        case Stage::WAIT_T2:
+            this->wait_for_key(connection, "@T2", &this->t2_response_, Stage::SEND_T2);
+            break;
+        case Stage::SEND_T2:
+            if (connection->write_decoded(JUTTA_KEY_EXCHANGE_T2_REPLY)) {
+                ESP_LOGD(TAG, "Sent @t2 response.");
+                this->buffer_.clear();
+                this->deadline_ = 0;
+                this->stage_ = Stage::WAIT_T3;
+            } else {
+                this->restart("failed to send @t2");
+            }
+            break;
+        case Stage::WAIT_T3:
+            this->wait_for_key(connection, "@T3", &this->t3_response_, Stage::SEND_T3);
+            break;
+        case Stage::SEND_T3:
+            if (connection->write_decoded(JUTTA_KEY_EXCHANGE_T3_ACK)) {
+                return this->finish(false);
+            }
+            this->restart("failed to send @t3");
+            break;
+    }
+    return Result::Pending;
+}
+
+const char* Handshake::get_stage_name() const {
+    switch (this->stage_) {
+        case Stage::IDLE:
+            return "idle";
+        case Stage::RESUME:
+            return "probing for fast resume";
+        case Stage::RESUME_SESSION:
+            return "probing the cached session";
+        case Stage::HELLO:
+            return "awaiting type";
+        case Stage::SEND_T1:
+            return "waiting for @t1";
+        case Stage::WAIT_T2:
+            return "waiting for @T2";
+        case Stage::SEND_T2:
+            return "sending @t2";
+        case Stage::WAIT_T3:
+            return "waiting for @T3";
+        case Stage::SEND_T3:
+            return "sending @t3";
+        case Stage::DONE:
+            return this->resumed_ ? "ready (resumed)" : "ready";
+    }
+    return "unknown";
+}
+
+void Handshake::restart(const char* reason) {
+    ESP_LOGW(TAG, "Restarting handshake: %s", reason);
+    ++this->restarts_;
+    this->buffer_.clear();
+    this->deadline_ = 0;
+    this->stage_ = Stage::HELLO;
+}
+
+Handshake::Result Handshake::finish(bool resumed) {
+    this->resumed_ = resumed;
+    this->buffer_.clear();
+    this->deadline_ = 0;
+    this->stage_ = Stage::DONE;
+    return resumed ? Result::Resumed : Result::Done;
+}
+
+bool Handshake::read_bytes(JuttaConnection* connection) {
+    bool read_any = false;
+    uint8_t byte = 0;
+    while (connection->read_decoded(&byte)) {
+        read_any = true;
+        this->buffer_.push_back(static_cast<char>(byte));
+        if (this->buffer_.size() > BUFFER_SIZE) {
+            this->buffer_.erase(0, this->buffer_.size() - BUFFER_SIZE);
+        }
+    }
+    return read_any;
+}
+
+void Handshake::wait_for_key(JuttaConnection* connection, const char* key, std::string* response, Stage next) {
+    if (this->deadline_ == 0) {
+        this->deadline_ = esphome::millis() + KEY_TIMEOUT_MS;
+    }
+    bool any = this->read_bytes(connection);
+    auto pos = this->buffer_.find(key);
+    if (pos != std::string::npos) {
+        auto end = this->buffer_.find("\r\n", pos);
+        // Some coffee makers leave out the "\r\n", then the key is complete once the line goes quiet:
+        if (end != std::string::npos || (!any && connection->rx_idle())) {
+            response->assign(this->buffer_, pos, end != std::string::npos ? end - pos : std::string::npos);
+            ESP_LOGD(TAG, "Received %s", response->c_str());
+            this->buffer_.clear();
+            this->deadline_ = 0;
+            this->stage_ = next;
+            return;
+        }
+    }
+    if (time_reached(esphome::millis(), this->deadline_)) {
+        this->restart(key[2] == '2' ? "timeout waiting for @T2" : "timeout waiting for @T3");
+    }
+}
+
+bool Handshake::time_reached(uint32_t now, uint32_t target) { return static_cast<int32_t>(now - target) >= 0; }
+//---------------------------------------------------------------------------
+}  // namespace jutta_proto
+//---------------------------------------------------------------------------
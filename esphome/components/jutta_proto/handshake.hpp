@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+//---------------------------------------------------------------------------
+namespace jutta_proto {
+//---------------------------------------------------------------------------
+class JuttaConnection;
+
+/**
+ * Key exchange with the coffee maker: "TY:", "@T1", wait for "@T2", answer "@t2", wait for "@T3" and answer "@t3".
+ * Anything going wrong starts over with "TY:".
+ * Given the result of an earlier key exchange, it first checks whether the coffee maker still reports the same type and
+ * still has that session, and skips the key exchange in that case.
+ *
+ * Only depends on the connection, so tools/jutta_replay.cpp runs the same code on the host.
+ **/
+class Handshake {
+ public:
+    enum class Stage : uint8_t {
+        IDLE,
+        RESUME,
+        RESUME_SESSION,
+        HELLO,
+        SEND_T1,
+        WAIT_T2,
+        SEND_T2,
+        WAIT_T3,
+        SEND_T3,
+        DONE,
+    };
+    enum class Result : uint8_t { Pending, Done, Resumed };
+
+    // Received bytes kept while looking for "@T2" and "@T3", and the longest key and type kept without allocating.
+    static constexpr size_t BUFFER_SIZE = 128;
+    static constexpr size_t RESPONSE_SIZE = 32;
+    static constexpr size_t DEVICE_TYPE_SIZE = 48;
+
+    Handshake();
+
+    /**
+     * Starts a full key exchange.
+     **/
+    void start();
+    /**
+     * Starts by checking whether the coffee maker still reports device_type and still has the session the given keys
+     * belong to. Falls back to the full key exchange otherwise.
+     **/
+    void resume(const char* device_type, const char* t2_response, const char* t3_response);
+    /**
+     * Sends the next request or checks the reply to the last one. Call regularly until it stops returning Pending.
+     * Resumed in case the earlier session is still valid.
+     **/
+    Result step(JuttaConnection* connection);
+
+    [[nodiscard]] Stage get_stage() const { return this->stage_; }
+    [[nodiscard]] bool is_running() const { return this->stage_ != Stage::IDLE && this->stage_ != Stage::DONE; }
+    [[nodiscard]] const char* get_stage_name() const;
+    /**
+     * The "ty:" reply, the keys of the last key exchange and whether the session got resumed instead.
+     **/
+    [[nodiscard]] const std::string& get_device_type() const { return this->device_type_; }
+    [[nodiscard]] const std::string& get_t2_response() const { return this->t2_response_; }
+    [[nodiscard]] const std::string& get_t3_response() const { return this->t3_response_; }
+    [[nodiscard]] bool was_resumed() const { return this->resumed_; }
+    /**
+     * Number of times it had to start over since start() or resume().
+     **/
+    [[nodiscard]] uint32_t get_restarts() const { return this->restarts_; }
+
+ private:
+    void restart(const char* reason);
+    Result finish(bool resumed);
+    // Reads everything received so far into buffer_, returns true in case anything arrived.
+    bool read_bytes(JuttaConnection* connection);
+    // Waits up to five seconds for a line starting with key, stores it in response and moves on to next.
+    void wait_for_key(JuttaConnection* connection, const char* key, std::string* response, Stage next);
+    static bool time_reached(uint32_t now, uint32_t target);
+
+    Stage stage_{Stage::IDLE};
+    std::string buffer_{};
+    std::string device_type_{};
+    std::string t2_response_{};
+    std::string t3_response_{};
+    // The session to resume and the coffee maker it belongs to.
+    std::string cached_device_type_{};
+    std::string cached_t2_response_{};
+    std::string cached_t3_response_{};
+    // millis() the current request or wait times out at, 0 before it started.
+    uint32_t deadline_{0};
+    uint32_t restarts_{0};
+    bool resumed_{false};
+};
+//---------------------------------------------------------------------------
+}  // namespace jutta_proto
+//---------------------------------------------------------------------------
@@ -0,0 +1,66 @@
+#include "heap_report.hpp"
+
+#ifdef USE_JUTTA_HEAP_FREE
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+//---------------------------------------------------------------------------
+namespace jutta_proto {
+namespace heap {
+//---------------------------------------------------------------------------
+namespace {
+// Per task, so allocations of the main loop, API or logger tasks do not count while a Scope is active on the protocol
+// task, e.g. during a vTaskDelay() in wait_for_gap(). ESP-IDF keeps thread_local variables per FreeRTOS task.
+thread_local uint32_t depth = 0;
+// Atomic, Scopes on different tasks count into the same total.
+std::atomic<uint32_t> counted{0};
+}  // namespace
+
+Scope::Scope() { ++depth; }
+
+Scope::~Scope() { --depth; }
+
+uint32_t allocations() { return counted.load(std::memory_order_relaxed); }
+
+/**
+ * Counts the allocation in case a Scope is active. Returns nullptr in case malloc() failed.
+ **/
+void* allocate(size_t size) {
+    if (depth > 0) {
+        counted.fetch_add(1, std::memory_order_relaxed);
+    }
+    return std::malloc(size == 0 ? 1 : size);
+}
+
+void* allocate_or_fail(size_t size) {
+    void* ptr = allocate(size);
+    if (ptr == nullptr) {
+#ifdef __cpp_exceptions
+        throw std::bad_alloc();
+#else
+        std::abort();
+#endif
+    }
+    return ptr;
+}
+//---------------------------------------------------------------------------
+}  // namespace heap
+}  // namespace jutta_proto
+//---------------------------------------------------------------------------
+
+// Replacements of the global allocation functions, see heap_report.hpp. The aligned variants are left alone, they
+// come with their own matching deallocation functions.
+void* operator new(size_t size) { return jutta_proto::heap::allocate_or_fail(size); }
+void* operator new[](size_t size) { return jutta_proto::heap::allocate_or_fail(size); }
+void* operator new(size_t size, const std::nothrow_t& /*tag*/) noexcept { return jutta_proto::heap::allocate(size); }
+void* operator new[](size_t size, const std::nothrow_t& /*tag*/) noexcept { return jutta_proto::heap::allocate(size); }
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, size_t /*size*/) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, size_t /*size*/) noexcept { std::free(ptr); }
+void operator delete(void* ptr, const std::nothrow_t& /*tag*/) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, const std::nothrow_t& /*tag*/) noexcept { std::free(ptr); }
+
+#endif
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "esphome/core/defines.h"
+
+#ifdef USE_JUTTA_HEAP_FREE
+#include <cstddef>
+#include <cstdint>
+#endif
+
+//---------------------------------------------------------------------------
+namespace jutta_proto {
+//---------------------------------------------------------------------------
+#ifdef USE_JUTTA_HEAP_FREE
+/**
+ * Counts the C++ heap allocations (operator new) made by the component.
+ * With "heap_free: true" the global operator new gets replaced by one that forwards to malloc() and, while a Scope is
+ * active, counts the call. Allocations of other components and of plain malloc() are not counted.
+ **/
+namespace heap {
+/**
+ * Counts the allocations of the current task until it goes out of scope. Scopes nest.
+ **/
+class Scope {
+ public:
+    Scope();
+    ~Scope();
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+};
+
+/**
+ * Allocations counted so far.
+ **/
+uint32_t allocations();
+
+// Used by the replaced global operator new.
+void* allocate(size_t size);
+void* allocate_or_fail(size_t size);
+}  // namespace heap
+#endif
+//---------------------------------------------------------------------------
+}  // namespace jutta_proto
+//---------------------------------------------------------------------------
+
+#ifdef USE_JUTTA_HEAP_FREE
+#define JUTTA_HEAP_SCOPE() ::jutta_proto::heap::Scope jutta_heap_scope_
+#else
+#define JUTTA_HEAP_SCOPE()
+#endif
@@ -0,0 +1,196 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+//---------------------------------------------------------------------------
+namespace jutta_proto {
+//---------------------------------------------------------------------------
+/**
+ * The JUTTA obfuscation and frame validation without any ESPHome dependencies.
+ * Shared between the JuttaConnection and the host side tools in "tools/".
+ **/
+namespace codec {
+//---------------------------------------------------------------------------
+// Every data byte is sent as four encoded bytes.
+constexpr size_t FRAME_SIZE = 4;
+// Bit 7 of an encoded byte is not part of the protocol and ignored.
+constexpr uint8_t JUTTA_BYTE_MASK = 0x7F;
+
+using frame_t = std::array<uint8_t, FRAME_SIZE>;
+
+/**
+ * Encodes the given byte into four bytes that the coffee maker understands.
+ * Based on: http://protocoljura.wiki-site.com/index.php/Protocol_to_coffeemaker
+ *
+ * A full documentation of the process can be found here:
+ * https://github.com/Jutta-Proto/protocol-cpp#deobfuscating
+ **/
+constexpr frame_t encode(uint8_t decData) {
+    // 1111 0000 -> 0000 1111:
+    uint8_t tmp = ((decData & 0xF0) >> 4) | ((decData & 0x0F) << 4);
+
+    // 1100 1100 -> 0011 0011:
+    tmp = ((tmp & 0xC0) >> 2) | ((tmp & 0x30) << 2) | ((tmp & 0x0C) >> 2) | ((tmp & 0x03) << 2);
+
+    // The base bit layout for all send bytes:
+    constexpr uint8_t BASE = 0b01011011;
+
+    frame_t encData{};
+    encData[0] = BASE | ((tmp & 0b10000000) >> 2);
+    encData[0] |= ((tmp & 0b01000000) >> 4);
+
+    encData[1] = BASE | (tmp & 0b00100000);
+    encData[1] |= ((tmp & 0b00010000) >> 2);
+
+    encData[2] = BASE | ((tmp & 0b00001000) << 2);
+    encData[2] |= (tmp & 0b00000100);
+
+    encData[3] = BASE | ((tmp & 0b00000010) << 4);
+    encData[3] |= ((tmp & 0b00000001) << 2);
+
+    return encData;
+}
+
+/**
+ * Decodes the given four bytes read from the coffee maker into on byte.
+ * Based on: http://protocoljura.wiki-site.com/index.php/Protocol_to_coffeemaker
+ *
+ * A full documentation of the process can be found here:
+ * https://github.com/Jutta-Proto/protocol-cpp#deobfuscating
+ **/
+constexpr uint8_t decode(const frame_t& encData) {
+    // Bit mask for the 2. bit from the left:
+    constexpr uint8_t B2_MASK = (0b10000000 >> 2);
+    // Bit mask for the 5. bit from the left:
+    constexpr uint8_t B5_MASK = (0b10000000 >> 5);
+
+    uint8_t decData = 0;
+    decData |= (encData[0] & B2_MASK) << 2;
+    decData |= (encData[0] & B5_MASK) << 4;
+
+    decData |= (encData[1] & B2_MASK);
+    decData |= (encData[1] & B5_MASK) << 2;
+
+    decData |= (encData[2] & B2_MASK) >> 2;
+    decData |= (encData[2] & B5_MASK);
+
+    decData |= (encData[3] & B2_MASK) >> 4;
+    decData |= (encData[3] & B5_MASK) >> 2;
+
+    // 1111 0000 -> 0000 1111:
+    decData = ((decData & 0xF0) >> 4) | ((decData & 0x0F) << 4);
+
+    // 1100 1100 -> 0011 0011:
+    decData = ((decData & 0xC0) >> 2) | ((decData & 0x30) << 2) | ((decData & 0x0C) >> 2) | ((decData & 0x03) << 2);
+
+    return decData;
+}
+
+constexpr uint8_t normalize_encoded_byte(uint8_t byte) {
+    return byte & JUTTA_BYTE_MASK;
+}
+
+/**
+ * Returns true in case the given byte can be part of an encoded frame.
+ * Only bit 2 and 5 carry data, all other bits are fixed (0x5B, 0x5F, 0x7B or 0x7F).
+ **/
+constexpr bool is_possible_encoded_byte(uint8_t byte) {
+    constexpr uint8_t DATA_BITS = 0b00100100;
+    constexpr uint8_t BASE = 0b01011011;
+    return (normalize_encoded_byte(byte) & static_cast<uint8_t>(~DATA_BITS)) == BASE;
+}
+
+/**
+ * Returns how many of the bits fixed to 1 (0, 1, 3, 4 and 6) are 0 in the given byte, i.e. how far it is from a
+ * possible encoded byte. The data bits 2 and 5 can not be checked, any value is valid for them.
+ **/
+constexpr uint8_t filler_distance(uint8_t byte) {
+    constexpr uint8_t FILLER_BITS = 0b01011011;
+    uint8_t missing = static_cast<uint8_t>(~byte) & FILLER_BITS;
+    uint8_t distance = 0;
+    for (; missing != 0; missing &= static_cast<uint8_t>(missing - 1)) {
+        ++distance;
+    }
+    return distance;
+}
+
+/**
+ * Sum of filler_distance() over the frame starting at the given position. 0 for a valid frame.
+ * At least FRAME_SIZE bytes have to be readable from data.
+ **/
+constexpr uint8_t frame_filler_distance(const uint8_t* data) {
+    return filler_distance(data[0]) + filler_distance(data[1]) + filler_distance(data[2]) + filler_distance(data[3]);
+}
+static_assert(filler_distance(0x5B) == 0 && filler_distance(0xFF) == 0 && filler_distance(0x5A) == 1 &&
+                  filler_distance(0x00) == 5,
+              "Only the filler bits count.");
+
+constexpr bool frames_equivalent(const frame_t& lhs, const frame_t& rhs) {
+    for (size_t i = 0; i < lhs.size(); ++i) {
+        if (normalize_encoded_byte(lhs[i]) != normalize_encoded_byte(rhs[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Returns true in case every frame built from possible encoded bytes survives a decode/encode round trip.
+ **/
+constexpr bool possible_frames_round_trip() {
+    constexpr uint8_t POSSIBLE[] = {0x5B, 0x5F, 0x7B, 0x7F};
+    for (size_t i = 0; i < 256; i++) {
+        frame_t frame{POSSIBLE[i & 0x03], POSSIBLE[(i >> 2) & 0x03], POSSIBLE[(i >> 4) & 0x03], POSSIBLE[(i >> 6) & 0x03]};
+        if (!frames_equivalent(frame, encode(decode(frame)))) {
+            return false;
+        }
+    }
+    return true;
+}
+static_assert(possible_frames_round_trip(), "Every frame of possible encoded bytes has to be a valid frame.");
+
+/**
+ * Returns true in case a valid encoded frame starts at the given position.
+ * Equivalent to checking that the frame survives a decode/encode round trip (see possible_frames_round_trip()).
+ * At least FRAME_SIZE bytes have to be readable from data.
+ **/
+constexpr bool is_valid_frame(const uint8_t* data) {
+    return is_possible_encoded_byte(data[0]) && is_possible_encoded_byte(data[1]) &&
+           is_possible_encoded_byte(data[2]) && is_possible_encoded_byte(data[3]);
+}
+
+/**
+ * Decodes a contiguous block of encoded bytes the same way the JuttaConnection aligns its RX buffer:
+ * A valid frame gets decoded and consumed, everything else is skipped one byte at a time.
+ * Calls on_byte(offset, byte) for every decoded byte, where offset is the position of the frame in data.
+ * Returns the number of bytes consumed. Bytes at the end that might still form a frame once more data is
+ * available are not consumed.
+ **/
+template <typename Callback>
+size_t decode_stream(const uint8_t* data, size_t size, Callback&& on_byte) {
+    size_t pos = 0;
+    while (pos < size) {
+        if (!is_possible_encoded_byte(data[pos])) {
+            ++pos;
+            continue;
+        }
+        if (size - pos < FRAME_SIZE) {
+            break;
+        }
+        if (is_valid_frame(data + pos)) {
+            frame_t frame{data[pos], data[pos + 1], data[pos + 2], data[pos + 3]};
+            on_byte(pos, decode(frame));
+            pos += FRAME_SIZE;
+        } else {
+            ++pos;
+        }
+    }
+    return pos;
+}
+//---------------------------------------------------------------------------
+}  // namespace codec
+//---------------------------------------------------------------------------
+}  // namespace jutta_proto
+//---------------------------------------------------------------------------
@@ -0,0 +1,248 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "jutta_codec.hpp"
+
+//---------------------------------------------------------------------------
+namespace jutta_proto {
+//---------------------------------------------------------------------------
+/**
+ * Multi threaded variant of codec::decode_stream() for long captures on the host.
+ * Not used by the ESPHome component itself.
+ **/
+namespace codec {
+//---------------------------------------------------------------------------
+namespace detail {
+struct ChunkByte {
+    // Offset of the frame relative to the chunk start.
+    uint32_t offset;
+    uint8_t byte;
+};
+
+struct ChunkResult {
+    std::vector<ChunkByte> bytes{};
+    // Position (relative to the chunk start) where the speculative walk left the chunk.
+    size_t exit{0};
+    // True in case the walk stopped because the data ended inside a possible frame.
+    bool truncated{false};
+};
+
+/**
+ * Decodes data[begin, end) as if the stream started at begin.
+ * Frames starting before end may extend up to four bytes past it.
+ **/
+inline void decode_chunk(const uint8_t* data, size_t size, size_t begin, size_t end, ChunkResult& result) {
+    result.bytes.clear();
+    result.truncated = false;
+    size_t pos = begin;
+    while (pos < end) {
+        if (!is_possible_encoded_byte(data[pos])) {
+            ++pos;
+            continue;
+        }
+        if (size - pos < FRAME_SIZE) {
+            result.truncated = true;
+            break;
+        }
+        if (is_valid_frame(data + pos)) {
+            frame_t frame{data[pos], data[pos + 1], data[pos + 2], data[pos + 3]};
+            result.bytes.push_back({static_cast<uint32_t>(pos - begin), decode(frame)});
+            pos += FRAME_SIZE;
+        } else {
+            ++pos;
+        }
+    }
+    result.exit = pos - begin;
+}
+
+/**
+ * Threads that decode one batch of chunks after the other. They get started once and wait for the next batch in
+ * between, instead of starting and joining new threads for every batch of a long capture.
+ * The calling thread decodes the first chunk of every batch itself.
+ **/
+class ChunkWorkers {
+ public:
+    explicit ChunkWorkers(size_t threads) : results_(threads) {
+        this->workers_.reserve(threads - 1);
+        for (size_t i = 1; i < threads; i++) {
+            this->workers_.emplace_back([this, i]() { this->work(i); });
+        }
+    }
+    ~ChunkWorkers() {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            this->stopping_ = true;
+        }
+        this->start_.notify_all();
+        for (std::thread& worker : this->workers_) {
+            worker.join();
+        }
+    }
+    ChunkWorkers(const ChunkWorkers&) = delete;
+    ChunkWorkers& operator=(const ChunkWorkers&) = delete;
+
+    /**
+     * Decodes the count chunks of chunk_size bytes starting at batch_start, returns once all of them are done.
+     **/
+    void run(const uint8_t* data, size_t size, size_t batch_start, size_t chunk_size, size_t count) {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            this->data_ = data;
+            this->size_ = size;
+            this->batch_start_ = batch_start;
+            this->chunk_size_ = chunk_size;
+            this->count_ = count;
+            this->pending_ = count - 1;
+            ++this->generation_;
+        }
+        this->start_.notify_all();
+        this->decode(0);
+        std::unique_lock<std::mutex> lock(this->mutex_);
+        this->done_.wait(lock, [this]() { return this->pending_ == 0; });
+    }
+
+    [[nodiscard]] const ChunkResult& result(size_t index) const { return this->results_[index]; }
+
+ private:
+    void decode(size_t index) {
+        size_t begin = this->batch_start_ + index * this->chunk_size_;
+        size_t end = std::min(this->size_, begin + this->chunk_size_);
+        decode_chunk(this->data_, this->size_, begin, end, this->results_[index]);
+    }
+
+    void work(size_t index) {
+        uint64_t seen = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(this->mutex_);
+                this->start_.wait(lock, [&]() { return this->stopping_ || this->generation_ != seen; });
+                if (this->stopping_) {
+                    return;
+                }
+                seen = this->generation_;
+                // The last batch of a capture may have fewer chunks than threads:
+                if (index >= this->count_) {
+                    continue;
+                }
+            }
+            this->decode(index);
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            if (--this->pending_ == 0) {
+                this->done_.notify_one();
+            }
+        }
+    }
+
+    std::vector<ChunkResult> results_;
+    std::vector<std::thread> workers_{};
+    std::mutex mutex_{};
+    std::condition_variable start_{};
+    std::condition_variable done_{};
+    // The current batch, only changed while no worker decodes:
+    const uint8_t* data_{nullptr};
+    size_t size_{0};
+    size_t batch_start_{0};
+    size_t chunk_size_{0};
+    size_t count_{0};
+    size_t pending_{0};
+    uint64_t generation_{0};
+    bool stopping_{false};
+};
+}  // namespace detail
+
+/**
+ * Decodes the given data in chunks on multiple threads.
+ * Every chunk is decoded speculatively from its first byte. When stitching the chunks back together in order, the
+ * actual position the previous chunk ended at is walked forward with the regular frame validation until it meets the
+ * speculative walk. From there on both produce the same frames, so the result is identical to decode_stream().
+ * on_byte(offset, byte) gets called in order on the calling thread.
+ * threads = 0 uses all available hardware threads. They get started once per call and decode all batches.
+ * Returns the number of bytes consumed, exactly like decode_stream().
+ **/
+template <typename Callback>
+size_t decode_stream_parallel(const uint8_t* data, size_t size, Callback&& on_byte, size_t threads = 0,
+                              size_t chunk_size = 4 * 1024 * 1024) {
+    if (threads == 0) {
+        threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+    }
+    // Offsets inside a chunk are stored as 32 bit and the boundary fix up needs a few bytes per chunk:
+    chunk_size = std::min<size_t>(std::max<size_t>(chunk_size, 4 * FRAME_SIZE), UINT32_MAX / 2);
+    if (threads == 1 || size <= chunk_size) {
+        return decode_stream(data, size, on_byte);
+    }
+
+    detail::ChunkWorkers workers(threads);
+
+    // Position the serial walk is at, always at or behind the start of the next chunk to stitch:
+    size_t pos = 0;
+    for (size_t batch_start = 0; batch_start < size; batch_start += threads * chunk_size) {
+        size_t count = std::min(threads, (size - batch_start + chunk_size - 1) / chunk_size);
+        workers.run(data, size, batch_start, chunk_size, count);
+
+        for (size_t i = 0; i < count; i++) {
+            size_t begin = batch_start + i * chunk_size;
+            size_t end = std::min(size, begin + chunk_size);
+            const detail::ChunkResult& chunk = workers.result(i);
+            const std::vector<detail::ChunkByte>& bytes = chunk.bytes;
+
+            // The serial walk may already be past this chunk in case the previous fix up ran across it:
+            if (pos >= end) {
+                continue;
+            }
+
+            // Walk serially until the position is one the speculative walk visited as well.
+            // It visited every position up to where it stopped except the ones inside the frames it decoded.
+            size_t next = 0;
+            bool converged = false;
+            while (pos < end) {
+                while (next < bytes.size() && begin + bytes[next].offset < pos) {
+                    ++next;
+                }
+                bool inside_frame = next > 0 && begin + bytes[next - 1].offset + FRAME_SIZE > pos;
+                if (!inside_frame && pos <= begin + chunk.exit) {
+                    converged = true;
+                    break;
+                }
+
+                if (!is_possible_encoded_byte(data[pos])) {
+                    ++pos;
+                    continue;
+                }
+                if (size - pos < FRAME_SIZE) {
+                    return pos;
+                }
+                if (is_valid_frame(data + pos)) {
+                    frame_t frame{data[pos], data[pos + 1], data[pos + 2], data[pos + 3]};
+                    on_byte(pos, decode(frame));
+                    pos += FRAME_SIZE;
+                } else {
+                    ++pos;
+                }
+            }
+            if (!converged) {
+                continue;
+            }
+
+            for (; next < bytes.size(); next++) {
+                on_byte(begin + bytes[next].offset, bytes[next].byte);
+            }
+            pos = begin + chunk.exit;
+            if (chunk.truncated) {
+                return pos;
+            }
+        }
+    }
+    return pos;
+}
+//---------------------------------------------------------------------------
+}  // namespace codec
+//---------------------------------------------------------------------------
+}  // namespace jutta_proto
+//---------------------------------------------------------------------------
@@ -10,6 +10,14 @@ const std::string JUTTA_TEST_MODE_ON = "AN:20\r\n";
 const std::string JUTTA_TEST_MODE_OFF = "AN:21\r\n";
 
 const std::string JUTTA_GET_TYPE = "TY:\r\n";
+// Harmless read of the input board. Coffee makers that need the key exchange only answer it with "ic:" within a session.
+const std::string JUTTA_READ_INPUTS = "IC:\r\n";
+
+// Key exchange of the handshake, see protocol_snoops/.
+const std::string JUTTA_KEY_EXCHANGE_T1 = "@T1\r\n";
+const std::string JUTTA_KEY_EXCHANGE_T1_ACK = "@t1\r\n";
+const std::string JUTTA_KEY_EXCHANGE_T2_REPLY = "@t2:8120000000\r\n";
+const std::string JUTTA_KEY_EXCHANGE_T3_ACK = "@t3\r\n";
 
 const std::string JUTTA_BUTTON_1 = "FA:04\r\n";
 const std::string JUTTA_BUTTON_2 = "FA:05\r\n";
@@ -2,10 +2,12 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cinttypes>
 #include <cstddef>
 #include <cstdio>
-#include <sstream>
 #include <string>
+#include <string_view>
+#include <utility>
 #include "esphome/core/log.h"
 #include "esphome/core/time.h"
 
@@ -15,39 +17,16 @@ namespace jutta_proto {
 static const char* TAG = "jutta_connection";
 
 namespace {
-constexpr uint32_t JUTTA_SERIAL_GAP_MS = 8;
-constexpr uint8_t JUTTA_BYTE_MASK = 0x7F;
+using codec::filler_distance;
+using codec::frame_filler_distance;
 
-inline void wait_for_jutta_gap() {
-    const uint32_t start = esphome::millis();
-    while (esphome::millis() - start < JUTTA_SERIAL_GAP_MS) {
-        // Busy-wait to preserve the required 8 ms spacing between JUTTA bytes.
+// True in case the received data ends with the expected response minus its "\r\n".
+bool ends_without_terminator(const char* data, size_t size, const std::string& response) {
+    std::string_view body(response);
+    if (body.size() >= 2 && body.substr(body.size() - 2) == "\r\n") {
+        body.remove_suffix(2);
     }
-}
-
-inline uint8_t normalize_encoded_byte(uint8_t byte) {
-    return byte & JUTTA_BYTE_MASK;
-}
-
-inline bool is_possible_encoded_byte(uint8_t byte) {
-    switch (normalize_encoded_byte(byte)) {
-        case 0x5B:
-        case 0x5F:
-        case 0x7B:
-        case 0x7F:
-            return true;
-        default:
-            return false;
-    }
-}
-
-inline bool frames_equivalent(const std::array<uint8_t, 4>& lhs, const std::array<uint8_t, 4>& rhs) {
-    for (size_t i = 0; i < lhs.size(); ++i) {
-        if (normalize_encoded_byte(lhs[i]) != normalize_encoded_byte(rhs[i])) {
-            return false;
-        }
-    }
-    return true;
+    return !body.empty() && size >= body.size() && std::string_view(data + size - body.size(), body.size()) == body;
 }
 
 }  // namespace
@@ -58,6 +37,30 @@ void JuttaConnection::init() {
     serial.init();
 }
 
+#ifdef USE_JUTTA_FAULT_INJECTION
+void JuttaConnection::enable_fault_injection(const serial::FaultProfile& profile) {
+    std::vector<uint8_t> ok_pattern;
+    for (char c : std::string("ok:\r\n")) {
+        auto enc = encode(static_cast<uint8_t>(c));
+        ok_pattern.insert(ok_pattern.end(), enc.begin(), enc.end());
+    }
+    // Decorates the installed transport, e.g. the replay on the host. Enabling again only swaps the profile:
+    const serial::Transport& inner = this->fault_injector_ != nullptr && this->transport == this->fault_injector_.get()
+                                         ? this->fault_injector_->inner()
+                                         : *this->transport;
+    this->fault_injector_ = std::make_unique<serial::FaultInjectingTransport>(inner, profile, std::move(ok_pattern));
+    this->transport = this->fault_injector_.get();
+    ESP_LOGW(TAG, "Fault injection enabled - received data will be corrupted on purpose.");
+}
+#endif
+
+#ifdef USE_JUTTA_TRAFFIC_RECORDER
+void JuttaConnection::enable_traffic_recorder(size_t capacity) {
+    this->recorder_ = std::make_unique<TrafficRecorder>(capacity);
+    ESP_LOGI(TAG, "Recording raw traffic into a %zu byte ring buffer.", this->recorder_->capacity());
+}
+#endif
+
 bool JuttaConnection::read_decoded(std::vector<uint8_t>& data) {
     return read_decoded_unsafe(data);
 }
@@ -67,6 +70,7 @@ bool JuttaConnection::read_decoded(uint8_t* byte) {
 }
 
 bool JuttaConnection::read_decoded_unsafe(uint8_t* byte) const {
+    JUTTA_PROFILE_SCOPE(this->profiler_, RX);
     std::array<uint8_t, 4> buffer{};
     if (!read_encoded_unsafe(buffer)) {
         return false;
@@ -75,23 +79,21 @@ bool JuttaConnection::read_decoded_unsafe(uint8_t* byte) const {
     return true;
 }
 
-bool JuttaConnection::read_decoded_unsafe(std::vector<uint8_t>& data) const {
-    // Read encoded data:
-    std::vector<std::array<uint8_t, 4>> dataBuffer;
-    if (read_encoded_unsafe(dataBuffer) <= 0) {
-        return false;
-    }
-
-    // Decode all:
-    for (const std::array<uint8_t, 4>& buffer : dataBuffer) {
+template <typename Buffer>
+bool JuttaConnection::read_decoded_unsafe(Buffer& data, size_t max_frames) const {
+    JUTTA_PROFILE_SCOPE(this->profiler_, RX);
+    size_t count = 0;
+    std::array<uint8_t, 4> buffer{};
+    // A machine that keeps sending must not keep us in here forever:
+    while (count < max_frames && read_encoded_unsafe(buffer)) {
         data.push_back(decode(buffer));
+        ++count;
     }
-    std::string decoded = vec_to_string(data);
-    ESP_LOGD(TAG, "Read: %s", decoded.c_str());
-    return true;
+    return count > 0;
 }
 
 bool JuttaConnection::write_decoded_unsafe(const uint8_t& byte) const {
+    JUTTA_TRACE_TX(this->trace_, byte);
     return write_encoded_unsafe(encode(byte));
 }
 
@@ -134,11 +136,18 @@ bool JuttaConnection::write_decoded(const std::string& data) {
 }
 
 void JuttaConnection::print_byte(const uint8_t& byte) {
+#if JUTTA_TRACE_ENABLED
+    // "0 1 0 1 0 1 0 0 " followed by "-> 84\t54":
+    std::array<char, 16 + 12> bits{};
     for (size_t i = 0; i < 8; i++) {
-        ESP_LOGI(TAG, "%d ", ((byte >> (7 - i)) & 0b00000001));
+        bits[i * 2] = ((byte >> (7 - i)) & 0b00000001) ? '1' : '0';
+        bits[(i * 2) + 1] = ' ';
     }
-    // printf("-> %d\t%02x\t%c", byte, byte, byte);
-    printf("-> %d\t%02x", byte, byte);
+    snprintf(bits.data() + 16, bits.size() - 16, "-> %d\t%02x", byte, byte);
+    ESP_LOGD(TAG, "%s", bits.data());
+#else
+    (void) byte;
+#endif
 }
 
 void JuttaConnection::print_bytes(const std::vector<uint8_t>& data) {
@@ -173,69 +182,36 @@ void JuttaConnection::run_encode_decode_test() {
 }
 
 std::array<uint8_t, 4> JuttaConnection::encode(const uint8_t& decData) {
-    // 1111 0000 -> 0000 1111:
-    uint8_t tmp = ((decData & 0xF0) >> 4) | ((decData & 0x0F) << 4);
-
-    // 1100 1100 -> 0011 0011:
-    tmp = ((tmp & 0xC0) >> 2) | ((tmp & 0x30) << 2) | ((tmp & 0x0C) >> 2) | ((tmp & 0x03) << 2);
-
-    // The base bit layout for all send bytes:
-    constexpr uint8_t BASE = 0b01011011;
-
-    std::array<uint8_t, 4> encData{};
-    encData[0] = BASE | ((tmp & 0b10000000) >> 2);
-    encData[0] |= ((tmp & 0b01000000) >> 4);
-
-    encData[1] = BASE | (tmp & 0b00100000);
-    encData[1] |= ((tmp & 0b00010000) >> 2);
-
-    encData[2] = BASE | ((tmp & 0b00001000) << 2);
-    encData[2] |= (tmp & 0b00000100);
-
-    encData[3] = BASE | ((tmp & 0b00000010) << 4);
-    encData[3] |= ((tmp & 0b00000001) << 2);
-
-    return encData;
+    return codec::encode(decData);
 }
 
 uint8_t JuttaConnection::decode(const std::array<uint8_t, 4>& encData) {
-    // Bit mask for the 2. bit from the left:
-    constexpr uint8_t B2_MASK = (0b10000000 >> 2);
-    // Bit mask for the 5. bit from the left:
-    constexpr uint8_t B5_MASK = (0b10000000 >> 5);
-
-    uint8_t decData = 0;
-    decData |= (encData[0] & B2_MASK) << 2;
-    decData |= (encData[0] & B5_MASK) << 4;
-
-    decData |= (encData[1] & B2_MASK);
-    decData |= (encData[1] & B5_MASK) << 2;
-
-    decData |= (encData[2] & B2_MASK) >> 2;
-    decData |= (encData[2] & B5_MASK);
-
-    decData |= (encData[3] & B2_MASK) >> 4;
-    decData |= (encData[3] & B5_MASK) >> 2;
-
-    // 1111 0000 -> 0000 1111:
-    decData = ((decData & 0xF0) >> 4) | ((decData & 0x0F) << 4);
-
-    // 1100 1100 -> 0011 0011:
-    decData = ((decData & 0xC0) >> 2) | ((decData & 0x30) << 2) | ((decData & 0x0C) >> 2) | ((decData & 0x03) << 2);
-
-    return decData;
+    return codec::decode(encData);
 }
 
 bool JuttaConnection::write_encoded_unsafe(const std::array<uint8_t, 4>& encData) const {
+#if JUTTA_TX_SCHEDULER_ENABLED
+    if (this->tx_scheduler_ != nullptr) {
+        this->tx_queue_.insert(this->tx_queue_.end(), encData.begin(), encData.end());
+        return true;
+    }
+#endif
+    JUTTA_PROFILE_SCOPE(this->profiler_, TX);
 
     bool result = true;
     for (uint8_t byte : encData) {
-        if (!serial.write_serial_byte(byte)) {
+        if (!transport->write_serial_byte(byte)) {
+            ++this->link_stats_.tx_failures;
             result = false;
             break;
         }
-        serial.flush();
-        wait_for_jutta_gap();
+#ifdef USE_JUTTA_TRAFFIC_RECORDER
+        if (this->recorder_) {
+            this->recorder_->record(trace::Direction::TX, byte, esphome::micros());
+        }
+#endif
+        transport->flush();
+        transport->wait_for_gap(this->byte_gap_us_);
     }
 
     return result;
@@ -245,13 +221,9 @@ bool JuttaConnection::read_encoded_unsafe(std::array<uint8_t, 4>& buffer) const
 
     if (!align_encoded_rx_buffer()) {
         if (this->encoded_rx_buffer_.size() < buffer.size()) {
-            wait_for_jutta_gap();
+            wait_for_rx_gap();
             std::array<uint8_t, 4> chunk{};
-            size_t size = serial.read_serial(chunk);
-            if (size > chunk.size()) {
-                ESP_LOGW(TAG, "Invalid amount of UART data found (%zu byte) - ignoring.", size);
-                size = chunk.size();
-            }
+            size_t size = read_transport(chunk);
 
             if (size > 0) {
                 this->encoded_rx_buffer_.insert(this->encoded_rx_buffer_.end(), chunk.begin(), chunk.begin() + size);
@@ -267,13 +239,9 @@ bool JuttaConnection::read_encoded_unsafe(std::array<uint8_t, 4>& buffer) const
     }
 
     if (this->encoded_rx_buffer_.size() < buffer.size()) {
-        wait_for_jutta_gap();
+        wait_for_rx_gap();
         std::array<uint8_t, 4> chunk{};
-        size_t read = serial.read_serial(chunk);
-        if (read > chunk.size()) {
-            ESP_LOGW(TAG, "Invalid amount of UART data found (%zu byte) - ignoring.", read);
-            read = chunk.size();
-        }
+        size_t read = read_transport(chunk);
 
         if (read == 0) {
             if (this->encoded_rx_buffer_.empty()) {
@@ -286,96 +254,167 @@ bool JuttaConnection::read_encoded_unsafe(std::array<uint8_t, 4>& buffer) const
     }
 
     if (this->encoded_rx_buffer_.size() < buffer.size()) {
-        ESP_LOGW(TAG, "Invalid amount of UART data found while forming encoded frame (%zu byte).",
+        ESP_LOGV(TAG, "Invalid amount of UART data found while forming encoded frame (%zu byte).",
                  this->encoded_rx_buffer_.size());
+#if JUTTA_TX_SCHEDULER_ENABLED
+        // Without waiting for the gap a partial frame is expected, the rest gets picked up on the next call:
+        if (this->tx_scheduler_ != nullptr) {
+            return false;
+        }
+#endif
+        ++this->link_stats_.undersized_reads;
         return false;
     }
 
     std::copy_n(this->encoded_rx_buffer_.begin(), buffer.size(), buffer.begin());
     this->encoded_rx_buffer_.erase(this->encoded_rx_buffer_.begin(),
                                    this->encoded_rx_buffer_.begin() + buffer.size());
+    const uint8_t corrected = frame_filler_distance(buffer.data());
+    if (corrected > 0) {
+        ++this->link_stats_.corrected_frames;
+        this->link_stats_.corrected_bits += corrected;
+    }
 
     ESP_LOGV(TAG, "Read 4 encoded bytes.");
+    observe_rx(decode(buffer));
     return true;
 }
 
-size_t JuttaConnection::read_encoded_unsafe(std::vector<std::array<uint8_t, 4>>& data) const {
-    size_t count = 0;
-    while (true) {
-        std::array<uint8_t, 4> buffer{};
-        if (!read_encoded_unsafe(buffer)) {
-            break;
-        }
-        data.push_back(buffer);
-        ++count;
+void JuttaConnection::observe_rx(uint8_t byte) const {
+    JUTTA_TRACE_RX(this->trace_, byte);
+    ++this->link_stats_.frames_decoded;
+    this->link_stats_.last_rx_ms = esphome::millis();
+    if (byte == '\n') {
+        this->rx_line_length_ = 0;
+        return;
+    }
+    if (this->rx_line_length_ >= this->rx_line_start_.size()) {
+        return;
+    }
+    this->rx_line_start_[this->rx_line_length_++] = static_cast<char>(byte);
+    if (this->rx_line_length_ == 2 && this->rx_line_start_[0] == '@' && this->rx_line_start_[1] == 'T') {
+        ++this->link_stats_.session_requests;
+    } else if (this->rx_line_length_ == 3 && this->rx_line_start_[0] == 't' && this->rx_line_start_[1] == 'y' &&
+               this->rx_line_start_[2] == ':') {
+        ++this->link_stats_.type_replies;
     }
-    return count;
 }
 
-bool JuttaConnection::align_encoded_rx_buffer() const {
-    size_t skipped = 0;
+bool JuttaConnection::rx_idle() const { return esphome::micros() - this->last_rx_us_ >= this->get_message_idle_time(); }
 
-    auto log_skipped = [&]() {
-        if (skipped > 0) {
-            ESP_LOGW(TAG, "Discarded %zu stray encoded byte%s while seeking JUTTA frame boundary.", skipped,
-                     skipped == 1 ? "" : "s");
-            skipped = 0;
+bool JuttaConnection::align_encoded_rx_buffer() const {
+    JUTTA_PROFILE_SCOPE(this->profiler_, ALIGN);
+    // Single pass over the buffer that erases all stray bytes at once.
+    // Every buffered byte is inspected at most four times, so the cost per received byte stays constant
+    // no matter what arrives on the UART.
+    // Soft decision: only bits 2 and 5 carry data, so a frame with a few filler bits read as 0 still decodes to the
+    // right byte. With a tolerance of 0 this only accepts exact frames (see codec::possible_frames_round_trip()).
+    const EncodedBuffer& rx = this->encoded_rx_buffer_;
+    size_t start = 0;
+    bool aligned = false;
+    while (start < rx.size()) {
+        ++this->link_stats_.bytes_inspected;
+        if (filler_distance(rx[start]) > this->frame_tolerance_) {
+            ++start;
+            continue;
         }
-    };
-
-    while (true) {
-        while (!this->encoded_rx_buffer_.empty() && !is_possible_encoded_byte(this->encoded_rx_buffer_.front())) {
-            this->encoded_rx_buffer_.erase(this->encoded_rx_buffer_.begin());
-            ++skipped;
+        if (rx.size() - start < 4) {
+            break;
         }
-
-        if (this->encoded_rx_buffer_.size() < 4) {
-            log_skipped();
-            return false;
+        this->link_stats_.bytes_inspected += 4;
+        if (frame_filler_distance(rx.data() + start) <= this->frame_tolerance_) {
+            aligned = true;
+            break;
         }
+        ++start;
+    }
+
+    if (start > 0) {
+        this->encoded_rx_buffer_.erase(this->encoded_rx_buffer_.begin(),
+                                       this->encoded_rx_buffer_.begin() + static_cast<std::ptrdiff_t>(start));
+        // Only counted here, JuraComponent logs a summary from time to time instead of flooding the log under EMI:
+        ESP_LOGV(TAG, "Discarded %zu stray encoded byte%s while seeking JUTTA frame boundary.", start,
+                 start == 1 ? "" : "s");
+        this->link_stats_.stray_bytes += static_cast<uint32_t>(start);
+        auto frames_lost = static_cast<uint32_t>((start + 3) / 4);
+        ++this->link_stats_.resync_events;
+        this->link_stats_.frames_lost += frames_lost;
+        if (frames_lost > this->link_stats_.max_frames_lost) {
+            this->link_stats_.max_frames_lost = frames_lost;
+        }
+    }
+    return aligned;
+}
 
-        std::array<uint8_t, 4> candidate{};
-        std::copy_n(this->encoded_rx_buffer_.begin(), candidate.size(), candidate.begin());
+void JuttaConnection::flush_serial_input() const {
+    this->encoded_rx_buffer_.clear();
+    std::array<uint8_t, 4> discard{};
+    while (read_transport(discard) > 0) {
+        wait_for_rx_gap();
+    }
+}
 
-        bool candidate_valid = true;
-        for (uint8_t byte : candidate) {
-            if (!is_possible_encoded_byte(byte)) {
-                candidate_valid = false;
-                break;
-            }
-        }
+void JuttaConnection::wait_for_rx_gap() const {
+#if JUTTA_TX_SCHEDULER_ENABLED
+    if (this->tx_scheduler_ != nullptr) {
+        return;
+    }
+#endif
+    transport->wait_for_gap(this->byte_gap_us_);
+}
 
-        if (!candidate_valid) {
-            this->encoded_rx_buffer_.erase(this->encoded_rx_buffer_.begin());
-            ++skipped;
-            continue;
-        }
+#ifdef USE_JUTTA_HEAP_FREE
+uint32_t JuttaConnection::get_buffer_overflows() const {
+    uint32_t overflows = this->encoded_rx_buffer_.overflows();
+#if JUTTA_TX_SCHEDULER_ENABLED
+    overflows += this->tx_queue_.overflows();
+#endif
+    return overflows;
+}
+#endif
 
-        uint8_t decoded = decode(candidate);
-        auto reencoded = encode(decoded);
-        if (frames_equivalent(candidate, reencoded)) {
-            log_skipped();
-            return true;
-        }
+#if JUTTA_TX_SCHEDULER_ENABLED
+void JuttaConnection::set_tx_scheduler(TxScheduler* scheduler) {
+    this->tx_scheduler_ = scheduler;
+    scheduler->add(this);
+}
 
-        this->encoded_rx_buffer_.erase(this->encoded_rx_buffer_.begin());
-        ++skipped;
+void JuttaConnection::send_queued_byte() {
+    JUTTA_PROFILE_SCOPE(this->profiler_, TX);
+    uint8_t byte = this->tx_queue_.front();
+    this->tx_queue_.pop_front();
+    if (!transport->write_serial_byte(byte)) {
+        ++this->link_stats_.tx_failures;
+        return;
+    }
+#ifdef USE_JUTTA_TRAFFIC_RECORDER
+    if (this->recorder_) {
+        this->recorder_->record(trace::Direction::TX, byte, esphome::micros());
     }
+#endif
+    transport->flush();
 }
+#endif
 
-void JuttaConnection::flush_serial_input() const {
-    this->encoded_rx_buffer_.clear();
-    std::array<uint8_t, 4> discard{};
-    while (true) {
-        size_t read = serial.read_serial(discard);
-        if (read == 0) {
-            break;
-        }
-        if (read > discard.size()) {
-            ESP_LOGW(TAG, "Invalid amount of UART data found while flushing (%zu byte).", read);
+size_t JuttaConnection::read_transport(std::array<uint8_t, 4>& chunk) const {
+    size_t size = transport->read_serial(chunk);
+    if (size > chunk.size()) {
+        ESP_LOGW(TAG, "Invalid amount of UART data found (%zu byte) - ignoring.", size);
+        size = chunk.size();
+    }
+    if (size > 0) {
+        // A frame takes four byte gaps to arrive, so the idle time has to start over with every raw byte:
+        this->last_rx_us_ = esphome::micros();
+    }
+#ifdef USE_JUTTA_TRAFFIC_RECORDER
+    if (this->recorder_) {
+        uint32_t now_us = esphome::micros();
+        for (size_t i = 0; i < size; i++) {
+            this->recorder_->record(trace::Direction::RX, chunk[i], now_us);
         }
-        wait_for_jutta_gap();
     }
+#endif
+    return size;
 }
 
 void JuttaConnection::reinject_decoded_front(const std::string& data) const {
@@ -383,14 +422,12 @@ void JuttaConnection::reinject_decoded_front(const std::string& data) const {
         return;
     }
 
-    std::vector<uint8_t> encoded;
-    encoded.reserve(data.size() * 4);
+    // Frame by frame, so no temporary buffer is needed:
+    auto pos = this->encoded_rx_buffer_.begin();
     for (char c : data) {
         auto enc = encode(static_cast<uint8_t>(static_cast<unsigned char>(c)));
-        encoded.insert(encoded.end(), enc.begin(), enc.end());
+        pos = this->encoded_rx_buffer_.insert(pos, enc.begin(), enc.end()) + static_cast<std::ptrdiff_t>(enc.size());
     }
-
-    this->encoded_rx_buffer_.insert(this->encoded_rx_buffer_.begin(), encoded.begin(), encoded.end());
     ESP_LOGV(TAG, "Re-injected %zu decoded bytes.", data.size());
 }
 
@@ -399,48 +436,84 @@ JuttaConnection::WaitResult JuttaConnection::wait_for_ok(const std::chrono::mill
     return wait_for_response_unsafe("ok:\r\n", timeout);
 }
 
-std::shared_ptr<std::string> JuttaConnection::write_decoded_with_response(const std::vector<uint8_t>& data,
+JuttaConnection::WaitResult JuttaConnection::write_decoded_with_response(const std::vector<uint8_t>& data,
+                                                                         std::string_view* response,
                                                                          const std::chrono::milliseconds& timeout) {
     if (!this->wait_string_context_.active) {
         if (!write_decoded_unsafe(data)) {
-            return nullptr;
+            return WaitResult::Error;
         }
     }
-    return wait_for_str_unsafe(timeout);
+    return wait_for_str_unsafe(response, timeout);
 }
 
-std::shared_ptr<std::string> JuttaConnection::write_decoded_with_response(const std::string& data,
+JuttaConnection::WaitResult JuttaConnection::write_decoded_with_response(const std::string& data,
+                                                                         std::string_view* response,
                                                                          const std::chrono::milliseconds& timeout) {
     if (!this->wait_string_context_.active) {
         if (!write_decoded_unsafe(data)) {
-            return nullptr;
+            return WaitResult::Error;
         }
     }
-    return wait_for_str_unsafe(timeout);
+    return wait_for_str_unsafe(response, timeout);
+}
+
+std::shared_ptr<std::string> JuttaConnection::write_decoded_with_response(const std::vector<uint8_t>& data,
+                                                                         const std::chrono::milliseconds& timeout) {
+    std::string_view response;
+    if (write_decoded_with_response(data, &response, timeout) != WaitResult::Success) {
+        return nullptr;
+    }
+    return std::make_shared<std::string>(response);
+}
+
+std::shared_ptr<std::string> JuttaConnection::write_decoded_with_response(const std::string& data,
+                                                                         const std::chrono::milliseconds& timeout) {
+    std::string_view response;
+    if (write_decoded_with_response(data, &response, timeout) != WaitResult::Success) {
+        return nullptr;
+    }
+    return std::make_shared<std::string>(response);
 }
 
-std::shared_ptr<std::string> JuttaConnection::wait_for_str_unsafe(const std::chrono::milliseconds& timeout) {
+JuttaConnection::WaitResult JuttaConnection::wait_for_str_unsafe(std::string_view* response,
+                                                                 const std::chrono::milliseconds& timeout) {
     if (!this->wait_string_context_.active) {
         this->wait_string_context_.active = true;
         this->wait_string_context_.timeout = timeout;
         this->wait_string_context_.start_time = esphome::millis();
+        this->rx_scratch_.clear();
     }
 
-    std::vector<uint8_t> buffer;
-    if (read_decoded_unsafe(buffer) && !buffer.empty()) {
-        this->wait_string_context_.active = false;
-        return std::make_shared<std::string>(vec_to_string(buffer));
+    // Collects the message across calls until it is complete:
+    if (read_decoded_unsafe(this->rx_scratch_, MAX_FRAMES_PER_READ - this->rx_scratch_.size()) ||
+        !this->rx_scratch_.empty()) {
+        const size_t size = this->rx_scratch_.size();
+        const bool terminated = size >= 2 && this->rx_scratch_[size - 2] == '\r' && this->rx_scratch_[size - 1] == '\n';
+        if (terminated || size >= MAX_FRAMES_PER_READ || this->rx_idle()) {
+            if (!terminated && size < MAX_FRAMES_PER_READ) {
+                ++this->link_stats_.idle_delimited;
+            }
+            this->wait_string_context_.active = false;
+            *response = std::string_view(reinterpret_cast<const char*>(this->rx_scratch_.data()), size);
+            return WaitResult::Success;
+        }
     }
 
+    if (this->tx_pending()) {
+        // The timeout starts once the request is out:
+        this->wait_string_context_.start_time = esphome::millis();
+    }
     if (timeout.count() > 0) {
         uint32_t now = esphome::millis();
         uint32_t elapsed = now - this->wait_string_context_.start_time;
         if (elapsed >= static_cast<uint32_t>(timeout.count())) {
             this->wait_string_context_.active = false;
+            return WaitResult::Timeout;
         }
     }
 
-    return nullptr;
+    return WaitResult::Pending;
 }
 
 JuttaConnection::WaitResult JuttaConnection::wait_for_response_unsafe(const std::string& response,
@@ -459,6 +532,9 @@ JuttaConnection::WaitResult JuttaConnection::wait_for_response_unsafe(const std:
         return WaitResult::Success;
     }
 
+    if (this->tx_pending()) {
+        this->wait_context_.start_time = esphome::millis();
+    }
     if (timeout.count() > 0) {
         uint32_t now = esphome::millis();
         uint32_t elapsed = now - this->wait_context_.start_time;
@@ -469,10 +545,9 @@ JuttaConnection::WaitResult JuttaConnection::wait_for_response_unsafe(const std:
         }
     }
 
-    std::vector<uint8_t> buffer;
-    if (read_decoded_unsafe(buffer) && !buffer.empty()) {
-        std::string incoming(buffer.begin(), buffer.end());
-        this->wait_context_.recent.append(incoming);
+    this->rx_scratch_.clear();
+    if (read_decoded_unsafe(this->rx_scratch_)) {
+        this->wait_context_.recent.append(this->rx_scratch_.begin(), this->rx_scratch_.end());
         if (this->wait_context_.recent.find(response) != std::string::npos) {
             this->wait_context_.active = false;
             this->wait_context_.recent.clear();
@@ -481,6 +556,12 @@ JuttaConnection::WaitResult JuttaConnection::wait_for_response_unsafe(const std:
         if (this->wait_context_.recent.size() > response.size()) {
             this->wait_context_.recent.erase(0, this->wait_context_.recent.size() - response.size());
         }
+    } else if (!this->wait_context_.recent.empty() && this->rx_idle() &&
+               ends_without_terminator(this->wait_context_.recent.data(), this->wait_context_.recent.size(), response)) {
+        ++this->link_stats_.idle_delimited;
+        this->wait_context_.active = false;
+        this->wait_context_.recent.clear();
+        return WaitResult::Success;
     }
 
     return WaitResult::Pending;
@@ -512,11 +593,64 @@ std::string JuttaConnection::vec_to_string(const std::vector<uint8_t>& data) {
         return "";
     }
 
-    std::ostringstream sstream;
-    for (unsigned char i : data) {
-        sstream << static_cast<char>(i);
+    return std::string(data.begin(), data.end());
+}
+
+void JuttaConnection::flush_trace() const {
+#if JUTTA_TRACE_ENABLED
+    if (this->trace_.empty()) {
+        return;
+    }
+    // Worst case every byte gets escaped as "\xNN":
+    std::array<char, 4 * 32 + 1> line{};
+    size_t length = 0;
+    size_t bytes = 0;
+    trace::Direction direction = trace::Direction::RX;
+    uint16_t line_start_ms = 0;
+    uint16_t prev_line_start_ms = 0;
+    bool first_line = true;
+
+    auto emit_line = [&]() {
+        if (bytes == 0) {
+            return;
+        }
+        line[length] = '\0';
+        // 16 bit timestamps wrap after ~65 seconds, which is way more than we have between two flushes:
+        uint16_t delta_ms = first_line ? 0 : static_cast<uint16_t>(line_start_ms - prev_line_start_ms);
+        ESP_LOGD(TAG, "%s +%u ms: %s", direction == trace::Direction::RX ? "RX" : "TX", static_cast<unsigned>(delta_ms), line.data());
+        prev_line_start_ms = line_start_ms;
+        first_line = false;
+        length = 0;
+        bytes = 0;
+    };
+
+    uint32_t dropped = this->trace_.drain([&](const trace::Record& record) {
+        if (bytes > 0 && (record.direction != direction || length + 4 >= line.size())) {
+            emit_line();
+        }
+        if (bytes == 0) {
+            direction = record.direction;
+            line_start_ms = record.time_ms;
+        }
+        ++bytes;
+        if (record.byte == '\r') {
+            line[length++] = '\\';
+            line[length++] = 'r';
+        } else if (record.byte == '\n') {
+            line[length++] = '\\';
+            line[length++] = 'n';
+            emit_line();
+        } else if (record.byte >= 0x20 && record.byte < 0x7F) {
+            line[length++] = static_cast<char>(record.byte);
+        } else {
+            length += snprintf(line.data() + length, line.size() - length, "\\x%02X", record.byte);
+        }
+    });
+    emit_line();
+    if (dropped > 0) {
+        ESP_LOGD(TAG, "Trace buffer overflowed, %" PRIu32 " byte not traced.", dropped);
     }
-    return sstream.str();
+#endif
 }
 
 //---------------------------------------------------------------------------
@@ -1,23 +1,89 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
 #include <chrono>
 #include <memory>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <deque>
 
+#include "esphome/core/defines.h"
+#include "fault_injection.hpp"
+#include "jutta_codec.hpp"
+#include "heap_report.hpp"
+#include "jutta_trace.hpp"
+#include "loop_profiler.hpp"
 #include "serial_connection.hpp"
+#include "static_buffer.hpp"
+#include "traffic_recorder.hpp"
+#include "tx_scheduler.hpp"
 
 //---------------------------------------------------------------------------
 namespace jutta_proto {
 //---------------------------------------------------------------------------
+/**
+ * Not synchronized, all calls have to come from the same thread: the ESPHome main loop or, with "protocol_task:",
+ * the protocol task (see protocol_task.hpp).
+ **/
 class JuttaConnection {
  public:
     enum class WaitResult { Pending, Success, Timeout, Error };
 
+    /**
+     * Link quality counters since boot.
+     **/
+    struct LinkStats {
+        // Number of data bytes (4 encoded bytes each) successfully received.
+        uint32_t frames_decoded{0};
+        // Number of received bytes that had to be discarded because they were not part of a valid frame.
+        uint32_t stray_bytes{0};
+        // Encoded bytes the frame aligner looked at. At most 5 per received byte plus 10 per read call, see
+        // tools/jutta_fuzz.cpp.
+        uint32_t bytes_inspected{0};
+        // Number of times stray bytes had to be discarded to find a frame boundary again.
+        uint32_t resync_events{0};
+        // Frames accepted despite filler bits read as 0 (see set_frame_tolerance()) and the number of those bits.
+        uint32_t corrected_frames{0};
+        uint32_t corrected_bits{0};
+        // Number of frames (4 encoded bytes each) lost in total and during the worst resync.
+        uint32_t frames_lost{0};
+        uint32_t max_frames_lost{0};
+        // Number of reads that ended with less than a full frame buffered.
+        uint32_t undersized_reads{0};
+        // Number of encoded frames that could not be written completely.
+        uint32_t tx_failures{0};
+        // millis() of the last successfully decoded byte.
+        uint32_t last_rx_ms{0};
+        // Received messages that ended without a "\r\n" and got closed once the line went quiet.
+        uint32_t idle_delimited{0};
+        // Received lines starting with "@T" (the coffee maker asks for a new key exchange) and "ty:".
+        uint32_t session_requests{0};
+        uint32_t type_replies{0};
+    };
+
+    // Upper bound of encoded frames consumed by a single read call.
+    static constexpr size_t MAX_FRAMES_PER_READ = 64;
+    // Pause after every encoded byte, unless the coffee maker's profile or the configuration asks for a different one.
+    static constexpr uint32_t DEFAULT_BYTE_GAP_US = 8000;
+    // The coffee maker paces its own bytes: an 8 ms gap plus 10 bit at 9600 baud, no matter which gap we send with.
+    static constexpr uint32_t RX_BYTE_INTERVAL_US = 8000 + 1042;
+    // A message without a "\r\n" is complete once no byte arrived for this many RX byte intervals, but at least
+    // MIN_MESSAGE_IDLE_US.
+    static constexpr uint8_t DEFAULT_MESSAGE_IDLE_GAPS = 4;
+    static constexpr uint32_t MIN_MESSAGE_IDLE_US = 20000;
+
  private:
     serial::SerialConnection serial;
+    // The transport all I/O goes through. Points to "serial" unless a decorator has been installed.
+    const serial::Transport* transport{&serial};
+#ifdef USE_JUTTA_FAULT_INJECTION
+    std::unique_ptr<serial::FaultInjectingTransport> fault_injector_{};
+#endif
+#ifdef USE_JUTTA_TRAFFIC_RECORDER
+    std::unique_ptr<TrafficRecorder> recorder_{};
+#endif
 
  public:
     /**
@@ -25,26 +91,128 @@ class JuttaConnection {
      * ESPHome provides the configured UART component.
      **/
     explicit JuttaConnection(esphome::uart::UARTComponent* parent);
+    JuttaConnection(const JuttaConnection&) = delete;
+    JuttaConnection& operator=(const JuttaConnection&) = delete;
 
     /**
      * Tries to initializes the Jutta serial (UART) connection.
      * Throws a exception in case something goes wrong.
-     * [Thread Safe]
      **/
     void init();
 
+    /**
+     * Routes all I/O through the given transport instead of the UART, e.g. to replay recorded traffic on the host.
+     * Replaces an installed fault injector. nullptr switches back to the UART.
+     **/
+    void set_transport(const serial::Transport* transport) { this->transport = transport != nullptr ? transport : &this->serial; }
+
+    /**
+     * Sets the pause in microseconds after every encoded byte written and before reading the next one.
+     **/
+    void set_byte_gap(uint32_t gap_us) { this->byte_gap_us_ = gap_us; }
+    [[nodiscard]] uint32_t get_byte_gap() const { return this->byte_gap_us_; }
+
+    /**
+     * Sets how many filler bits per frame may read as 0 before the frame gets dropped as noise. The data bits do not
+     * depend on them, so such a frame still decodes correctly. 0 only accepts exact frames.
+     **/
+    void set_frame_tolerance(uint8_t bits) { this->frame_tolerance_ = bits; }
+    [[nodiscard]] uint8_t get_frame_tolerance() const { return this->frame_tolerance_; }
+
+    /**
+     * Sets after how many RX byte intervals without a received byte a message lacking its "\r\n" counts as complete.
+     * Independent of the byte gap, a calibrated short gap only speeds up sending.
+     **/
+    void set_message_idle_gaps(uint8_t gaps) { this->message_idle_gaps_ = gaps; }
+    [[nodiscard]] uint32_t get_message_idle_time() const {
+        return std::max(this->message_idle_gaps_ * RX_BYTE_INTERVAL_US, MIN_MESSAGE_IDLE_US);
+    }
+    /**
+     * True in case no byte arrived for get_message_idle_time(), i.e. the last message is complete.
+     **/
+    [[nodiscard]] bool rx_idle() const;
+
+#if JUTTA_TX_SCHEDULER_ENABLED
+    /**
+     * Registers with the given scheduler. From then on writes only queue the encoded bytes and return right away,
+     * the scheduler sends them. Reads no longer wait for a gap but take whatever arrived since the last call.
+     **/
+    void set_tx_scheduler(TxScheduler* scheduler);
+    /**
+     * Writes the next queued byte. Called by the scheduler once the gap after the previous one has passed.
+     **/
+    void send_queued_byte();
+#endif
+    /**
+     * True while written bytes are still queued for the scheduler. Always false without it.
+     **/
+    [[nodiscard]] bool tx_pending() const {
+#if JUTTA_TX_SCHEDULER_ENABLED
+        return !this->tx_queue_.empty();
+#else
+        return false;
+#endif
+    }
+
+#ifdef USE_JUTTA_FAULT_INJECTION
+    /**
+     * Routes all received data of the installed transport through a FaultInjectingTransport using the given profile.
+     * Calling it again replaces the profile and starts with fresh fault counters.
+     * Only meant for bench testing the recovery paths and for tools/jutta_replay.cpp.
+     **/
+    void enable_fault_injection(const serial::FaultProfile& profile);
+    /**
+     * Returns the active fault injector or nullptr in case fault injection is disabled.
+     **/
+    [[nodiscard]] const serial::FaultInjectingTransport* get_fault_injector() const { return this->fault_injector_.get(); }
+#endif
+#ifdef USE_JUTTA_LOOP_PROFILER
+    /**
+     * Sets the profiler the time spent on TX and RX gets reported to.
+     **/
+    void set_profiler(LoopProfiler* profiler) { this->profiler_ = profiler; }
+#endif
+#ifdef USE_JUTTA_TRAFFIC_RECORDER
+    /**
+     * Starts recording all raw bytes written and read into a ring buffer of the given size in bytes.
+     * The buffer gets allocated here, once.
+     **/
+    void enable_traffic_recorder(size_t capacity);
+    /**
+     * Returns the traffic recorder or nullptr in case recording is disabled.
+     **/
+    [[nodiscard]] TrafficRecorder* get_traffic_recorder() const { return this->recorder_.get(); }
+#endif
+
+    /**
+     * Returns the link quality counters.
+     **/
+    [[nodiscard]] const LinkStats& get_link_stats() const { return this->link_stats_; }
+#ifdef USE_JUTTA_HEAP_FREE
+    /**
+     * Returns how many bytes the fixed capacity buffers had to drop since boot.
+     **/
+    [[nodiscard]] uint32_t get_buffer_overflows() const;
+#endif
+
+    /**
+     * Logs all bytes traced since the last call, one line per message and direction.
+     * Formatting happens here instead of on the byte path.
+     * Does nothing in case the log level is below debug.
+     * Not thread safe!
+     **/
+    void flush_trace() const;
+
     /**
      * Tries to read a single decoded byte.
      * This requires reading 4 JUTTA bytes and converting them to a single actual data byte.
      * The result will be stored in the given "byte" pointer.
      * Returns true on success.
-     * [Thread Safe]
      **/
     bool read_decoded(uint8_t* byte);
     /**
      * Reads as many data bytes, as there are availabel.
      * Each data byte consists of 4 JUTTA bytes which will be decoded into a single data byte.
-     * [Thread Safe]
      **/
     bool read_decoded(std::vector<uint8_t>& data);
     /**
@@ -61,7 +229,6 @@ class JuttaConnection {
      * To disable the timeout, set the timeout to 0 seconds.
      * Returns true on success.
      * Returns false when a timeout occurred or writing failed.
-     * [Thread Safe]
      **/
     WaitResult write_decoded_wait_for(const std::vector<uint8_t>& data, const std::string& response,
                                       const std::chrono::milliseconds& timeout = std::chrono::milliseconds{5000});
@@ -72,29 +239,48 @@ class JuttaConnection {
      * To disable the timeout, set the timeout to 0 seconds.
      * Returns true on success.
      * Returns false when a timeout occurred or writing failed.
-     * [Thread Safe]
      **/
     WaitResult write_decoded_wait_for(const std::string& data, const std::string& response,
                                       const std::chrono::milliseconds& timeout = std::chrono::milliseconds{5000});
 
     /**
      * Writes the given data to the coffee maker and then waits for any response with an optional timeout.
+     * On success "response" points to the received data inside the connection, so nothing gets allocated or copied.
+     * The view stays valid until the next call that reads from this connection, copy it in case it is needed longer.
      * The default timeout for this operation is 5 seconds.
      * To disable the timeout, set the timeout to 0 seconds.
-     * Returns true on success.
-     * Returns false when a timeout occurred or writing failed.
-     * [Thread Safe]
+     * Returns the current wait status.
+     **/
+    WaitResult write_decoded_with_response(const std::vector<uint8_t>& data, std::string_view* response,
+                                           const std::chrono::milliseconds& timeout = std::chrono::milliseconds{5000});
+    /**
+     * Writes the given data to the coffee maker and then waits for any response with an optional timeout.
+     * On success "response" points to the received data inside the connection, so nothing gets allocated or copied.
+     * The view stays valid until the next call that reads from this connection, copy it in case it is needed longer.
+     * The default timeout for this operation is 5 seconds.
+     * To disable the timeout, set the timeout to 0 seconds.
+     * Returns the current wait status.
+     **/
+    WaitResult write_decoded_with_response(const std::string& data, std::string_view* response,
+                                           const std::chrono::milliseconds& timeout = std::chrono::milliseconds{5000});
+    /**
+     * Writes the given data to the coffee maker and then waits for any response with an optional timeout.
+     * Adapter that copies the response into a new string, prefer the std::string_view overload.
+     * The default timeout for this operation is 5 seconds.
+     * To disable the timeout, set the timeout to 0 seconds.
+     * Returns the response on success.
+     * Returns nullptr while waiting, when a timeout occurred or writing failed.
      **/
     std::shared_ptr<std::string> write_decoded_with_response(const std::vector<uint8_t>& data,
                                                              const std::chrono::milliseconds& timeout =
                                                                  std::chrono::milliseconds{5000});
     /**
      * Writes the given data to the coffee maker and then waits for any response with an optional timeout.
+     * Adapter that copies the response into a new string, prefer the std::string_view overload.
      * The default timeout for this operation is 5 seconds.
      * To disable the timeout, set the timeout to 0 seconds.
-     * Returns true on success.
-     * Returns false when a timeout occurred or writing failed.
-     * [Thread Safe]
+     * Returns the response on success.
+     * Returns nullptr while waiting, when a timeout occurred or writing failed.
      **/
     std::shared_ptr<std::string> write_decoded_with_response(const std::string& data,
                                                              const std::chrono::milliseconds& timeout =
@@ -102,12 +288,10 @@ class JuttaConnection {
 
     /**
      * Encodes the given byte into 4 JUTTA bytes and writes them to the coffee maker.
-     * [Thread Safe]
      **/
     bool write_decoded(const uint8_t& byte);
     /**
      * Encodes each byte of the given bytes into 4 JUTTA bytes and writes them to the coffee maker.
-     * [Thread Safe]
      **/
     bool write_decoded(const std::vector<uint8_t>& data);
     /**
@@ -115,14 +299,13 @@ class JuttaConnection {
      *
      * An example call could look like: write_decoded("TY:\r\n");
      * This would request the device type from the coffee maker.
-     * [Thread Safe]
      **/
     bool write_decoded(const std::string& data);
 
     /**
      * Helper function used for debugging.
      * Prints the given byte in binary, hex and as a char.
-     * Does not append a new line at the end!
+     * Only logs at debug level and above.
      *
      * Example output:
      * 0 1 0 1 0 1 0 0 -> 84    54      T
@@ -155,18 +338,12 @@ class JuttaConnection {
  private:
     /**
      * Encodes the given byte into four bytes that the coffee maker understands.
-     * Based on: http://protocoljura.wiki-site.com/index.php/Protocol_to_coffeemaker
-     *
-     * A full documentation of the process can be found here:
-     * https://github.com/Jutta-Proto/protocol-cpp#deobfuscating
+     * See codec::encode() for details.
      **/
     static std::array<uint8_t, 4> encode(const uint8_t& decData);
     /**
      * Decodes the given four bytes read from the coffee maker into on byte.
-     * Based on: http://protocoljura.wiki-site.com/index.php/Protocol_to_coffeemaker
-     *
-     * A full documentation of the process can be found here:
-     * https://github.com/Jutta-Proto/protocol-cpp#deobfuscating
+     * See codec::decode() for details.
      **/
     static uint8_t decode(const std::array<uint8_t, 4>& encData);
     /**
@@ -179,12 +356,6 @@ class JuttaConnection {
      * Not thread safe!
      **/
     [[nodiscard]] bool read_encoded_unsafe(std::array<uint8_t, 4>& buffer) const;
-    /**
-     * Reads multiples of four bytes. Every four bytes represent one actual byte.
-     * Returns the number of 4 byte tuples read.
-     * Not thread safe!
-     **/
-    [[nodiscard]] size_t read_encoded_unsafe(std::vector<std::array<uint8_t, 4>>& data) const;
     /**
      * Tries to read a single decoded byte.
      * This requires reading 4 JUTTA bytes and converting them to a single actual data byte.
@@ -194,12 +365,21 @@ class JuttaConnection {
      **/
     [[nodiscard]] bool read_decoded_unsafe(uint8_t* byte) const;
     /**
-     * Reads as many data bytes, as there are availabel.
+     * Reads as many data bytes, as there are availabel, and appends them to the given buffer.
      * Each data byte consists of 4 JUTTA bytes which will be decoded into a single data byte.
+     * Stops after at most max_frames bytes, so a continuous stream can not stall the caller.
      * Not thread safe!
      **/
-    [[nodiscard]] bool read_decoded_unsafe(std::vector<uint8_t>& data) const;
+    template <typename Buffer>
+    [[nodiscard]] bool read_decoded_unsafe(Buffer& data, size_t max_frames = MAX_FRAMES_PER_READ) const;
 
+    /**
+     * Drops stray bytes from the front of the encoded RX buffer until it starts with a valid JUTTA frame, or one
+     * within the frame tolerance.
+     * Runs in linear time of the buffer size.
+     * Returns true in case a complete valid frame is at the front of the buffer.
+     * Not thread safe!
+     **/
     [[nodiscard]] bool align_encoded_rx_buffer() const;
     void flush_serial_input() const;
 
@@ -224,7 +404,8 @@ class JuttaConnection {
 
     /**
      * Waits until the coffee maker responded with the given response.
-     * The response has to include the "\r\n" at the end of a message.
+     * The response has to include the "\r\n" at the end of a message. Also succeeds in case the coffee maker left out
+     * the "\r\n" and the line went idle right after the rest of the response.
      * The default timeout for this operation is 5 seconds.
      * To disable the timeout, set the timeout to 0 seconds.
      * Returns true on success.
@@ -237,18 +418,34 @@ class JuttaConnection {
 
     /**
      * Waits for any response with an optional timeout.
+     * The response is complete once it ends with "\r\n", the line went idle or MAX_FRAMES_PER_READ bytes arrived.
      * The default timeout for this operation is 5 seconds.
      * To disable the timeout, set the timeout to 0 seconds.
-     * Returns the string on success.
+     * On success "response" points to the received data in rx_scratch_.
      * Not thread safe!
      **/
-    [[nodiscard]] std::shared_ptr<std::string> wait_for_str_unsafe(
-        const std::chrono::milliseconds& timeout = std::chrono::milliseconds{5000});
+    [[nodiscard]] WaitResult wait_for_str_unsafe(std::string_view* response,
+                                                 const std::chrono::milliseconds& timeout =
+                                                     std::chrono::milliseconds{5000});
+
+#ifdef USE_JUTTA_HEAP_FREE
+    // Partial frames plus a re-injected response.
+    using EncodedBuffer = StaticVector<uint8_t, 128>;
+    using DecodedBuffer = StaticVector<uint8_t, MAX_FRAMES_PER_READ>;
+    // Expected responses are short. The window holds the tail of the previous read plus a full read.
+    using ResponseString = StaticString<32>;
+    using WindowString = StaticString<32 + MAX_FRAMES_PER_READ>;
+#else
+    using EncodedBuffer = std::vector<uint8_t>;
+    using DecodedBuffer = std::vector<uint8_t>;
+    using ResponseString = std::string;
+    using WindowString = std::string;
+#endif
 
     struct WaitContext {
         bool active{false};
-        std::string expected{};
-        std::string recent{};
+        ResponseString expected{};
+        WindowString recent{};
         std::chrono::milliseconds timeout{std::chrono::milliseconds{5000}};
         uint32_t start_time{0};
     };
@@ -266,12 +463,51 @@ class JuttaConnection {
 
     // Buffer of partially received encoded bytes that haven't formed a full
     // decoded data byte yet.
-    mutable std::vector<uint8_t> encoded_rx_buffer_{};
+    mutable EncodedBuffer encoded_rx_buffer_{};
+    // Decoded bytes of the current wait call, kept to reuse its storage. Responses handed out as views point here.
+    DecodedBuffer rx_scratch_{};
 
-    // Buffer for decoded bytes that were read ahead of the consumer.
-    mutable std::deque<uint8_t> decoded_rx_buffer_{};
+    mutable LinkStats link_stats_{};
+    uint32_t byte_gap_us_{DEFAULT_BYTE_GAP_US};
+    uint32_t message_idle_gaps_{DEFAULT_MESSAGE_IDLE_GAPS};
+    uint8_t frame_tolerance_{0};
+    // micros() when the last raw byte got received.
+    mutable uint32_t last_rx_us_{0};
+#if JUTTA_TX_SCHEDULER_ENABLED
+    TxScheduler* tx_scheduler_{nullptr};
+    // Encoded bytes waiting for their TX slot.
+#ifdef USE_JUTTA_HEAP_FREE
+    // A full custom brew command at 4 encoded bytes per character.
+    mutable StaticVector<uint8_t, 4 * 64> tx_queue_{};
+#else
+    mutable std::deque<uint8_t> tx_queue_{};
+#endif
+#endif
+#ifdef USE_JUTTA_LOOP_PROFILER
+    LoopProfiler* profiler_{nullptr};
+#endif
+    // Start of the line currently being received, used to spot "@T" and "ty:" messages.
+    mutable std::array<char, 3> rx_line_start_{};
+    mutable size_t rx_line_length_{0};
+#if JUTTA_TRACE_ENABLED
+    mutable trace::TraceBuffer trace_{};
+#endif
 
     void reinject_decoded_front(const std::string& data) const;
+    /**
+     * Reads at maximum four bytes from the transport and records them in case the traffic recorder is enabled.
+     * Returns how many bytes have been read.
+     **/
+    size_t read_transport(std::array<uint8_t, 4>& chunk) const;
+    /**
+     * Gives the coffee maker time to send the next encoded byte before reading. Skipped with the TX scheduler.
+     **/
+    void wait_for_rx_gap() const;
+    /**
+     * Updates the link statistics with the given freshly received data byte.
+     * Not thread safe!
+     **/
+    void observe_rx(uint8_t byte) const;
 
 };
 //---------------------------------------------------------------------------
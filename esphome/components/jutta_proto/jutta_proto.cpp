@@ -1,7 +1,13 @@
 #include "esphome/components/jutta_proto/jutta_proto.h"
 
+#include <cinttypes>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string_view>
 #include <utility>
 
+#include "esphome/core/helpers.h"
 #include "esphome/core/time.h"
 
 namespace esphome {
@@ -9,253 +15,965 @@ namespace jutta_component {
 
 static const char *const TAG = "jutta_proto";
 
+// The link counts as lost after this many unacknowledged commands in a row,
+static const uint32_t LINK_MAX_CONSECUTIVE_TIMEOUTS = 2;
+// or after a single one in case the coffee maker did not send anything for this long.
+static const uint32_t LINK_SILENCE_TIMEOUT_MS = 10000;
+// Requests queued while (re-)connecting are dropped when the link is not back in time.
+static const uint32_t PENDING_REQUEST_EXPIRY_MS = 30000;
+// How long to wait for the answer to a keep-alive probe and when to retry an unanswered one.
+static const uint32_t KEEP_ALIVE_PROBE_TIMEOUT_MS = 1000;
+static const uint32_t KEEP_ALIVE_RETRY_MS = 5000;
+// The link counts as lost after this many unanswered probes in a row.
+static const uint32_t KEEP_ALIVE_MAX_FAILURES = 2;
+// How often the command latency sensors get updated.
+static const uint32_t LATENCY_PUBLISH_INTERVAL_MS = 60000;
+// How often link quality problems get summarized in the log and the link quality sensors get updated.
+static const uint32_t LINK_QUALITY_REPORT_INTERVAL_MS = 60000;
+
+#ifdef USE_JUTTA_TRAFFIC_RECORDER
+// Raw bytes per traffic dump log line (64 base64 characters) and lines logged per loop().
+static const size_t TRAFFIC_DUMP_CHUNK_SIZE = 48;
+static const size_t TRAFFIC_DUMP_LINES_PER_LOOP = 4;
+#endif
+
+#ifdef USE_JUTTA_BRIDGE
+// Captured bytes per direction decoded per loop(), so logging never holds up forwarding for long.
+static const size_t BRIDGE_DECODE_BYTES_PER_LOOP = 32;
+// The bridge adds more latency than a byte slot in case loop() takes longer than this.
+static const uint32_t BRIDGE_MAX_POLL_GAP_US = 8000;
+#endif
+
+static const char *const COMMAND_CLASS_NAMES[] = {"FN", "FA", "other"};
+
+// Copies the given string into a fixed size cache field. Returns false in case it does not fit.
+template<size_t N> static bool copy_to_field(char (&field)[N], const std::string &value) {
+  if (value.size() >= N) {
+    return false;
+  }
+  std::memset(field, 0, N);
+  std::memcpy(field, value.data(), value.size());
+  return true;
+}
+
 void JuraComponent::setup() {
   if (this->parent_ == nullptr) {
     ESP_LOGE(TAG, "UART parent not configured for JUTTA Proto component.");
     this->mark_failed();
     return;
   }
+#ifdef USE_JUTTA_BRIDGE
+  if (this->bridge_dongle_ != nullptr) {
+    this->setup_bridge();
+    return;
+  }
+#endif
 
   this->connection_ = std::make_unique<::jutta_proto::JuttaConnection>(this->parent_);
   this->connection_->init();
+  this->connection_->set_message_idle_gaps(this->message_idle_gaps_);
+  this->connection_->set_frame_tolerance(this->frame_tolerance_);
+#ifdef USE_JUTTA_LOOP_PROFILER
+  this->connection_->set_profiler(&this->profiler_);
+  this->set_interval("loop_profile", 60000, [this]() { this->submit({{}, &JuraComponent::publish_loop_profile}); });
+#endif
+#ifdef USE_JUTTA_TRAFFIC_RECORDER
+  this->connection_->enable_traffic_recorder(this->traffic_recorder_size_);
+#endif
+#if JUTTA_TX_SCHEDULER_ENABLED
+  this->connection_->set_tx_scheduler(&::jutta_proto::TxScheduler::shared());
+  this->reported_tx_ms_ = esphome::millis();
+#endif
+#ifdef USE_JUTTA_FAULT_INJECTION
+  this->connection_->enable_fault_injection(this->fault_profile_);
+  this->set_interval("fault_report", 60000, [this]() { this->submit({{}, &JuraComponent::log_fault_report}); });
+#endif
 
-  this->handshake_stage_ = HandshakeStage::HELLO;
-  ESP_LOGI(TAG, "Starting handshake with coffee maker...");
+  this->set_interval("link_quality", LINK_QUALITY_REPORT_INTERVAL_MS,
+                     [this]() { this->submit({{}, &JuraComponent::report_link_quality}); });
+#ifdef USE_SENSOR
+  bool has_latency_sensors = !this->latency_sensors_.empty();
+  for (auto *sensor : this->timeout_sensors_) {
+    has_latency_sensors |= sensor != nullptr;
+  }
+  if (has_latency_sensors) {
+    this->set_interval("latency", LATENCY_PUBLISH_INTERVAL_MS,
+                       [this]() { this->submit({{}, &JuraComponent::publish_latency}); });
+  }
+#endif
+
+#ifdef USE_JUTTA_PROTOCOL_TASK
+  // Reserved once, so the device type strings do not grow later on:
+  this->posted_device_type_.reserve(sizeof(HandshakeCache::device_type));
+  this->status_device_type_.reserve(sizeof(HandshakeCache::device_type));
+#endif
+
+  this->handshake_pref_ =
+      global_preferences->make_preference<HandshakeCache>(fnv1_hash("jutta_proto_handshake_" + this->preference_id_), true);
+#ifdef USE_JUTTA_BYTE_GAP_CALIBRATION
+  if (this->calibrate_byte_gap_) {
+    this->byte_gap_pref_ =
+        global_preferences->make_preference<ByteGapCache>(fnv1_hash("jutta_proto_byte_gap_" + this->preference_id_), true);
+    if (this->byte_gap_pref_.load(&this->byte_gap_cache_)) {
+      this->byte_gap_cache_.device_type[sizeof(this->byte_gap_cache_.device_type) - 1] = '\0';
+    } else {
+      this->byte_gap_cache_ = {};
+    }
+  }
+#endif
+  this->handshake_start_time_ = esphome::millis();
+  if (this->fast_resume_ && this->load_handshake_cache()) {
+    this->handshake_.resume(this->handshake_cache_.device_type, this->handshake_cache_.t2_response,
+                            this->handshake_cache_.t3_response);
+    ESP_LOGI(TAG, "Probing coffee maker for a fast resume as %s...", this->handshake_cache_.device_type);
+  } else {
+    this->handshake_.start();
+    ESP_LOGI(TAG, "Starting handshake with coffee maker...");
+  }
+
+#ifdef USE_JUTTA_PROTOCOL_TASK
+  // From here on only the protocol task touches the connection and the coffee maker:
+  if (!this->protocol_task_.start("jutta_proto", [this]() { this->protocol_task_step(); })) {
+    ESP_LOGE(TAG, "Failed to start the protocol task.");
+    this->mark_failed();
+  }
+#endif
 }
 
 void JuraComponent::loop() {
-  if (this->connection_ != nullptr && this->handshake_stage_ != HandshakeStage::DONE &&
-      this->handshake_stage_ != HandshakeStage::FAILED) {
+#ifdef USE_JUTTA_BRIDGE
+  if (this->bridge_ != nullptr) {
+    this->run_bridge();
+    return;
+  }
+#endif
+#ifdef USE_JUTTA_PROTOCOL_TASK
+  this->handle_events();
+#else
+  this->run_protocol();
+  this->dispatch_pending_notifications();
+#endif
+  this->resume_idle_waiters();
+}
+
+void JuraComponent::run_protocol() {
+  JUTTA_PROFILE_SCOPE(&this->profiler_, LOOP);
+  JUTTA_HEAP_SCOPE();
+  if (this->connection_ != nullptr && this->handshake_.is_running()) {
+    JUTTA_PROFILE_SCOPE(&this->profiler_, HANDSHAKE);
     this->process_handshake();
   }
 
-  if (this->coffee_maker_ != nullptr) {
-    this->coffee_maker_->loop();
+#ifdef USE_JUTTA_BYTE_GAP_CALIBRATION
+  if (this->link_ready() && this->calibrating_byte_gap()) {
+    this->run_byte_gap_calibration();
+  }
+#endif
+  if (this->link_ready() && !this->calibrating_byte_gap()) {
+    {
+      JUTTA_PROFILE_SCOPE(&this->profiler_, COFFEE_MAKER);
+      this->coffee_maker_->loop();
+    }
     if (!this->coffee_maker_->is_locked()) {
       this->custom_cancel_flag_ = false;
     }
+#ifdef USE_JUTTA_HEAP_FREE
+    this->track_brew_allocations();
+#endif
+    this->check_link_health();
+  }
+  if (this->link_ready() && !this->calibrating_byte_gap()) {
+    this->run_keep_alive();
+  }
+  // Also while the link stays down, so nothing waits on a request that will never run:
+  this->expire_pending_request();
+  if (this->accepts_commands()) {
+    this->replay_pending_request();
   }
+#ifdef USE_JUTTA_TRAFFIC_RECORDER
+  this->continue_traffic_dump();
+#endif
+#if JUTTA_TX_SCHEDULER_ENABLED
+  this->service_tx_slots();
+#endif
+#if JUTTA_TRACE_ENABLED
+  // Format what the byte path traced during this loop:
+  const auto *connection = this->active_connection();
+  if (connection != nullptr) {
+    connection->flush_trace();
+  }
+#endif
 }
 
 void JuraComponent::dump_config() {
+#ifdef USE_JUTTA_BRIDGE
+  if (this->bridge_dongle_ != nullptr) {
+    this->log_bridge_config();
+    return;
+  }
+#endif
+  this->submit({{}, &JuraComponent::log_config});
+}
+
+#ifdef USE_JUTTA_BRIDGE
+void JuraComponent::setup_bridge() {
+  this->bridge_ = std::make_unique<::jutta_proto::Bridge>(this->parent_, this->bridge_dongle_);
+#ifdef USE_JUTTA_TRAFFIC_RECORDER
+  this->bridge_->enable_traffic_recorder(this->traffic_recorder_size_);
+#endif
+  // Every byte has to be passed on within a byte slot, so loop() has to come around as often as possible:
+  this->bridge_high_freq_.start();
+  ESP_LOGI(TAG, "Bridging the dongle and the coffee maker, no handshake of our own.");
+}
+
+void JuraComponent::run_bridge() {
+  using ::jutta_proto::Bridge;
+
+  this->bridge_->forward(esphome::micros());
+  this->bridge_->decode(BRIDGE_DECODE_BYTES_PER_LOOP, [](Bridge::Side from, Bridge::Kind kind, const std::string &message) {
+    const Bridge::Side to = from == Bridge::Side::MACHINE ? Bridge::Side::DONGLE : Bridge::Side::MACHINE;
+    ESP_LOGD(TAG, "Bridge %s -> %s (%s): %s", Bridge::side_name(from), Bridge::side_name(to), Bridge::kind_name(kind),
+             message.c_str());
+  });
+  this->bridge_->take_injection_result([](const std::string &command, const std::string &reply) {
+    if (reply.empty()) {
+      ESP_LOGW(TAG, "Injected %s, no answer from the coffee maker.", command.c_str());
+    } else {
+      ESP_LOGI(TAG, "Injected %s, coffee maker answered %s", command.c_str(), reply.c_str());
+    }
+  });
+  // Logging takes a while, pass on what arrived meanwhile:
+  this->bridge_->forward(esphome::micros());
+#ifdef USE_JUTTA_TRAFFIC_RECORDER
+  this->continue_traffic_dump();
+#endif
+}
+
+void JuraComponent::log_bridge_config() {
+  using ::jutta_proto::Bridge;
+
+  ESP_LOGCONFIG(TAG, "JUTTA Proto");
+  ESP_LOGCONFIG(TAG, "  Mode: bridge between dongle and coffee maker");
+  if (this->bridge_ == nullptr) {
+    return;
+  }
+  const auto &stats = this->bridge_->stats();
+  for (auto from : {Bridge::Side::DONGLE, Bridge::Side::MACHINE}) {
+    const auto &direction = stats.directions[static_cast<size_t>(from)];
+    ESP_LOGCONFIG(TAG,
+                  "  From %s: %" PRIu32 " bytes forwarded, %" PRIu32 " messages (%" PRIu32 " commands, %" PRIu32
+                  " responses, %" PRIu32 " key exchange, %" PRIu32 " other), %" PRIu32 " bytes not decoded",
+                  Bridge::side_name(from), direction.forwarded, direction.messages, direction.kinds[0],
+                  direction.kinds[1], direction.kinds[2], direction.kinds[3], direction.capture_dropped);
+  }
+  ESP_LOGCONFIG(TAG, "  Worst added latency: %" PRIu32 " us%s", stats.max_poll_gap_us,
+                stats.max_poll_gap_us > BRIDGE_MAX_POLL_GAP_US ? " (more than a byte slot)" : "");
+  ESP_LOGCONFIG(TAG, "  Injected: %" PRIu32 " commands, %" PRIu32 " unanswered, %" PRIu32 " dongle bytes dropped meanwhile",
+                stats.injected, stats.injection_timeouts, stats.hold_dropped);
+#ifdef USE_JUTTA_TRAFFIC_RECORDER
+  const auto *recorder = this->bridge_->get_traffic_recorder();
+  if (recorder != nullptr) {
+    ESP_LOGCONFIG(TAG, "  Traffic recorder: %zu of %zu bytes used, %" PRIu32 " entries overwritten",
+                  recorder->size() - ::jutta_proto::TrafficRecorder::HEADER_SIZE, recorder->capacity(),
+                  recorder->overwritten());
+  }
+#endif
+}
+#endif
+
+void JuraComponent::inject_command(const std::string &command) {
+#ifdef USE_JUTTA_BRIDGE
+  if (this->bridge_ != nullptr) {
+    ESP_LOGD(TAG, "Queueing %s for injection.", command.c_str());
+    this->bridge_->inject(command);
+    return;
+  }
+#endif
+  ESP_LOGW(TAG, "Cannot inject %s - only available with 'bridge:'.", command.c_str());
+}
+
+void JuraComponent::log_config() {
   ESP_LOGCONFIG(TAG, "JUTTA Proto");
-  if (!this->device_type_.empty()) {
-    ESP_LOGCONFIG(TAG, "  Detected device: %s", this->device_type_.c_str());
+  if (!this->handshake_.get_device_type().empty()) {
+    ESP_LOGCONFIG(TAG, "  Detected device: %s", this->handshake_.get_device_type().c_str());
   } else {
     ESP_LOGCONFIG(TAG, "  Detected device: (pending)");
   }
 
-  const char *state = "unknown";
-  switch (this->handshake_stage_) {
-    case HandshakeStage::IDLE:
-      state = "idle";
-      break;
-    case HandshakeStage::HELLO:
-      state = "awaiting type";
-      break;
-    case HandshakeStage::SEND_T1:
-      state = "waiting for @t1";
-      break;
-    case HandshakeStage::WAIT_T2:
-      state = "waiting for @T2";
-      break;
-    case HandshakeStage::SEND_T2:
-      state = "sending @t2";
-      break;
-    case HandshakeStage::WAIT_T3:
-      state = "waiting for @T3";
-      break;
-    case HandshakeStage::SEND_T3:
-      state = "sending @t3";
-      break;
-    case HandshakeStage::DONE:
-      state = "ready";
-      break;
-    case HandshakeStage::FAILED:
-      state = "failed";
-      break;
+  ESP_LOGCONFIG(TAG, "  Handshake state: %s", this->handshake_.get_stage_name());
+  ESP_LOGCONFIG(TAG, "  Fast resume: %s", YESNO(this->fast_resume_));
+
+  if (!this->handshake_.get_t2_response().empty()) {
+    ESP_LOGCONFIG(TAG, "  Last key exchange T2: %s", this->handshake_.get_t2_response().c_str());
+  }
+  if (!this->handshake_.get_t3_response().empty()) {
+    ESP_LOGCONFIG(TAG, "  Last key exchange T3: %s", this->handshake_.get_t3_response().c_str());
   }
-  ESP_LOGCONFIG(TAG, "  Handshake state: %s", state);
 
-  if (!this->handshake_t2_response_.empty()) {
-    ESP_LOGCONFIG(TAG, "  Last key exchange T2: %s", this->handshake_t2_response_.c_str());
+  // The coffee maker outlives a lost link, whose connection is back in connection_ during the handshake:
+  ESP_LOGCONFIG(TAG, "  Coffee maker ready: %s", YESNO(this->link_ready()));
+  if (this->coffee_maker_ != nullptr) {
+    ESP_LOGCONFIG(TAG, "  Model profile: %s", this->coffee_maker_->get_profile().name);
   }
-  if (!this->handshake_t3_response_.empty()) {
-    ESP_LOGCONFIG(TAG, "  Last key exchange T3: %s", this->handshake_t3_response_.c_str());
+  ESP_LOGCONFIG(TAG, "  Link re-established: %" PRIu32 " time(s)", this->relink_count_);
+  const auto *connection = this->active_connection();
+  if (connection != nullptr) {
+    ESP_LOGCONFIG(TAG, "  Byte gap: %" PRIu32 " us (%s)", connection->get_byte_gap(), this->byte_gap_source_);
+    const auto &link = connection->get_link_stats();
+    ESP_LOGCONFIG(TAG,
+                  "  Link quality: %" PRIu32 " bytes decoded, %" PRIu32 " stray bytes, %" PRIu32 " resyncs, %" PRIu32
+                  " undersized reads, %" PRIu32 " TX failures",
+                  link.frames_decoded, link.stray_bytes, link.resync_events, link.undersized_reads, link.tx_failures);
+    if (connection->get_frame_tolerance() > 0) {
+      ESP_LOGCONFIG(TAG,
+                    "  Frame tolerance: %u filler bit(s), %" PRIu32 " frame(s) with %" PRIu32 " bit(s) corrected",
+                    static_cast<unsigned>(connection->get_frame_tolerance()), link.corrected_frames,
+                    link.corrected_bits);
+    }
+    ESP_LOGCONFIG(TAG, "  Message end: \\r\\n or %" PRIu32 " us idle, %" PRIu32 " message(s) ended by idle",
+                  connection->get_message_idle_time(), link.idle_delimited);
+#ifdef USE_JUTTA_HEAP_FREE
+    ESP_LOGCONFIG(TAG,
+                  "  Heap free: %" PRIu32 " allocation(s) during the last brew, at most %" PRIu32 " over %" PRIu32
+                  " brew(s), %" PRIu32 " byte(s) dropped by full buffers",
+                  this->last_brew_allocations_, this->max_brew_allocations_, this->tracked_brews_,
+                  connection->get_buffer_overflows());
+#endif
+#ifdef USE_JUTTA_TRAFFIC_RECORDER
+    const auto *recorder = connection->get_traffic_recorder();
+    if (recorder != nullptr) {
+      ESP_LOGCONFIG(TAG, "  Traffic recorder: %zu of %zu bytes used, %" PRIu32 " entries overwritten",
+                    recorder->size() - ::jutta_proto::TrafficRecorder::HEADER_SIZE, recorder->capacity(),
+                    recorder->overwritten());
+    }
+#endif
+  }
+  ESP_LOGCONFIG(TAG, "  Ack timeout: %" PRIu32 " - %" PRIu32 " ms, %u resend(s) of FN: commands",
+                this->ack_timeout_min_ms_, this->ack_timeout_max_ms_, static_cast<unsigned>(this->ack_max_retries_));
+  if (this->keep_alive_.base_interval_ms > 0) {
+    ESP_LOGCONFIG(TAG, "  Keep-alive: every %" PRIu32 " ms up to %" PRIu32 " ms, %" PRIu32 " probe(s) sent",
+                  this->keep_alive_.base_interval_ms, this->keep_alive_.max_interval_ms, this->keep_alive_.probes_sent);
+  } else {
+    ESP_LOGCONFIG(TAG, "  Keep-alive: disabled");
   }
 
   if (this->coffee_maker_ != nullptr) {
-    ESP_LOGCONFIG(TAG, "  Coffee maker ready: %s", YESNO(true));
+    for (size_t i = 0; i < ::jutta_proto::CoffeeMaker::NUM_COMMAND_CLASSES; i++) {
+      const auto &latency =
+          this->coffee_maker_->get_command_latency(static_cast<::jutta_proto::CoffeeMaker::CommandClass>(i));
+      if (latency.tx.count() == 0 && latency.timeouts == 0) {
+        continue;
+      }
+      ESP_LOGCONFIG(TAG,
+                    "  %s commands: %" PRIu32 " sent, %" PRIu32 " timed out, %" PRIu32 " resent, ok: after %" PRIu32
+                    "/%" PRIu32 "/%" PRIu32 " ms (p50/p95/p99), timeout %" PRIu32 " ms",
+                    COMMAND_CLASS_NAMES[i], latency.tx.count(), latency.timeouts, latency.retries,
+                    latency.ack.percentile(50), latency.ack.percentile(95), latency.ack.percentile(99),
+                    latency.rtt.timeout_ms());
+    }
+  }
+
+#ifdef USE_SENSOR
+  LOG_SENSOR("  ", "Boot to ready", this->boot_to_ready_sensor_);
+  LOG_SENSOR("  ", "Frames decoded", this->frames_decoded_sensor_);
+  LOG_SENSOR("  ", "Stray bytes", this->stray_bytes_sensor_);
+  LOG_SENSOR("  ", "Resync events", this->resync_events_sensor_);
+  LOG_SENSOR("  ", "Corrected bits", this->corrected_bits_sensor_);
+  LOG_SENSOR("  ", "Undersized reads", this->undersized_reads_sensor_);
+  LOG_SENSOR("  ", "TX failures", this->tx_failures_sensor_);
+  for (const auto &latency : this->latency_sensors_) {
+    LOG_SENSOR("  ", "Command latency", latency.sensor);
+  }
+  for (auto *sensor : this->timeout_sensors_) {
+    LOG_SENSOR("  ", "Command timeouts", sensor);
+  }
+#endif
+
+#ifdef USE_JUTTA_LOOP_PROFILER
+  ESP_LOGCONFIG(TAG, "  Loop profile (budget %" PRIu32 " us, %" PRIu32 " loops over it):", this->profiler_.get_budget_us(),
+                this->profiler_.get_loops_over_budget());
+  for (uint8_t i = 0; i < ::jutta_proto::LoopProfiler::NUM_SECTIONS; i++) {
+    auto section = static_cast<::jutta_proto::LoopProfiler::Section>(i);
+    const auto &stats = this->profiler_.get_section(section);
+    ESP_LOGCONFIG(TAG, "    %-12s %8" PRIu32 " calls, mean %7" PRIu32 " us, max %7" PRIu32 " us",
+                  ::jutta_proto::LoopProfiler::section_name(section), stats.calls, stats.mean_us(), stats.max_us);
+  }
+#ifdef USE_SENSOR
+  LOG_SENSOR("  ", "Max loop time", this->max_loop_time_sensor_);
+  LOG_SENSOR("  ", "Loops over budget", this->loops_over_budget_sensor_);
+#endif
+#endif
+
+#if JUTTA_TX_SCHEDULER_ENABLED
+  const auto &scheduler = ::jutta_proto::TxScheduler::shared();
+  ESP_LOGCONFIG(TAG, "  TX scheduler: shared by %zu coffee makers, %" PRIu32 " bytes sent, worst slot delay %" PRIu32 " us",
+                scheduler.size(), scheduler.stats().bytes_sent, scheduler.stats().max_slot_delay_us);
+#endif
+#ifdef USE_SENSOR
+  LOG_SENSOR("  ", "TX throughput", this->tx_throughput_sensor_);
+#endif
+
+#ifdef USE_JUTTA_PROTOCOL_TASK
+  if (this->protocol_task_.get_core() == ::jutta_proto::ProtocolTask::NO_CORE) {
+    ESP_LOGCONFIG(TAG, "  Protocol task: any core, priority %u", this->protocol_task_.get_priority());
   } else {
-    ESP_LOGCONFIG(TAG, "  Coffee maker ready: %s", YESNO(false));
+    ESP_LOGCONFIG(TAG, "  Protocol task: core %d, priority %u", this->protocol_task_.get_core(),
+                  this->protocol_task_.get_priority());
+  }
+  ESP_LOGCONFIG(TAG, "    Stack: %" PRIu32 " bytes, at least %" PRIu32 " left, %" PRIu32 " event(s) dropped",
+                this->protocol_task_.get_stack_size(), this->protocol_task_.get_stack_headroom(), this->dropped_events_);
+#endif
+
+#ifdef USE_JUTTA_FAULT_INJECTION
+  const auto *injecting = this->active_connection();
+  if (injecting != nullptr && injecting->get_fault_injector() != nullptr) {
+    const auto &profile = injecting->get_fault_injector()->profile();
+    ESP_LOGCONFIG(TAG, "  Fault injection:");
+    ESP_LOGCONFIG(TAG, "    Profile: flip %.4f, drop %.4f, duplicate %.4f, gap %.4f (%" PRIu32 " ms), lost ok %.4f",
+                  profile.bit_flip_rate, profile.drop_rate, profile.duplicate_rate, profile.gap_rate, profile.gap_ms,
+                  profile.lost_ok_rate);
   }
+  this->log_fault_report();
+#endif
 }
 
 void JuraComponent::process_handshake() {
-  using ::jutta_proto::JuttaConnection;
-  using ::jutta_proto::JUTTA_GET_TYPE;
+  auto result = this->handshake_.step(this->connection_.get());
+  if (result == ::jutta_proto::Handshake::Result::Pending) {
+    return;
+  }
+  this->finish_handshake(result == ::jutta_proto::Handshake::Result::Resumed);
 
-  switch (this->handshake_stage_) {
-    case HandshakeStage::IDLE:
-      break;
-    case HandshakeStage::HELLO: {
-      auto response = this->connection_->write_decoded_with_response(JUTTA_GET_TYPE, std::chrono::milliseconds{1000});
-      if (response != nullptr) {
-        this->device_type_ = *response;
-        ESP_LOGI(TAG, "Detected coffee maker response: %s", this->device_type_.c_str());
-        this->handshake_buffer_.clear();
-        this->handshake_stage_ = HandshakeStage::SEND_T1;
-      }
-      break;
-    }
-    case HandshakeStage::SEND_T1: {
-      auto wait_result = this->connection_->write_decoded_wait_for("@T1\r\n", "@t1\r\n", std::chrono::milliseconds{1000});
-      if (wait_result == JuttaConnection::WaitResult::Success) {
-        ESP_LOGD(TAG, "Received @t1 acknowledgment.");
-        this->handshake_buffer_.clear();
-        this->handshake_deadline_ = 0;
-        this->handshake_stage_ = HandshakeStage::WAIT_T2;
-      } else if (wait_result == JuttaConnection::WaitResult::Timeout) {
-        this->restart_handshake("timeout waiting for @t1");
-      } else if (wait_result == JuttaConnection::WaitResult::Error) {
-        this->restart_handshake("failed to send @T1");
-      }
-      break;
+  if (this->coffee_maker_ == nullptr) {
+    auto connection = std::move(this->connection_);
+    this->coffee_maker_ = std::make_unique<::jutta_proto::CoffeeMaker>(std::move(connection));
+    this->coffee_maker_->set_ack_timeout(this->ack_timeout_min_ms_, this->ack_timeout_max_ms_, this->ack_max_retries_);
+    this->coffee_maker_->set_brew_listener(
+        [this](::jutta_proto::CoffeeMaker::BrewEvent event) { this->on_brew_event(event); });
+    ESP_LOGI(TAG, "Coffee maker controller initialized.");
+  } else {
+    this->coffee_maker_->connection = std::move(this->connection_);
+    ESP_LOGI(TAG, "Link to coffee maker re-established.");
+  }
+  const auto &profile = ::jutta_proto::find_model_profile(this->handshake_.get_device_type());
+  if (&profile != &this->coffee_maker_->get_profile()) {
+    ESP_LOGI(TAG, "Using the %s profile: %u pages, %" PRIu32 " us byte gap.", profile.name,
+             static_cast<unsigned>(profile.num_pages), profile.byte_gap_us);
+  }
+  // Also applies the byte gap to a replaced connection:
+  this->coffee_maker_->set_profile(profile);
+  this->apply_byte_gap(profile);
+}
+
+void JuraComponent::apply_byte_gap(const ::jutta_proto::ModelProfile &profile) {
+  auto *connection = this->coffee_maker_->connection.get();
+  if (this->byte_gap_us_ != 0) {
+    connection->set_byte_gap(this->byte_gap_us_);
+    this->byte_gap_source_ = "configured";
+    return;
+  }
+  this->byte_gap_source_ = "profile";
+#ifdef USE_JUTTA_BYTE_GAP_CALIBRATION
+  if (!this->calibrate_byte_gap_) {
+    return;
+  }
+  if (this->handshake_.get_device_type() == this->byte_gap_cache_.device_type &&
+      this->byte_gap_cache_.gap_us >= ::jutta_proto::GapCalibrator::MIN_GAP_US &&
+      this->byte_gap_cache_.gap_us <= profile.byte_gap_us) {
+    connection->set_byte_gap(this->byte_gap_cache_.gap_us);
+    this->byte_gap_source_ = "calibrated";
+    return;
+  }
+  // Also restarts a calibration the relink interrupted:
+  if (!this->byte_gap_calibration_attempted_ || this->gap_calibrator_.is_running()) {
+    this->byte_gap_calibration_attempted_ = true;
+    ESP_LOGI(TAG, "Calibrating the byte gap, starting at %" PRIu32 " us...", profile.byte_gap_us);
+    this->gap_calibrator_.start(profile.byte_gap_us, this->handshake_.get_device_type());
+    this->byte_gap_source_ = "calibrating";
+  }
+#else
+  (void) profile;
+#endif
+}
+
+void JuraComponent::finish_handshake(bool resumed) {
+  uint32_t now = esphome::millis();
+  this->last_handshake_duration_ms_ = now - this->handshake_start_time_;
+  if (this->last_handshake_duration_ms_ > this->max_handshake_duration_ms_) {
+    this->max_handshake_duration_ms_ = this->last_handshake_duration_ms_;
+  }
+  if (resumed) {
+    ESP_LOGI(TAG, "Resumed previous session after %" PRIu32 " ms.", this->last_handshake_duration_ms_);
+  } else {
+    ESP_LOGI(TAG, "Handshake finished successfully after %" PRIu32 " ms.", this->last_handshake_duration_ms_);
+    this->save_handshake_cache();
+  }
+
+  const auto &link = this->connection_->get_link_stats();
+  this->link_session_requests_ = link.session_requests;
+  this->link_type_replies_ = link.type_replies;
+  this->liveness_ = Liveness::ALIVE;
+  this->keep_alive_.probing = false;
+  this->keep_alive_.failures = 0;
+  this->keep_alive_.interval_ms = this->keep_alive_.base_interval_ms;
+  this->keep_alive_.last_probe = now;
+  this->notify(Notification::HANDSHAKE_COMPLETE);
+
+  if (this->ready_once_) {
+    return;
+  }
+  this->ready_once_ = true;
+#ifdef USE_SENSOR
+  if (this->boot_to_ready_sensor_ != nullptr) {
+    this->publish(this->boot_to_ready_sensor_, static_cast<float>(now));
+  }
+#endif
+}
+
+void JuraComponent::check_link_health() {
+  const auto &link = this->coffee_maker_->connection->get_link_stats();
+  uint32_t timeouts = this->coffee_maker_->get_consecutive_timeouts();
+  const char *reason = nullptr;
+  if (link.session_requests != this->link_session_requests_) {
+    reason = "coffee maker asked for a new key exchange";
+    // An outstanding keep-alive probe may have its "ty:" reply partly read already:
+  } else if (link.type_replies > this->link_type_replies_ + (this->keep_alive_.probing ? 1 : 0)) {
+    reason = "unexpected type reply";
+  } else if (timeouts >= LINK_MAX_CONSECUTIVE_TIMEOUTS) {
+    reason = "commands keep timing out";
+  } else if (timeouts > 0 && esphome::millis() - link.last_rx_ms >= LINK_SILENCE_TIMEOUT_MS) {
+    reason = "coffee maker went silent";
+  }
+  if (reason != nullptr) {
+    this->relink(reason);
+  }
+}
+
+void JuraComponent::run_keep_alive() {
+  KeepAliveState &keep_alive = this->keep_alive_;
+  if (keep_alive.base_interval_ms == 0) {
+    return;
+  }
+  auto *connection = this->coffee_maker_->connection.get();
+  uint32_t now = esphome::millis();
+
+  if (!keep_alive.probing) {
+    // Running commands prove that the coffee maker is there, so only probe once it has been quiet for a while:
+    if (this->coffee_maker_->is_locked() || now - connection->get_link_stats().last_rx_ms < keep_alive.interval_ms ||
+        now - keep_alive.last_probe < keep_alive.interval_ms) {
+      return;
     }
-    case HandshakeStage::WAIT_T2: {
-      if (this->handshake_deadline_ == 0) {
-        this->handshake_deadline_ = esphome::millis() + 5000;
-      }
-      bool any = this->read_handshake_bytes();
-      if (any) {
-        auto pos = this->handshake_buffer_.find("@T2");
-        if (pos != std::string::npos) {
-          auto end = this->handshake_buffer_.find("\r\n", pos);
-          if (end != std::string::npos) {
-            this->handshake_t2_response_ = this->handshake_buffer_.substr(pos, end - pos);
-          } else {
-            this->handshake_t2_response_ = this->handshake_buffer_.substr(pos);
-          }
-          ESP_LOGD(TAG, "Received %s", this->handshake_t2_response_.c_str());
-          this->handshake_buffer_.clear();
-          this->handshake_deadline_ = 0;
-          this->handshake_stage_ = HandshakeStage::SEND_T2;
-        }
-      }
-      if (this->handshake_deadline_ != 0 && time_reached(esphome::millis(), this->handshake_deadline_)) {
-        this->restart_handshake("timeout waiting for @T2");
-      }
-      break;
+    keep_alive.probing = true;
+    keep_alive.last_probe = now;
+    ++keep_alive.probes_sent;
+  }
+
+  std::string_view response;
+  auto wait_result = connection->write_decoded_with_response(
+      ::jutta_proto::JUTTA_GET_TYPE, &response, std::chrono::milliseconds{KEEP_ALIVE_PROBE_TIMEOUT_MS});
+  if (wait_result == ::jutta_proto::JuttaConnection::WaitResult::Success) {
+    keep_alive.probing = false;
+    // The answer is a "ty:" the link health check must not take for a restarted coffee maker. Only that one, another
+    // one arriving meanwhile is still noticed:
+    this->link_type_replies_ = std::min(connection->get_link_stats().type_replies, this->link_type_replies_ + 1);
+    if (keep_alive.failures > 0) {
+      keep_alive.failures = 0;
+      keep_alive.interval_ms = keep_alive.base_interval_ms;
+    } else {
+      keep_alive.interval_ms = std::min(keep_alive.interval_ms * 2, keep_alive.max_interval_ms);
     }
-    case HandshakeStage::SEND_T2: {
-      if (this->connection_->write_decoded("@t2:8120000000\r\n")) {
-        ESP_LOGD(TAG, "Sent @t2 response.");
-        this->handshake_stage_ = HandshakeStage::WAIT_T3;
-        this->handshake_buffer_.clear();
-        this->handshake_deadline_ = 0;
-      } else {
-        this->restart_handshake("failed to send @t2");
-      }
-      break;
+    this->liveness_ = Liveness::ALIVE;
+    return;
+  }
+  if (!time_reached(now, keep_alive.last_probe + KEEP_ALIVE_PROBE_TIMEOUT_MS)) {
+    return;
+  }
+
+  keep_alive.probing = false;
+  ++keep_alive.failures;
+  if (keep_alive.failures >= KEEP_ALIVE_MAX_FAILURES) {
+    this->relink("keep-alive probes unanswered");
+    return;
+  }
+  ESP_LOGW(TAG, "Coffee maker did not answer the keep-alive probe.");
+  this->liveness_ = Liveness::SILENT;
+  keep_alive.interval_ms = std::min(keep_alive.base_interval_ms, KEEP_ALIVE_RETRY_MS);
+}
+
+#ifdef USE_SENSOR
+void JuraComponent::publish_latency() {
+  if (this->coffee_maker_ == nullptr) {
+    return;
+  }
+  for (const auto &entry : this->latency_sensors_) {
+    const auto &latency = this->coffee_maker_->get_command_latency(
+        static_cast<::jutta_proto::CoffeeMaker::CommandClass>(entry.command_class));
+    const ::jutta_proto::LatencyHistogram *histogram = &latency.tx;
+    if (entry.phase == 1) {
+      histogram = &latency.ack;
+    } else if (entry.phase == 2) {
+      histogram = &latency.delay;
     }
-    case HandshakeStage::WAIT_T3: {
-      if (this->handshake_deadline_ == 0) {
-        this->handshake_deadline_ = esphome::millis() + 5000;
-      }
-      bool any = this->read_handshake_bytes();
-      if (any) {
-        auto pos = this->handshake_buffer_.find("@T3");
-        if (pos != std::string::npos) {
-          auto end = this->handshake_buffer_.find("\r\n", pos);
-          if (end != std::string::npos) {
-            this->handshake_t3_response_ = this->handshake_buffer_.substr(pos, end - pos);
-          } else {
-            this->handshake_t3_response_ = this->handshake_buffer_.substr(pos);
-          }
-          ESP_LOGD(TAG, "Received %s", this->handshake_t3_response_.c_str());
-          this->handshake_buffer_.clear();
-          this->handshake_deadline_ = 0;
-          this->handshake_stage_ = HandshakeStage::SEND_T3;
-        }
-      }
-      if (this->handshake_deadline_ != 0 && time_reached(esphome::millis(), this->handshake_deadline_)) {
-        this->restart_handshake("timeout waiting for @T3");
-      }
-      break;
+    if (histogram->count() > 0) {
+      this->publish(entry.sensor, static_cast<float>(histogram->percentile(entry.percentile)));
     }
-    case HandshakeStage::SEND_T3: {
-      if (this->connection_->write_decoded("@t3\r\n")) {
-        ESP_LOGI(TAG, "Handshake finished successfully.");
-        this->handshake_stage_ = HandshakeStage::DONE;
-        this->handshake_buffer_.clear();
-        this->handshake_deadline_ = 0;
-      } else {
-        this->restart_handshake("failed to send @t3");
-      }
-      break;
+  }
+  for (size_t i = 0; i < this->timeout_sensors_.size(); i++) {
+    if (this->timeout_sensors_[i] != nullptr) {
+      const auto &latency =
+          this->coffee_maker_->get_command_latency(static_cast<::jutta_proto::CoffeeMaker::CommandClass>(i));
+      this->publish(this->timeout_sensors_[i], static_cast<float>(latency.timeouts));
     }
-    case HandshakeStage::DONE:
-    case HandshakeStage::FAILED:
-      break;
   }
+}
+#endif
 
-  if (this->handshake_stage_ == HandshakeStage::DONE && this->connection_ != nullptr &&
-      this->coffee_maker_ == nullptr) {
-    auto connection = std::move(this->connection_);
-    this->coffee_maker_ = std::make_unique<::jutta_proto::CoffeeMaker>(std::move(connection));
-    ESP_LOGI(TAG, "Coffee maker controller initialized.");
+void JuraComponent::report_link_quality() {
+  const auto *connection = this->active_connection();
+  if (connection == nullptr) {
+    return;
+  }
+  const auto &link = connection->get_link_stats();
+  const auto &last = this->reported_link_stats_;
+  uint32_t stray_bytes = link.stray_bytes - last.stray_bytes;
+  uint32_t resyncs = link.resync_events - last.resync_events;
+  uint32_t undersized_reads = link.undersized_reads - last.undersized_reads;
+  uint32_t tx_failures = link.tx_failures - last.tx_failures;
+  uint32_t corrected_bits = link.corrected_bits - last.corrected_bits;
+  if (stray_bytes > 0 || resyncs > 0 || undersized_reads > 0 || tx_failures > 0 || corrected_bits > 0) {
+    ESP_LOGW(TAG,
+             "Link quality: %" PRIu32 " stray bytes in %" PRIu32 " resyncs, %" PRIu32 " undersized reads, %" PRIu32
+             " TX failures, %" PRIu32 " corrected bits and %" PRIu32 " bytes decoded in the last %" PRIu32 " s",
+             stray_bytes, resyncs, undersized_reads, tx_failures, corrected_bits,
+             link.frames_decoded - last.frames_decoded, LINK_QUALITY_REPORT_INTERVAL_MS / 1000);
+  }
+  this->reported_link_stats_ = link;
+#if JUTTA_TX_SCHEDULER_ENABLED
+  this->report_tx_throughput();
+#endif
+
+#ifdef USE_SENSOR
+  if (this->frames_decoded_sensor_ != nullptr) {
+    this->publish(this->frames_decoded_sensor_, static_cast<float>(link.frames_decoded));
+  }
+  if (this->stray_bytes_sensor_ != nullptr) {
+    this->publish(this->stray_bytes_sensor_, static_cast<float>(link.stray_bytes));
+  }
+  if (this->resync_events_sensor_ != nullptr) {
+    this->publish(this->resync_events_sensor_, static_cast<float>(link.resync_events));
+  }
+  if (this->undersized_reads_sensor_ != nullptr) {
+    this->publish(this->undersized_reads_sensor_, static_cast<float>(link.undersized_reads));
+  }
+  if (this->tx_failures_sensor_ != nullptr) {
+    this->publish(this->tx_failures_sensor_, static_cast<float>(link.tx_failures));
   }
+  if (this->corrected_bits_sensor_ != nullptr) {
+    this->publish(this->corrected_bits_sensor_, static_cast<float>(link.corrected_bits));
+  }
+#endif
 }
 
-void JuraComponent::restart_handshake(const char *reason) {
-  if (reason != nullptr) {
-    ESP_LOGW(TAG, "Restarting handshake: %s", reason);
+void JuraComponent::relink(const char *reason) {
+  ESP_LOGW(TAG, "Link to coffee maker lost (%s), re-running the handshake.", reason);
+  ++this->relink_count_;
+  this->liveness_ = Liveness::LOST;
+  this->keep_alive_.probing = false;
+  this->coffee_maker_->abort();
+  this->connection_ = std::move(this->coffee_maker_->connection);
+  this->custom_cancel_flag_ = false;
+  this->handshake_start_time_ = esphome::millis();
+  this->handshake_.start();
+}
+
+void JuraComponent::queue_request(const PendingRequest &request) {
+  if (this->handshake_.get_stage() == ::jutta_proto::Handshake::Stage::IDLE) {
+    ESP_LOGW(TAG, "Cannot %s - component not ready.", request.description);
+    return;
+  }
+  if (this->pending_request_.type != PendingRequest::Type::NONE) {
+    ESP_LOGW(TAG, "Replacing queued request to %s.", this->pending_request_.description);
   }
-  this->handshake_buffer_.clear();
-  this->handshake_deadline_ = 0;
-  this->handshake_stage_ = HandshakeStage::HELLO;
+  this->pending_request_ = request;
+  this->pending_request_.queued_at = esphome::millis();
+  ESP_LOGI(TAG, "Coffee maker not ready yet - queued request to %s.", request.description);
 }
 
-bool JuraComponent::read_handshake_bytes() {
-  if (this->connection_ == nullptr) {
+void JuraComponent::expire_pending_request() {
+  if (this->pending_request_.type == PendingRequest::Type::NONE ||
+      esphome::millis() - this->pending_request_.queued_at < PENDING_REQUEST_EXPIRY_MS) {
+    return;
+  }
+  ESP_LOGW(TAG, "Dropping queued request to %s, the coffee maker was not ready in time.",
+           this->pending_request_.description);
+  this->pending_request_ = {};
+}
+
+void JuraComponent::replay_pending_request() {
+  if (this->pending_request_.type == PendingRequest::Type::NONE || this->coffee_maker_->is_locked()) {
+    return;
+  }
+  PendingRequest request = this->pending_request_;
+  this->pending_request_ = {};
+  ESP_LOGI(TAG, "Running queued request to %s.", request.description);
+  this->run_request(request);
+}
+
+bool JuraComponent::load_handshake_cache() {
+  if (!this->handshake_pref_.load(&this->handshake_cache_)) {
     return false;
   }
-  bool read_any = false;
-  uint8_t byte = 0;
-  while (this->connection_->read_decoded(&byte)) {
-    read_any = true;
-    this->handshake_buffer_.push_back(static_cast<char>(byte));
-    if (this->handshake_buffer_.size() > 128) {
-      this->handshake_buffer_.erase(0, this->handshake_buffer_.size() - 128);
-    }
+  // Never trust the stored strings to be terminated:
+  this->handshake_cache_.device_type[sizeof(this->handshake_cache_.device_type) - 1] = '\0';
+  this->handshake_cache_.t2_response[sizeof(this->handshake_cache_.t2_response) - 1] = '\0';
+  this->handshake_cache_.t3_response[sizeof(this->handshake_cache_.t3_response) - 1] = '\0';
+  return this->handshake_cache_.device_type[0] != '\0';
+}
+
+void JuraComponent::save_handshake_cache() {
+  HandshakeCache cache{};
+  if (!copy_to_field(cache.device_type, this->handshake_.get_device_type()) ||
+      !copy_to_field(cache.t2_response, this->handshake_.get_t2_response()) ||
+      !copy_to_field(cache.t3_response, this->handshake_.get_t3_response())) {
+    ESP_LOGW(TAG, "Handshake result too long to be cached, fast resume unavailable.");
+    return;
+  }
+  // Only write in case something changed to spare the flash:
+  if (std::memcmp(&cache, &this->handshake_cache_, sizeof(cache)) == 0) {
+    return;
+  }
+  this->handshake_cache_ = cache;
+  if (!this->handshake_pref_.save(&this->handshake_cache_)) {
+    ESP_LOGW(TAG, "Failed to store the handshake result.");
+  }
+}
+
+#ifdef USE_JUTTA_BYTE_GAP_CALIBRATION
+void JuraComponent::run_byte_gap_calibration() {
+  auto *connection = this->coffee_maker_->connection.get();
+  auto result = this->gap_calibrator_.step(connection);
+  // The probes are answered with "ty:" replies the link health check must not take for a restarted coffee maker:
+  this->link_type_replies_ = connection->get_link_stats().type_replies;
+  if (result == ::jutta_proto::GapCalibrator::Result::Pending) {
+    return;
+  }
+  if (result == ::jutta_proto::GapCalibrator::Result::Failed) {
+    ESP_LOGW(TAG, "Byte gap calibration failed after %" PRIu32 " request(s), keeping %" PRIu32 " us.",
+             this->gap_calibrator_.get_probes_sent(), connection->get_byte_gap());
+    this->byte_gap_source_ = "profile";
+    return;
+  }
+  ESP_LOGI(TAG, "Byte gap calibrated to %" PRIu32 " us (shortest working: %" PRIu32 " us) after %" PRIu32
+                " request(s).",
+           this->gap_calibrator_.get_gap(), this->gap_calibrator_.get_fastest_gap(),
+           this->gap_calibrator_.get_probes_sent());
+  this->byte_gap_source_ = "calibrated";
+  ByteGapCache cache{};
+  if (!copy_to_field(cache.device_type, this->handshake_.get_device_type())) {
+    return;
+  }
+  cache.gap_us = this->gap_calibrator_.get_gap();
+  this->byte_gap_cache_ = cache;
+  if (!this->byte_gap_pref_.save(&this->byte_gap_cache_)) {
+    ESP_LOGW(TAG, "Failed to store the calibrated byte gap.");
   }
-  return read_any;
 }
+#endif
 
 bool JuraComponent::time_reached(uint32_t now, uint32_t target) {
   return static_cast<int32_t>(now - target) >= 0;
 }
 
-void JuraComponent::start_brew(::jutta_proto::CoffeeMaker::coffee_t coffee) {
-  if (!this->is_ready()) {
-    ESP_LOGW(TAG, "Cannot start brew - component not ready.");
+const ::jutta_proto::JuttaConnection *JuraComponent::active_connection() const {
+  if (this->connection_ != nullptr) {
+    return this->connection_.get();
+  }
+  if (this->coffee_maker_ != nullptr) {
+    return this->coffee_maker_->connection.get();
+  }
+  return nullptr;
+}
+
+#if JUTTA_TX_SCHEDULER_ENABLED
+void JuraComponent::service_tx_slots() {
+  // Every component hands out slots for all of them. Keep loop() running at full speed while bytes are queued,
+  // otherwise a slot would only come up every loop interval.
+  if (::jutta_proto::TxScheduler::shared().service(esphome::micros())) {
+    this->high_freq_.start();
+  } else {
+    this->high_freq_.stop();
+  }
+}
+
+void JuraComponent::report_tx_throughput() {
+  const auto &scheduler = ::jutta_proto::TxScheduler::shared();
+  uint32_t now = esphome::millis();
+  uint32_t elapsed_ms = now - this->reported_tx_ms_;
+  uint32_t bytes = scheduler.stats().bytes_sent - this->reported_tx_bytes_;
+  this->reported_tx_ms_ = now;
+  this->reported_tx_bytes_ = scheduler.stats().bytes_sent;
+  if (elapsed_ms == 0) {
     return;
   }
-  this->coffee_maker_->brew_coffee(coffee);
+  // Four encoded bytes per data byte:
+  float throughput = static_cast<float>(bytes) * 1000.0f / 4.0f / static_cast<float>(elapsed_ms);
+  // The numbers are the same for all components, only the first one logs them:
+  const auto *connection = this->active_connection();
+  if (bytes > 0 && connection != nullptr && scheduler.lane_index(connection) == 0) {
+    ESP_LOGI(TAG, "TX scheduler: %.1f data bytes/s to %zu coffee makers in the last %" PRIu32 " s, worst slot delay %" PRIu32
+             " us",
+             throughput, scheduler.size(), elapsed_ms / 1000, scheduler.stats().max_slot_delay_us);
+  }
+#ifdef USE_SENSOR
+  if (this->tx_throughput_sensor_ != nullptr) {
+    this->publish(this->tx_throughput_sensor_, throughput);
+  }
+#endif
+}
+#endif
+
+#ifdef USE_JUTTA_LOOP_PROFILER
+void JuraComponent::publish_loop_profile() {
+  uint32_t max_loop_us = this->profiler_.take_window_max_loop_us();
+#ifdef USE_SENSOR
+  if (this->max_loop_time_sensor_ != nullptr) {
+    this->publish(this->max_loop_time_sensor_, static_cast<float>(max_loop_us) / 1000.0f);
+  }
+  if (this->loops_over_budget_sensor_ != nullptr) {
+    this->publish(this->loops_over_budget_sensor_, static_cast<float>(this->profiler_.get_loops_over_budget()));
+  }
+#endif
+  if (max_loop_us > this->profiler_.get_budget_us()) {
+    ESP_LOGD(TAG, "Longest loop in the last minute: %" PRIu32 " us", max_loop_us);
+  }
+}
+#endif
+
+#ifdef USE_JUTTA_FAULT_INJECTION
+void JuraComponent::set_fault_profile(float bit_flip_rate, float drop_rate, float duplicate_rate, float gap_rate,
+                                      uint32_t gap_ms, float lost_ok_rate, uint32_t seed) {
+  this->fault_profile_.bit_flip_rate = bit_flip_rate;
+  this->fault_profile_.drop_rate = drop_rate;
+  this->fault_profile_.duplicate_rate = duplicate_rate;
+  this->fault_profile_.gap_rate = gap_rate;
+  this->fault_profile_.gap_ms = gap_ms;
+  this->fault_profile_.lost_ok_rate = lost_ok_rate;
+  this->fault_profile_.seed = seed;
+}
+
+void JuraComponent::log_fault_report() {
+  const auto *connection = this->active_connection();
+  if (connection == nullptr || connection->get_fault_injector() == nullptr) {
+    return;
+  }
+  const auto &injected = connection->get_fault_injector()->stats();
+  const auto &link = connection->get_link_stats();
+  uint32_t brews = 0;
+  uint32_t failed = 0;
+  if (this->coffee_maker_ != nullptr) {
+    brews = this->coffee_maker_->get_brew_stats().finished;
+    failed = this->coffee_maker_->get_brew_stats().failed;
+  }
+  float failure_rate = brews > 0 ? 100.0f * static_cast<float>(failed) / static_cast<float>(brews) : 0.0f;
+
+  ESP_LOGI(TAG,
+           "Fault report: %" PRIu32 " bytes seen, %" PRIu32 " flipped, %" PRIu32 " dropped, %" PRIu32
+           " duplicated, %" PRIu32 " gaps, %" PRIu32 " ok: lost",
+           injected.bytes_seen, injected.bits_flipped, injected.bytes_dropped, injected.bytes_duplicated,
+           injected.gaps_stretched, injected.oks_dropped);
+  ESP_LOGI(TAG, "Fault report: %" PRIu32 " resyncs, %" PRIu32 " frames lost (worst resync %" PRIu32 ")",
+           link.resync_events, link.frames_lost, link.max_frames_lost);
+  ESP_LOGI(TAG, "Fault report: handshake took %" PRIu32 " ms (worst %" PRIu32 " ms), %" PRIu32 "/%" PRIu32
+           " brews failed (%.1f%%)",
+           this->last_handshake_duration_ms_, this->max_handshake_duration_ms_, failed, brews, failure_rate);
+}
+#endif
+
+void JuraComponent::start_brew(::jutta_proto::CoffeeMaker::coffee_t coffee) {
+  Command command;
+  command.request.type = PendingRequest::Type::BREW;
+  command.request.description = "start brew";
+  command.request.coffee = coffee;
+  this->submit(command);
 }
 
 void JuraComponent::start_custom_brew(uint32_t grind_duration_ms, uint32_t water_duration_ms) {
-  if (!this->is_ready()) {
-    ESP_LOGW(TAG, "Cannot brew custom coffee - component not ready.");
+  Command command;
+  command.request.type = PendingRequest::Type::CUSTOM_BREW;
+  command.request.description = "brew custom coffee";
+  command.request.grind_duration_ms = grind_duration_ms;
+  command.request.water_duration_ms = water_duration_ms;
+  this->submit(command);
+}
+
+void JuraComponent::cancel_custom_brew() { this->submit({{}, &JuraComponent::run_cancel_custom_brew}); }
+
+void JuraComponent::switch_page(uint32_t page) {
+  Command command;
+  command.request.type = PendingRequest::Type::SWITCH_PAGE;
+  command.request.description = "switch page";
+  command.request.page = page;
+  this->submit(command);
+}
+
+void JuraComponent::dump_traffic() { this->submit({{}, &JuraComponent::start_traffic_dump}); }
+
+void JuraComponent::run_request(const PendingRequest &request) {
+  if (!this->accepts_commands()) {
+    this->queue_request(request);
     return;
   }
-  this->custom_cancel_flag_ = false;
-  this->coffee_maker_->brew_custom_coffee(&this->custom_cancel_flag_, std::chrono::milliseconds{grind_duration_ms},
-                                          std::chrono::milliseconds{water_duration_ms});
+  switch (request.type) {
+    case PendingRequest::Type::NONE:
+      break;
+    case PendingRequest::Type::BREW:
+#ifdef USE_JUTTA_HEAP_FREE
+      this->brew_allocations_start_ = ::jutta_proto::heap::allocations();
+      this->brew_tracked_ = true;
+#endif
+      this->coffee_maker_->brew_coffee(request.coffee);
+      break;
+    case PendingRequest::Type::CUSTOM_BREW:
+#ifdef USE_JUTTA_HEAP_FREE
+      this->brew_allocations_start_ = ::jutta_proto::heap::allocations();
+      this->brew_tracked_ = true;
+#endif
+      this->custom_cancel_flag_ = false;
+      this->coffee_maker_->brew_custom_coffee(&this->custom_cancel_flag_,
+                                              std::chrono::milliseconds{request.grind_duration_ms},
+                                              std::chrono::milliseconds{request.water_duration_ms});
+      break;
+    case PendingRequest::Type::SWITCH_PAGE:
+      this->coffee_maker_->switch_page(request.page);
+      break;
+  }
+}
+
+#ifdef USE_JUTTA_HEAP_FREE
+void JuraComponent::track_brew_allocations() {
+  if (!this->brew_tracked_ || this->coffee_maker_->is_locked()) {
+    return;
+  }
+  this->brew_tracked_ = false;
+  uint32_t allocations = ::jutta_proto::heap::allocations() - this->brew_allocations_start_;
+  ++this->tracked_brews_;
+  this->last_brew_allocations_ = allocations;
+  this->max_brew_allocations_ = std::max(this->max_brew_allocations_, allocations);
+  if (allocations > 0) {
+    ESP_LOGW(TAG, "Brew made %" PRIu32 " heap allocation(s).", allocations);
+  } else {
+    ESP_LOGD(TAG, "Brew finished without heap allocations.");
+  }
 }
+#endif
 
-void JuraComponent::cancel_custom_brew() {
-  if (!this->is_ready()) {
+void JuraComponent::run_cancel_custom_brew() {
+  if (!this->link_ready()) {
+    if (this->pending_request_.type == PendingRequest::Type::CUSTOM_BREW) {
+      ESP_LOGI(TAG, "Dropping queued custom brew.");
+      this->pending_request_ = {};
+      return;
+    }
     ESP_LOGW(TAG, "Cannot cancel custom brew - component not ready.");
     return;
   }
@@ -265,20 +983,254 @@ void JuraComponent::cancel_custom_brew() {
   this->custom_cancel_flag_ = true;
 }
 
-void JuraComponent::switch_page(uint32_t page) {
-  if (!this->is_ready()) {
-    ESP_LOGW(TAG, "Cannot switch page - component not ready.");
+void JuraComponent::start_traffic_dump() {
+#ifdef USE_JUTTA_TRAFFIC_RECORDER
+  auto *recorder = this->traffic_recorder();
+  if (recorder == nullptr) {
+    ESP_LOGW(TAG, "Traffic recorder not running yet.");
+    return;
+  }
+  if (recorder->is_paused()) {
+    ESP_LOGW(TAG, "Traffic dump already in progress.");
     return;
   }
-  this->coffee_maker_->switch_page(page);
+  // Keep the buffer stable until everything has been logged:
+  recorder->set_paused(true);
+  this->traffic_dump_offset_ = 0;
+  ESP_LOGI(TAG, "Traffic dump: %zu bytes in %zu lines, %" PRIu32 " entries, %" PRIu32 " overwritten", recorder->size(),
+           (recorder->size() + TRAFFIC_DUMP_CHUNK_SIZE - 1) / TRAFFIC_DUMP_CHUNK_SIZE, recorder->entries(),
+           recorder->overwritten());
+#else
+  ESP_LOGW(TAG, "Traffic recorder disabled, add 'traffic_recorder:' to the configuration.");
+#endif
 }
 
-bool JuraComponent::is_busy() const {
-  if (this->coffee_maker_ == nullptr) {
+#ifdef USE_JUTTA_TRAFFIC_RECORDER
+::jutta_proto::TrafficRecorder *JuraComponent::traffic_recorder() const {
+#ifdef USE_JUTTA_BRIDGE
+  if (this->bridge_ != nullptr) {
+    return this->bridge_->get_traffic_recorder();
+  }
+#endif
+  const auto *connection = this->active_connection();
+  return connection != nullptr ? connection->get_traffic_recorder() : nullptr;
+}
+
+void JuraComponent::continue_traffic_dump() {
+  auto *recorder = this->traffic_recorder();
+  if (recorder == nullptr || !recorder->is_paused()) {
+    return;
+  }
+  const size_t lines = (recorder->size() + TRAFFIC_DUMP_CHUNK_SIZE - 1) / TRAFFIC_DUMP_CHUNK_SIZE;
+  std::array<uint8_t, TRAFFIC_DUMP_CHUNK_SIZE> chunk{};
+  for (size_t i = 0; i < TRAFFIC_DUMP_LINES_PER_LOOP; i++) {
+    size_t length = recorder->read(this->traffic_dump_offset_, chunk.data(), chunk.size());
+    if (length == 0) {
+      recorder->set_paused(false);
+      ESP_LOGI(TAG, "Traffic dump done, %" PRIu32 " bytes not recorded meanwhile.", recorder->missed());
+      return;
+    }
+    ESP_LOGI(TAG, "Traffic %zu/%zu: %s", (this->traffic_dump_offset_ / TRAFFIC_DUMP_CHUNK_SIZE) + 1, lines,
+             base64_encode(chunk.data(), length).c_str());
+    this->traffic_dump_offset_ += length;
+  }
+}
+#endif
+
+void JuraComponent::submit(const Command &command) {
+#ifdef USE_JUTTA_PROTOCOL_TASK
+#ifdef USE_JUTTA_BRIDGE
+  // A bridge never starts the protocol task:
+  if (this->bridge_ != nullptr) {
+    this->execute(command);
+    return;
+  }
+#endif
+  if (this->commands_.push(command)) {
+    ++this->commands_submitted_;
+  } else {
+    ESP_LOGW(TAG, "Protocol task busy, dropping request to %s.",
+             command.method != nullptr ? "run a maintenance task" : command.request.description);
+  }
+#else
+  this->execute(command);
+  this->dispatch_pending_notifications();
+#endif
+}
+
+void JuraComponent::execute(const Command &command) {
+  JUTTA_HEAP_SCOPE();
+  if (command.method != nullptr) {
+    (this->*command.method)();
+  } else {
+    this->run_request(command.request);
+  }
+}
+
+JuraComponent::Status JuraComponent::current_status() const {
+  Status status;
+  status.ready = this->link_ready();
+  status.busy = this->coffee_maker_ != nullptr && this->coffee_maker_->is_locked();
+  status.queued = this->pending_request_.type != PendingRequest::Type::NONE;
+  status.liveness = this->liveness_;
+  return status;
+}
+
+JuraComponent::Status JuraComponent::get_status() const {
+#ifdef USE_JUTTA_PROTOCOL_TASK
+  return this->status_;
+#else
+  return this->current_status();
+#endif
+}
+
+const std::string &JuraComponent::device_type() const {
+#ifdef USE_JUTTA_PROTOCOL_TASK
+  return this->status_device_type_;
+#else
+  return this->handshake_.get_device_type();
+#endif
+}
+
+bool JuraComponent::is_idle() const {
+#ifdef USE_JUTTA_PROTOCOL_TASK
+  // The status is only current once the protocol task ran every command and all of its events got handled:
+  if (this->commands_handled_.load(std::memory_order_acquire) != this->commands_submitted_ || !this->events_.empty()) {
     return false;
   }
-  return this->coffee_maker_->is_locked();
+#endif
+  const Status status = this->get_status();
+  return !status.busy && !status.queued;
+}
+
+void JuraComponent::notify(Notification notification) {
+#ifdef USE_JUTTA_PROTOCOL_TASK
+  Event event;
+  event.type = Event::Type::NOTIFICATION;
+  event.notification = notification;
+  if (!this->events_.push(event)) {
+    ++this->dropped_events_;
+  }
+#else
+  this->pending_notifications_.push_back(notification);
+#endif
+}
+
+void JuraComponent::dispatch_notification(Notification notification) {
+  this->notification_callbacks_[static_cast<size_t>(notification)].call();
+}
+
+#ifndef USE_JUTTA_PROTOCOL_TASK
+void JuraComponent::dispatch_pending_notifications() {
+  // Copied first, a trigger may start the next brew and queue new notifications:
+  const auto pending = this->pending_notifications_;
+  this->pending_notifications_.clear();
+  for (Notification notification : pending) {
+    this->dispatch_notification(notification);
+  }
+}
+#endif
+
+void JuraComponent::resume_idle_waiters() {
+  if (this->idle_requested_ && this->is_idle()) {
+    this->idle_requested_ = false;
+    this->idle_callbacks_.call();
+  }
+}
+
+void JuraComponent::on_brew_event(::jutta_proto::CoffeeMaker::BrewEvent event) {
+  using BrewEvent = ::jutta_proto::CoffeeMaker::BrewEvent;
+  switch (event) {
+    case BrewEvent::STARTED:
+      this->notify(Notification::BREW_STARTED);
+      break;
+    case BrewEvent::FINISHED:
+      this->notify(Notification::BREW_FINISHED);
+      break;
+    case BrewEvent::CANCELLED:
+      this->notify(Notification::BREW_CANCELLED);
+      break;
+    case BrewEvent::FAILED:
+      this->notify(Notification::BREW_FAILED);
+      break;
+  }
+}
+
+#ifdef USE_SENSOR
+void JuraComponent::publish(sensor::Sensor *sensor, float value) {
+#ifdef USE_JUTTA_PROTOCOL_TASK
+  // Sensors may only be published from the main loop:
+  Event event;
+  event.type = Event::Type::PUBLISH;
+  event.sensor = sensor;
+  event.value = value;
+  if (!this->events_.push(event)) {
+    ++this->dropped_events_;
+  }
+#else
+  sensor->publish_state(value);
+#endif
+}
+#endif
+
+#ifdef USE_JUTTA_PROTOCOL_TASK
+void JuraComponent::protocol_task_step() {
+  Command command;
+  uint32_t handled = 0;
+  while (this->commands_.pop(&command)) {
+    this->execute(command);
+    ++handled;
+  }
+  this->run_protocol();
+  this->post_status();
+  if (handled > 0) {
+    this->commands_handled_.fetch_add(handled, std::memory_order_release);
+  }
+}
+
+void JuraComponent::post_status() {
+  Status status = this->current_status();
+  if (status != this->posted_status_) {
+    Event event;
+    event.type = Event::Type::STATUS;
+    event.status = status;
+    // Retried on the next step in case the ring is full:
+    if (this->events_.push(event)) {
+      this->posted_status_ = status;
+    }
+  }
+  if (this->handshake_.get_device_type() != this->posted_device_type_) {
+    Event event;
+    event.type = Event::Type::DEVICE_TYPE;
+    std::snprintf(event.device_type, sizeof(event.device_type), "%s", this->handshake_.get_device_type().c_str());
+    if (this->events_.push(event)) {
+      this->posted_device_type_ = this->handshake_.get_device_type();
+    }
+  }
+}
+
+void JuraComponent::handle_events() {
+  Event event;
+  while (this->events_.pop(&event)) {
+    switch (event.type) {
+      case Event::Type::STATUS:
+        this->status_ = event.status;
+        break;
+      case Event::Type::DEVICE_TYPE:
+        this->status_device_type_ = event.device_type;
+        break;
+      case Event::Type::PUBLISH:
+#ifdef USE_SENSOR
+        event.sensor->publish_state(event.value);
+#endif
+        break;
+      case Event::Type::NOTIFICATION:
+        this->dispatch_notification(event.notification);
+        break;
+    }
+  }
 }
+#endif
 
 }  // namespace jutta_component
 }  // namespace esphome
@@ -1,24 +1,64 @@
 #pragma once
 
+#include <array>
+#include <atomic>
 #include <chrono>
 #include <cstdint>
+#include <functional>
 #include <memory>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "esphome/core/automation.h"
 #include "esphome/core/component.h"
+#include "esphome/core/defines.h"
+#include "esphome/core/helpers.h"
 #include "esphome/core/log.h"
+#include "esphome/core/preferences.h"
 #include "esphome/components/uart/uart.h"
+#ifdef USE_SENSOR
+#include "esphome/components/sensor/sensor.h"
+#endif
 
+#include "bridge.hpp"
 #include "coffee_maker.hpp"
+#include "gap_calibrator.hpp"
+#include "handshake.hpp"
 #include "jutta_connection.hpp"
 #include "jutta_commands.hpp"
+#include "loop_profiler.hpp"
+#include "model_profiles.hpp"
+#include "protocol_task.hpp"
+#include "static_buffer.hpp"
 
 namespace esphome {
 namespace jutta_component {
 
 class JuraComponent : public esphome::Component, public esphome::uart::UARTDevice {
  public:
+  // What we know about the coffee maker being reachable right now.
+  enum class Liveness { UNKNOWN, ALIVE, SILENT, LOST };
+
+  // State of the protocol side as seen by the main loop.
+  struct Status {
+    bool ready{false};
+    bool busy{false};
+    // A request waits for the link to come back.
+    bool queued{false};
+    Liveness liveness{Liveness::UNKNOWN};
+
+    bool operator==(const Status &other) const {
+      return this->ready == other.ready && this->busy == other.busy && this->queued == other.queued &&
+             this->liveness == other.liveness;
+    }
+    bool operator!=(const Status &other) const { return !(*this == other); }
+  };
+
+  // What the on_brew_* and on_handshake_complete triggers fire on.
+  enum class Notification : uint8_t { BREW_STARTED, BREW_FINISHED, BREW_CANCELLED, BREW_FAILED, HANDSHAKE_COMPLETE };
+  static constexpr size_t NUM_NOTIFICATIONS = 5;
+
   void setup() override;
   void loop() override;
   void dump_config() override;
@@ -27,28 +67,354 @@ class JuraComponent : public esphome::Component, public esphome::uart::UARTDevic
   void start_custom_brew(uint32_t grind_duration_ms, uint32_t water_duration_ms);
   void cancel_custom_brew();
   void switch_page(uint32_t page);
+  // Logs the recorded raw traffic as base64, spread over the next loop() calls.
+  void dump_traffic();
+  // Bridge mode only: sends the given command (e.g. "FA:04") to the coffee maker the next time the dongle is quiet.
+  void inject_command(const std::string &command);
+
+  Status get_status() const;
+  bool is_ready() const { return this->get_status().ready; }
+  bool is_busy() const { return this->get_status().busy; }
+  const std::string &device_type() const;
+  Liveness get_liveness() const { return this->get_status().liveness; }
+  bool is_alive() const { return this->get_liveness() == Liveness::ALIVE; }
+  // Neither brewing nor holding a request that has not run yet.
+  bool is_idle() const;
+
+  // Callbacks run from the main loop.
+  void add_on_notification_callback(Notification notification, std::function<void()> &&callback) {
+    this->notification_callbacks_[static_cast<size_t>(notification)].add(std::move(callback));
+  }
+  void add_on_idle_callback(std::function<void()> &&callback) { this->idle_callbacks_.add(std::move(callback)); }
+  // Calls the idle callbacks once, as soon as is_idle() holds in the main loop.
+  void request_idle_callback() { this->idle_requested_ = true; }
+
+  void set_keep_alive(uint32_t interval_ms, uint32_t max_interval_ms) {
+    this->keep_alive_.base_interval_ms = interval_ms;
+    this->keep_alive_.interval_ms = interval_ms;
+    this->keep_alive_.max_interval_ms = max_interval_ms;
+  }
+
+  void set_fast_resume(bool fast_resume) { this->fast_resume_ = fast_resume; }
+  // Keeps the flash caches of several components on one node apart, the config id is a good choice.
+  void set_preference_id(const std::string &id) { this->preference_id_ = id; }
+  // Filler bits per received frame that may read as 0 without dropping the frame.
+  void set_frame_tolerance(uint8_t bits) { this->frame_tolerance_ = bits; }
+  // Byte gaps without a new frame after which a message lacking its "\r\n" counts as complete.
+  void set_message_idle_gaps(uint8_t gaps) { this->message_idle_gaps_ = gaps; }
+  // Bounds of the "ok:" timeouts learned per command class and resends of FN: commands after a timeout.
+  void set_ack_timeout(uint32_t min_timeout_ms, uint32_t max_timeout_ms, uint8_t max_retries) {
+    this->ack_timeout_min_ms_ = min_timeout_ms;
+    this->ack_timeout_max_ms_ = max_timeout_ms;
+    this->ack_max_retries_ = max_retries;
+  }
+  // Pause after every encoded byte sent, overrides the one of the model profile. 0 keeps the profile's.
+  void set_byte_gap(uint32_t gap_us) { this->byte_gap_us_ = gap_us; }
+#ifdef USE_JUTTA_BYTE_GAP_CALIBRATION
+  // Measure the shortest byte gap the coffee maker keeps up with once and remember it per device type.
+  void set_calibrate_byte_gap(bool calibrate) { this->calibrate_byte_gap_ = calibrate; }
+#endif
+#ifdef USE_SENSOR
+  void set_boot_to_ready_sensor(sensor::Sensor *sensor) { this->boot_to_ready_sensor_ = sensor; }
+  // phase: 0 = TX, 1 = waiting for the "ok:", 2 = delay after it. percentile: 0 - 100.
+  void set_latency_sensor(uint8_t command_class, uint8_t phase, uint8_t percentile, sensor::Sensor *sensor) {
+    this->latency_sensors_.push_back({command_class, phase, percentile, sensor});
+  }
+  void set_timeout_sensor(uint8_t command_class, sensor::Sensor *sensor) {
+    this->timeout_sensors_[command_class] = sensor;
+  }
+  void set_frames_decoded_sensor(sensor::Sensor *sensor) { this->frames_decoded_sensor_ = sensor; }
+  void set_stray_bytes_sensor(sensor::Sensor *sensor) { this->stray_bytes_sensor_ = sensor; }
+  void set_resync_events_sensor(sensor::Sensor *sensor) { this->resync_events_sensor_ = sensor; }
+  void set_undersized_reads_sensor(sensor::Sensor *sensor) { this->undersized_reads_sensor_ = sensor; }
+  void set_tx_failures_sensor(sensor::Sensor *sensor) { this->tx_failures_sensor_ = sensor; }
+  void set_corrected_bits_sensor(sensor::Sensor *sensor) { this->corrected_bits_sensor_ = sensor; }
+  // Data bytes per second sent to all coffee makers of the node, only updated with the TX scheduler.
+  void set_tx_throughput_sensor(sensor::Sensor *sensor) { this->tx_throughput_sensor_ = sensor; }
+#endif
 
-  bool is_ready() const { return this->handshake_stage_ == HandshakeStage::DONE && this->coffee_maker_ != nullptr; }
-  bool is_busy() const;
-  const std::string &device_type() const { return this->device_type_; }
+#ifdef USE_JUTTA_LOOP_PROFILER
+  void set_loop_budget(uint32_t budget_us) { this->profiler_.set_budget_us(budget_us); }
+#ifdef USE_SENSOR
+  void set_max_loop_time_sensor(sensor::Sensor *sensor) { this->max_loop_time_sensor_ = sensor; }
+  void set_loops_over_budget_sensor(sensor::Sensor *sensor) { this->loops_over_budget_sensor_ = sensor; }
+#endif
+#endif
+
+#ifdef USE_JUTTA_TRAFFIC_RECORDER
+  void set_traffic_recorder_size(size_t size) { this->traffic_recorder_size_ = size; }
+#endif
+
+#ifdef USE_JUTTA_PROTOCOL_TASK
+  void set_protocol_task(uint32_t stack_size, uint8_t priority, int8_t core) {
+    this->protocol_task_.configure(stack_size, priority, core);
+  }
+#endif
+
+#ifdef USE_JUTTA_BRIDGE
+  // Sit between the original dongle on the given UART and the coffee maker instead of talking to it.
+  void set_bridge_dongle(uart::UARTComponent *dongle) { this->bridge_dongle_ = dongle; }
+#endif
+
+#ifdef USE_JUTTA_FAULT_INJECTION
+  void set_fault_profile(float bit_flip_rate, float drop_rate, float duplicate_rate, float gap_rate, uint32_t gap_ms,
+                         float lost_ok_rate, uint32_t seed);
+#endif
 
  protected:
-  enum class HandshakeStage { IDLE, HELLO, SEND_T1, WAIT_T2, SEND_T2, WAIT_T3, SEND_T3, DONE, FAILED };
+  // A request that arrived while (re-)connecting, replayed once the coffee maker is ready again.
+  struct PendingRequest {
+    enum class Type { NONE, BREW, CUSTOM_BREW, SWITCH_PAGE } type{Type::NONE};
+    const char *description{""};
+    ::jutta_proto::CoffeeMaker::coffee_t coffee{::jutta_proto::CoffeeMaker::coffee_t::ESPRESSO};
+    uint32_t grind_duration_ms{0};
+    uint32_t water_duration_ms{0};
+    uint32_t page{0};
+    uint32_t queued_at{0};
+  };
+
+  // Probes the coffee maker with a cheap request in case it has been quiet for a while.
+  struct KeepAliveState {
+    // 0 disables the keep-alive.
+    uint32_t base_interval_ms{30000};
+    uint32_t max_interval_ms{300000};
+    // Grows while probes succeed, falls back to the base interval once one fails.
+    uint32_t interval_ms{30000};
+    uint32_t last_probe{0};
+    uint32_t failures{0};
+    uint32_t probes_sent{0};
+    bool probing{false};
+  };
+
+  // Result of the last successful key exchange, persisted so the next boot can skip it.
+  struct HandshakeCache {
+    char device_type[48];
+    char t2_response[48];
+    char t3_response[48];
+  };
+
+#ifdef USE_JUTTA_BYTE_GAP_CALIBRATION
+  // Calibrated byte gap of the given coffee maker, kept in flash across reboots.
+  struct ByteGapCache {
+    char device_type[48];
+    uint32_t gap_us;
+  };
+#endif
 
+  // Work for the protocol side: a request or, in case method is set, a call of that method.
+  struct Command {
+    PendingRequest request{};
+    void (JuraComponent::*method)(){nullptr};
+  };
+
+  // What the protocol task tells the main loop.
+  struct Event {
+    enum class Type : uint8_t { STATUS, DEVICE_TYPE, PUBLISH, NOTIFICATION } type{Type::STATUS};
+    Status status{};
+    Notification notification{Notification::BREW_STARTED};
+    char device_type[sizeof(HandshakeCache::device_type)]{};
+#ifdef USE_SENSOR
+    sensor::Sensor *sensor{nullptr};
+    float value{0.0f};
+#endif
+  };
+
+  // Hands the command to the protocol task, or runs it right away without one.
+  void submit(const Command &command);
+  void execute(const Command &command);
+  // One pass over the protocol side: handshake, coffee maker and link supervision.
+  void run_protocol();
+  Status current_status() const;
+  bool link_ready() const {
+    return this->handshake_.get_stage() == ::jutta_proto::Handshake::Stage::DONE && this->coffee_maker_ != nullptr;
+  }
+  void run_request(const PendingRequest &request);
+  void run_cancel_custom_brew();
+  void start_traffic_dump();
+  void log_config();
+#ifdef USE_SENSOR
+  void publish(sensor::Sensor *sensor, float value);
+#endif
+  // Protocol side: hands the notification to the main loop.
+  void notify(Notification notification);
+  // Main loop: runs the triggers.
+  void dispatch_notification(Notification notification);
+  void resume_idle_waiters();
+  void on_brew_event(::jutta_proto::CoffeeMaker::BrewEvent event);
   void process_handshake();
-  void restart_handshake(const char *reason);
-  bool read_handshake_bytes();
+  void finish_handshake(bool resumed);
+  // Picks the byte gap for the connection of a freshly (re-)established link.
+  void apply_byte_gap(const ::jutta_proto::ModelProfile &profile);
+  bool calibrating_byte_gap() const {
+#ifdef USE_JUTTA_BYTE_GAP_CALIBRATION
+    return this->gap_calibrator_.is_running();
+#else
+    return false;
+#endif
+  }
+  bool load_handshake_cache();
+  void save_handshake_cache();
+  void check_link_health();
+  void run_keep_alive();
+  void report_link_quality();
+#ifdef USE_SENSOR
+  void publish_latency();
+#endif
+  bool accepts_commands() const {
+    return this->link_ready() && !this->keep_alive_.probing && !this->calibrating_byte_gap();
+  }
+  void relink(const char *reason);
+  void queue_request(const PendingRequest &request);
+  void expire_pending_request();
+  void replay_pending_request();
   static bool time_reached(uint32_t now, uint32_t target);
+  const ::jutta_proto::JuttaConnection *active_connection() const;
+#ifdef USE_JUTTA_LOOP_PROFILER
+  void publish_loop_profile();
+
+  ::jutta_proto::LoopProfiler profiler_{};
+#ifdef USE_SENSOR
+  sensor::Sensor *max_loop_time_sensor_{nullptr};
+  sensor::Sensor *loops_over_budget_sensor_{nullptr};
+#endif
+#endif
+#ifdef USE_JUTTA_TRAFFIC_RECORDER
+  void continue_traffic_dump();
+  // The recorder of the bridge or the connection, nullptr in case there is none yet.
+  ::jutta_proto::TrafficRecorder *traffic_recorder() const;
+
+  size_t traffic_recorder_size_{4096};
+  // Next byte of the recording to dump, only valid while the recorder is paused for a dump.
+  size_t traffic_dump_offset_{0};
+#endif
+#ifdef USE_JUTTA_BYTE_GAP_CALIBRATION
+  void run_byte_gap_calibration();
+
+  bool calibrate_byte_gap_{false};
+  // Calibrate at most once per boot, a failed calibration falls back to the profile's gap.
+  bool byte_gap_calibration_attempted_{false};
+  ::jutta_proto::GapCalibrator gap_calibrator_{};
+  ByteGapCache byte_gap_cache_{};
+  ESPPreferenceObject byte_gap_pref_;
+#endif
+#ifdef USE_JUTTA_FAULT_INJECTION
+  void log_fault_report();
+
+  ::serial::FaultProfile fault_profile_{};
+#endif
+
+#ifdef USE_JUTTA_BRIDGE
+  void setup_bridge();
+  void run_bridge();
+  void log_bridge_config();
+
+  uart::UARTComponent *bridge_dongle_{nullptr};
+  std::unique_ptr<::jutta_proto::Bridge> bridge_;
+  HighFrequencyLoopRequester bridge_high_freq_{};
+#endif
+
+#if JUTTA_TX_SCHEDULER_ENABLED
+  void service_tx_slots();
+  void report_tx_throughput();
+
+  HighFrequencyLoopRequester high_freq_{};
+  // Scheduler statistics at the time of the last throughput report.
+  uint32_t reported_tx_bytes_{0};
+  uint32_t reported_tx_ms_{0};
+#endif
+
+#ifdef USE_JUTTA_PROTOCOL_TASK
+  void protocol_task_step();
+  // Posts the status and device type in case they changed since they were posted last.
+  void post_status();
+  void handle_events();
+
+  ::jutta_proto::ProtocolTask protocol_task_{};
+  ::jutta_proto::SpscRing<Command, 8> commands_{};
+  ::jutta_proto::SpscRing<Event, 32> events_{};
+  // Owned by the protocol task:
+  Status posted_status_{};
+  std::string posted_device_type_;
+  uint32_t dropped_events_{0};
+  // Commands handed to the protocol task by the main loop and the ones it ran. Bumped after the status got posted,
+  // so once both match the events hold the outcome.
+  uint32_t commands_submitted_{0};
+  std::atomic<uint32_t> commands_handled_{0};
+  // Owned by the main loop:
+  Status status_{};
+  std::string status_device_type_;
+#else
+  void dispatch_pending_notifications();
+
+  // Collected while the coffee maker runs and dispatched afterwards, so no trigger starts a brew from within one.
+  ::jutta_proto::StaticVector<Notification, 8> pending_notifications_{};
+#endif
+  std::array<CallbackManager<void()>, NUM_NOTIFICATIONS> notification_callbacks_{};
+  CallbackManager<void()> idle_callbacks_{};
+  bool idle_requested_{false};
+
+#ifdef USE_JUTTA_HEAP_FREE
+  // Logs the heap allocations of the running brew once it finished.
+  void track_brew_allocations();
+
+  // heap::allocations() when the running brew started.
+  uint32_t brew_allocations_start_{0};
+  bool brew_tracked_{false};
+  uint32_t tracked_brews_{0};
+  uint32_t last_brew_allocations_{0};
+  uint32_t max_brew_allocations_{0};
+#endif
 
   std::unique_ptr<::jutta_proto::JuttaConnection> connection_;
   std::unique_ptr<::jutta_proto::CoffeeMaker> coffee_maker_;
-  HandshakeStage handshake_stage_{HandshakeStage::IDLE};
-  std::string handshake_buffer_;
-  std::string device_type_;
-  std::string handshake_t2_response_;
-  std::string handshake_t3_response_;
-  uint32_t handshake_deadline_{0};
+  ::jutta_proto::Handshake handshake_{};
+  // Start of the current handshake attempt including all restarts, and how long the successful ones took.
+  uint32_t handshake_start_time_{0};
+  uint32_t last_handshake_duration_ms_{0};
+  uint32_t max_handshake_duration_ms_{0};
   bool custom_cancel_flag_{false};
+  bool fast_resume_{true};
+  uint32_t byte_gap_us_{0};
+  uint32_t ack_timeout_min_ms_{::jutta_proto::RttEstimator::DEFAULT_MIN_TIMEOUT_MS};
+  uint32_t ack_timeout_max_ms_{::jutta_proto::RttEstimator::DEFAULT_MAX_TIMEOUT_MS};
+  uint8_t ack_max_retries_{2};
+  uint8_t frame_tolerance_{0};
+  uint8_t message_idle_gaps_{::jutta_proto::JuttaConnection::DEFAULT_MESSAGE_IDLE_GAPS};
+  // Where the byte gap in use came from, for the config dump.
+  const char *byte_gap_source_{"profile"};
+  HandshakeCache handshake_cache_{};
+  ESPPreferenceObject handshake_pref_;
+  // Part of the preference keys, see set_preference_id().
+  std::string preference_id_;
+  bool ready_once_{false};
+  // Link statistics at the end of the last handshake, traffic beyond that hints at a restarted coffee maker.
+  uint32_t link_session_requests_{0};
+  uint32_t link_type_replies_{0};
+  uint32_t relink_count_{0};
+  PendingRequest pending_request_{};
+  KeepAliveState keep_alive_{};
+  // Link statistics at the time of the last summary.
+  ::jutta_proto::JuttaConnection::LinkStats reported_link_stats_{};
+  Liveness liveness_{Liveness::UNKNOWN};
+#ifdef USE_SENSOR
+  struct LatencySensor {
+    uint8_t command_class;
+    uint8_t phase;
+    uint8_t percentile;
+    sensor::Sensor *sensor;
+  };
+
+  sensor::Sensor *boot_to_ready_sensor_{nullptr};
+  std::vector<LatencySensor> latency_sensors_;
+  std::array<sensor::Sensor *, ::jutta_proto::CoffeeMaker::NUM_COMMAND_CLASSES> timeout_sensors_{};
+  sensor::Sensor *frames_decoded_sensor_{nullptr};
+  sensor::Sensor *stray_bytes_sensor_{nullptr};
+  sensor::Sensor *resync_events_sensor_{nullptr};
+  sensor::Sensor *undersized_reads_sensor_{nullptr};
+  sensor::Sensor *tx_failures_sensor_{nullptr};
+  sensor::Sensor *corrected_bits_sensor_{nullptr};
+  sensor::Sensor *tx_throughput_sensor_{nullptr};
+#endif
 };
 
 class StartBrewAction : public esphome::Action<> {
@@ -95,6 +461,72 @@ class SwitchPageAction : public esphome::Action<> {
   uint32_t page_{0};
 };
 
+class DumpTrafficAction : public esphome::Action<> {
+ public:
+  explicit DumpTrafficAction(JuraComponent *parent) : parent_(parent) {}
+  void play() override { this->parent_->dump_traffic(); }
+
+ protected:
+  JuraComponent *parent_;
+};
+
+class InjectCommandAction : public esphome::Action<> {
+ public:
+  explicit InjectCommandAction(JuraComponent *parent) : parent_(parent) {}
+  void set_command(const std::string &command) { command_ = command; }
+  void play() override { this->parent_->inject_command(command_); }
+
+ protected:
+  JuraComponent *parent_;
+  std::string command_;
+};
+
+class NotificationTrigger : public Trigger<> {
+ public:
+  NotificationTrigger(JuraComponent *parent, JuraComponent::Notification notification) {
+    parent->add_on_notification_callback(notification, [this]() { this->trigger(); });
+  }
+};
+
+// Continues the automation once the coffee maker is idle, right away in case it already is.
+class WaitUntilIdleAction : public esphome::Action<> {
+ public:
+  explicit WaitUntilIdleAction(JuraComponent *parent) : parent_(parent) {
+    parent->add_on_idle_callback([this]() { this->resume_(); });
+  }
+
+  void play_complex() override {
+    this->num_running_++;
+    if (this->parent_->is_idle()) {
+      this->play_next_();
+      return;
+    }
+    ++this->waiting_;
+    this->parent_->request_idle_callback();
+  }
+  void play() override {}
+  void stop() override { this->waiting_ = 0; }
+
+ protected:
+  void resume_() {
+    for (uint32_t waiting = std::exchange(this->waiting_, 0); waiting > 0; --waiting) {
+      this->play_next_();
+    }
+  }
+
+  JuraComponent *parent_;
+  uint32_t waiting_{0};
+};
+
+class IsAliveCondition : public esphome::Condition<> {
+ public:
+  explicit IsAliveCondition(JuraComponent *parent) : parent_(parent) {}
+  bool check() override { return this->parent_->is_alive(); }
+
+ protected:
+  JuraComponent *parent_;
+};
+
 }  // namespace jutta_component
 }  // namespace esphome
 
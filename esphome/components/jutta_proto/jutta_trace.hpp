@@ -0,0 +1,89 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "esphome/core/hal.h"
+#include "esphome/core/log.h"
+
+/**
+ * Tracing for the RX/TX byte path.
+ * Below the debug log level all JUTTA_TRACE_* macros compile to nothing, so the byte path does not pay for logging it never
+ * prints. At debug level and above every byte gets stored as a four byte record, which only takes a few instructions and
+ * does not change the protocol timing. The records get formatted later, outside of the byte path (see
+ * JuttaConnection::flush_trace()).
+ **/
+#if defined(ESPHOME_LOG_LEVEL) && ESPHOME_LOG_LEVEL >= ESPHOME_LOG_LEVEL_DEBUG
+#define JUTTA_TRACE_ENABLED 1
+#else
+#define JUTTA_TRACE_ENABLED 0
+#endif
+
+//---------------------------------------------------------------------------
+namespace jutta_proto::trace {
+//---------------------------------------------------------------------------
+enum class Direction : uint8_t { RX = 0, TX = 1 };
+
+struct Record {
+    // Lower 16 bit of millis() when the byte was received or written.
+    uint16_t time_ms;
+    Direction direction;
+    uint8_t byte;
+};
+static_assert(sizeof(Record) == 4, "Trace records are meant to stay compact.");
+
+/**
+ * Fixed size ring of trace records. Once full, the oldest records get overwritten and counted as dropped.
+ **/
+class TraceBuffer {
+ public:
+    static constexpr size_t CAPACITY = 256;
+    static_assert((CAPACITY & (CAPACITY - 1)) == 0, "The capacity has to be a power of two.");
+
+    void push(Direction direction, uint8_t byte, uint32_t now_ms) {
+        this->records_[this->head_ & (CAPACITY - 1)] = {static_cast<uint16_t>(now_ms), direction, byte};
+        ++this->head_;
+        if (this->head_ - this->tail_ > CAPACITY) {
+            ++this->tail_;
+            ++this->dropped_;
+        }
+    }
+
+    [[nodiscard]] bool empty() const { return this->head_ == this->tail_; }
+
+    /**
+     * Calls on_record(const Record&) for all records in the order they got pushed and removes them.
+     * Returns the number of records dropped since the last call.
+     **/
+    template <typename Callback>
+    uint32_t drain(Callback&& on_record) {
+        for (; this->tail_ != this->head_; ++this->tail_) {
+            on_record(this->records_[this->tail_ & (CAPACITY - 1)]);
+        }
+        uint32_t dropped = this->dropped_;
+        this->dropped_ = 0;
+        return dropped;
+    }
+
+ private:
+    std::array<Record, CAPACITY> records_{};
+    uint32_t head_{0};
+    uint32_t tail_{0};
+    uint32_t dropped_{0};
+};
+//---------------------------------------------------------------------------
+}  // namespace jutta_proto::trace
+//---------------------------------------------------------------------------
+
+#if JUTTA_TRACE_ENABLED
+#define JUTTA_TRACE_RX(buffer, byte) (buffer).push(::jutta_proto::trace::Direction::RX, (byte), esphome::millis())
+#define JUTTA_TRACE_TX(buffer, byte) (buffer).push(::jutta_proto::trace::Direction::TX, (byte), esphome::millis())
+#else
+#define JUTTA_TRACE_RX(buffer, byte) \
+    do {                             \
+    } while (false)
+#define JUTTA_TRACE_TX(buffer, byte) \
+    do {                             \
+    } while (false)
+#endif
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+//---------------------------------------------------------------------------
+namespace jutta_proto {
+//---------------------------------------------------------------------------
+/**
+ * Histogram of durations in milliseconds with fixed buckets.
+ * Recording a value is a binary search over the bucket bounds and an increment, so it can be done for every command.
+ **/
+class LatencyHistogram {
+ public:
+    // Upper bounds of all buckets except the last one, which takes everything above.
+    static constexpr std::array<uint16_t, 15> BOUNDS_MS{5, 10, 20, 30, 50, 75, 100, 150, 200, 300, 500, 750, 1000, 2000, 5000};
+    static constexpr size_t NUM_BUCKETS = BOUNDS_MS.size() + 1;
+
+    void record(uint32_t duration_ms) {
+        size_t bucket = static_cast<size_t>(std::lower_bound(BOUNDS_MS.begin(), BOUNDS_MS.end(), duration_ms) - BOUNDS_MS.begin());
+        ++this->counts_[bucket];
+        ++this->total_;
+        this->max_ms_ = std::max(this->max_ms_, duration_ms);
+    }
+
+    /**
+     * Returns the upper bound of the bucket the given percentile (0 - 100) falls into.
+     * Never returns more than the largest recorded value. Returns 0 in case nothing has been recorded yet.
+     **/
+    [[nodiscard]] uint32_t percentile(uint8_t percent) const {
+        if (this->total_ == 0) {
+            return 0;
+        }
+        // Rank of the value we are looking for, rounded up:
+        uint64_t rank = (static_cast<uint64_t>(this->total_) * std::min<uint8_t>(percent, 100) + 99) / 100;
+        rank = std::max<uint64_t>(rank, 1);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BOUNDS_MS.size(); i++) {
+            seen += this->counts_[i];
+            if (seen >= rank) {
+                return std::min<uint32_t>(BOUNDS_MS[i], this->max_ms_);
+            }
+        }
+        return this->max_ms_;
+    }
+
+    [[nodiscard]] uint32_t count() const { return this->total_; }
+    [[nodiscard]] uint32_t max_ms() const { return this->max_ms_; }
+
+ private:
+    std::array<uint32_t, NUM_BUCKETS> counts_{};
+    uint32_t total_{0};
+    uint32_t max_ms_{0};
+};
+//---------------------------------------------------------------------------
+}  // namespace jutta_proto
+//---------------------------------------------------------------------------
@@ -0,0 +1,113 @@
+#pragma once
+
+#include "esphome/core/defines.h"
+
+#ifdef USE_JUTTA_LOOP_PROFILER
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "esphome/core/hal.h"
+#endif
+
+//---------------------------------------------------------------------------
+namespace jutta_proto {
+//---------------------------------------------------------------------------
+#ifdef USE_JUTTA_LOOP_PROFILER
+/**
+ * Keeps track of how much time the different parts of JuraComponent::loop() take.
+ * Sections nest: TX and RX are part of the handshake or coffee maker section they are called from,
+ * ALIGN is part of RX and everything is part of LOOP.
+ **/
+class LoopProfiler {
+ public:
+    enum Section : uint8_t { LOOP = 0, HANDSHAKE, COFFEE_MAKER, TX, RX, ALIGN, NUM_SECTIONS };
+
+    struct SectionStats {
+        uint32_t calls{0};
+        uint32_t max_us{0};
+        uint64_t total_us{0};
+
+        [[nodiscard]] uint32_t mean_us() const { return this->calls > 0 ? static_cast<uint32_t>(this->total_us / this->calls) : 0; }
+    };
+
+    /**
+     * Measures the time until it goes out of scope.
+     **/
+    class Scope {
+     public:
+        Scope(LoopProfiler* profiler, Section section) : profiler_(profiler), section_(section), start_(esphome::micros()) {}
+        ~Scope() {
+            if (this->profiler_ != nullptr) {
+                this->profiler_->record(this->section_, esphome::micros() - this->start_);
+            }
+        }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+     private:
+        LoopProfiler* profiler_;
+        Section section_;
+        uint32_t start_;
+    };
+
+    static const char* section_name(Section section) {
+        static const char* const NAMES[NUM_SECTIONS] = {"loop", "handshake", "coffee maker", "TX", "RX", "RX align"};
+        return NAMES[section];
+    }
+
+    void set_budget_us(uint32_t budget_us) { this->budget_us_ = budget_us; }
+    [[nodiscard]] uint32_t get_budget_us() const { return this->budget_us_; }
+
+    void record(Section section, uint32_t duration_us) {
+        SectionStats& stats = this->sections_[section];
+        ++stats.calls;
+        stats.total_us += duration_us;
+        if (duration_us > stats.max_us) {
+            stats.max_us = duration_us;
+        }
+        if (section == LOOP) {
+            if (duration_us > this->budget_us_) {
+                ++this->loops_over_budget_;
+            }
+            if (duration_us > this->window_max_loop_us_) {
+                this->window_max_loop_us_ = duration_us;
+            }
+        }
+    }
+
+    [[nodiscard]] const SectionStats& get_section(Section section) const { return this->sections_[section]; }
+    [[nodiscard]] uint32_t get_loops_over_budget() const { return this->loops_over_budget_; }
+
+    /**
+     * Returns the longest loop since the last call and starts a new window.
+     **/
+    uint32_t take_window_max_loop_us() {
+        uint32_t max_us = this->window_max_loop_us_;
+        this->window_max_loop_us_ = 0;
+        return max_us;
+    }
+
+ private:
+    std::array<SectionStats, NUM_SECTIONS> sections_{};
+    uint32_t budget_us_{30000};
+    uint32_t loops_over_budget_{0};
+    uint32_t window_max_loop_us_{0};
+};
+
+#define JUTTA_PROFILE_CONCAT_(a, b) a##b
+#define JUTTA_PROFILE_CONCAT(a, b) JUTTA_PROFILE_CONCAT_(a, b)
+/**
+ * Times the rest of the current scope as the given LoopProfiler::Section.
+ * profiler may be nullptr. Compiles to nothing without USE_JUTTA_LOOP_PROFILER.
+ **/
+#define JUTTA_PROFILE_SCOPE(profiler, section) \
+    ::jutta_proto::LoopProfiler::Scope JUTTA_PROFILE_CONCAT(jutta_profile_scope_, __LINE__)((profiler), ::jutta_proto::LoopProfiler::section)
+#else
+#define JUTTA_PROFILE_SCOPE(profiler, section) \
+    do {                                       \
+    } while (false)
+#endif
+//---------------------------------------------------------------------------
+}  // namespace jutta_proto
+//---------------------------------------------------------------------------
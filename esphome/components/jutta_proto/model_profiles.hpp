@@ -0,0 +1,93 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include "coffee_maker.hpp"
+
+//---------------------------------------------------------------------------
+namespace jutta_proto {
+//---------------------------------------------------------------------------
+/**
+ * Front panel layout and timing of one family of coffee makers.
+ * All profiles are constexpr, so the registry lives in flash and looking up a drink is a plain array access.
+ **/
+struct ModelProfile {
+    struct Drink {
+        uint8_t page;
+        CoffeeMaker::jutta_button_t button;
+    };
+
+    // Matched against the start of the "ty:" reply, e.g. "EF532" for "ty:EF532M V02.03".
+    std::string_view type_prefix;
+    const char* name;
+    uint8_t num_pages;
+    // Indexed by CoffeeMaker::coffee_t.
+    std::array<Drink, CoffeeMaker::NUM_COFFEES> drinks;
+    // Pause after every encoded byte sent (in microseconds) and after pressing a front panel button.
+    uint32_t byte_gap_us;
+    uint32_t button_delay_ms;
+
+    [[nodiscard]] constexpr const Drink& drink(CoffeeMaker::coffee_t coffee) const {
+        return this->drinks[static_cast<size_t>(coffee)];
+    }
+};
+
+/**
+ * Used for coffee makers without a profile of their own. The layout of the JURA E6 (2019), which the protocol has
+ * been documented on.
+ **/
+inline constexpr ModelProfile DEFAULT_MODEL_PROFILE{
+    "",
+    "default",
+    2,
+    {{
+        {0, CoffeeMaker::BUTTON_1},  // ESPRESSO
+        {0, CoffeeMaker::BUTTON_2},  // COFFEE
+        {0, CoffeeMaker::BUTTON_4},  // CAPPUCCINO
+        {0, CoffeeMaker::BUTTON_5},  // MILK_FOAM
+        {1, CoffeeMaker::BUTTON_1},  // CAFFE_BARISTA
+        {1, CoffeeMaker::BUTTON_2},  // LUNGO_BARISTA
+        {1, CoffeeMaker::BUTTON_4},  // ESPRESSO_DOPPIO
+        {1, CoffeeMaker::BUTTON_5},  // MACCHIATO
+    }},
+    8000,
+    500,
+};
+
+/**
+ * Known coffee makers. The first profile whose prefix matches wins, so more specific prefixes go first.
+ **/
+inline constexpr std::array<ModelProfile, 1> MODEL_PROFILES{{
+    // JURA E6 (2019), "ty:EF532M V02.03":
+    {
+        "EF532",
+        "E6 (2019)",
+        DEFAULT_MODEL_PROFILE.num_pages,
+        DEFAULT_MODEL_PROFILE.drinks,
+        DEFAULT_MODEL_PROFILE.byte_gap_us,
+        DEFAULT_MODEL_PROFILE.button_delay_ms,
+    },
+}};
+
+/**
+ * Returns the profile for the given "ty:" reply, with or without the "ty:" and the trailing "\r\n".
+ * Falls back to DEFAULT_MODEL_PROFILE in case no profile matches.
+ **/
+constexpr const ModelProfile& find_model_profile(std::string_view device_type) {
+    constexpr std::string_view TYPE_REPLY = "ty:";
+    if (device_type.substr(0, TYPE_REPLY.size()) == TYPE_REPLY) {
+        device_type.remove_prefix(TYPE_REPLY.size());
+    }
+    for (const ModelProfile& profile : MODEL_PROFILES) {
+        if (device_type.substr(0, profile.type_prefix.size()) == profile.type_prefix) {
+            return profile;
+        }
+    }
+    return DEFAULT_MODEL_PROFILE;
+}
+//---------------------------------------------------------------------------
+}  // namespace jutta_proto
+//---------------------------------------------------------------------------
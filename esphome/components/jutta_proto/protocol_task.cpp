@@ -0,0 +1,73 @@
+#include "protocol_task.hpp"
+
+#ifdef USE_JUTTA_PROTOCOL_TASK
+
+#include <chrono>
+#include <utility>
+
+//---------------------------------------------------------------------------
+namespace jutta_proto {
+//---------------------------------------------------------------------------
+bool ProtocolTask::start(const char* name, std::function<void()> step) {
+    if (this->is_running()) {
+        return false;
+    }
+    this->step_ = std::move(step);
+    this->running_.store(true, std::memory_order_release);
+#ifdef USE_ESP32
+    const BaseType_t core = this->core_ == NO_CORE ? tskNO_AFFINITY : static_cast<BaseType_t>(this->core_);
+    if (xTaskCreatePinnedToCore(&ProtocolTask::task_main, name, this->stack_size_, this, this->priority_, &this->handle_,
+                                core) != pdPASS) {
+        this->handle_ = nullptr;
+        this->running_.store(false, std::memory_order_release);
+        return false;
+    }
+#else
+    (void) name;
+    this->thread_ = std::thread([this]() { this->run(); });
+#endif
+    return true;
+}
+
+void ProtocolTask::stop() {
+    this->running_.store(false, std::memory_order_release);
+#ifndef USE_ESP32
+    if (this->thread_.joinable()) {
+        this->thread_.join();
+    }
+#endif
+}
+
+uint32_t ProtocolTask::get_stack_headroom() const {
+#ifdef USE_ESP32
+    // The ESP-IDF port reports bytes instead of words:
+    return this->handle_ != nullptr ? static_cast<uint32_t>(uxTaskGetStackHighWaterMark(this->handle_)) : 0;
+#else
+    return 0;
+#endif
+}
+
+void ProtocolTask::run() {
+    while (this->running_.load(std::memory_order_acquire)) {
+        this->step_();
+#ifdef USE_ESP32
+        vTaskDelay(1);
+#else
+        std::this_thread::sleep_for(std::chrono::milliseconds{1});
+#endif
+    }
+}
+
+#ifdef USE_ESP32
+void ProtocolTask::task_main(void* arg) {
+    auto* task = static_cast<ProtocolTask*>(arg);
+    task->run();
+    task->handle_ = nullptr;
+    vTaskDelete(nullptr);
+}
+#endif
+//---------------------------------------------------------------------------
+}  // namespace jutta_proto
+//---------------------------------------------------------------------------
+
+#endif
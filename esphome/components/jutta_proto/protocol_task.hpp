@@ -0,0 +1,131 @@
+#pragma once
+
+#include "esphome/core/defines.h"
+
+#ifdef USE_JUTTA_PROTOCOL_TASK
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+#ifdef USE_ESP32
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#else
+#include <thread>
+#endif
+
+//---------------------------------------------------------------------------
+namespace jutta_proto {
+//---------------------------------------------------------------------------
+/**
+ * Fixed size lock-free queue between exactly one producer and one consumer thread.
+ * Neither side ever blocks or allocates. N has to be a power of two.
+ **/
+template <typename T, size_t N>
+class SpscRing {
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "The ring size has to be a power of two.");
+
+ public:
+    /**
+     * Producer side. Returns false in case the ring is full.
+     **/
+    bool push(const T& item) {
+        const size_t head = this->head_.load(std::memory_order_relaxed);
+        if (head - this->tail_.load(std::memory_order_acquire) == N) {
+            return false;
+        }
+        this->slots_[head & (N - 1)] = item;
+        this->head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Consumer side. Returns false in case the ring is empty.
+     **/
+    bool pop(T* item) {
+        const size_t tail = this->tail_.load(std::memory_order_relaxed);
+        if (this->head_.load(std::memory_order_acquire) == tail) {
+            return false;
+        }
+        *item = this->slots_[tail & (N - 1)];
+        this->tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Consumer side. Items the producer pushes right after this returned may not be counted.
+     **/
+    [[nodiscard]] bool empty() const {
+        return this->head_.load(std::memory_order_acquire) == this->tail_.load(std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] static constexpr size_t capacity() { return N; }
+
+ private:
+    std::array<T, N> slots_{};
+    // Free running counters, only the producer writes head_ and only the consumer writes tail_.
+    std::atomic<size_t> head_{0};
+    std::atomic<size_t> tail_{0};
+};
+
+/**
+ * Calls a step function over and over on its own FreeRTOS task (optionally pinned to a core) or, on the host,
+ * its own std::thread. Yields for a tick between two steps.
+ **/
+class ProtocolTask {
+ public:
+    // Core for the task to run on, NO_CORE lets the scheduler pick.
+    static constexpr int8_t NO_CORE = -1;
+
+    ProtocolTask() = default;
+    ProtocolTask(const ProtocolTask&) = delete;
+    ProtocolTask& operator=(const ProtocolTask&) = delete;
+    ~ProtocolTask() { this->stop(); }
+
+    void configure(uint32_t stack_size, uint8_t priority, int8_t core) {
+        this->stack_size_ = stack_size;
+        this->priority_ = priority;
+        this->core_ = core;
+    }
+    [[nodiscard]] uint32_t get_stack_size() const { return this->stack_size_; }
+    [[nodiscard]] uint8_t get_priority() const { return this->priority_; }
+    [[nodiscard]] int8_t get_core() const { return this->core_; }
+
+    /**
+     * Starts calling step. Returns false in case the task could not be created.
+     **/
+    bool start(const char* name, std::function<void()> step);
+    /**
+     * Lets the task end after its current step. Waits for that on the host.
+     **/
+    void stop();
+    [[nodiscard]] bool is_running() const { return this->running_.load(std::memory_order_acquire); }
+    /**
+     * Smallest amount of stack (in bytes) that was left so far, 0 in case unknown.
+     **/
+    [[nodiscard]] uint32_t get_stack_headroom() const;
+
+ private:
+    void run();
+
+    std::function<void()> step_{};
+    std::atomic<bool> running_{false};
+    uint32_t stack_size_{8192};
+    uint8_t priority_{2};
+    int8_t core_{NO_CORE};
+#ifdef USE_ESP32
+    static void task_main(void* arg);
+
+    TaskHandle_t handle_{nullptr};
+#else
+    std::thread thread_{};
+#endif
+};
+//---------------------------------------------------------------------------
+}  // namespace jutta_proto
+//---------------------------------------------------------------------------
+
+#endif
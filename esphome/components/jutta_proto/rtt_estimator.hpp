@@ -0,0 +1,86 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+//---------------------------------------------------------------------------
+namespace jutta_proto {
+//---------------------------------------------------------------------------
+/**
+ * Learns how long to wait for an "ok:" from the observed round-trip times, the way TCP derives its retransmission
+ * timeout (RFC 6298): timeout = smoothed RTT + 4 * RTT deviation, kept between a floor and a ceiling.
+ * Until the first sample arrives the ceiling is used. Every timeout doubles the current value (up to the ceiling) until
+ * the next sample arrives, so a slow coffee maker is not given up on too early.
+ * The averages are kept scaled (by 8 and 4) to stay in integer arithmetic.
+ **/
+class RttEstimator {
+ public:
+    static constexpr uint32_t DEFAULT_MIN_TIMEOUT_MS = 250;
+    static constexpr uint32_t DEFAULT_MAX_TIMEOUT_MS = 5000;
+
+    void set_limits(uint32_t min_timeout_ms, uint32_t max_timeout_ms) {
+        this->min_timeout_ms_ = min_timeout_ms;
+        this->max_timeout_ms_ = std::max(min_timeout_ms, max_timeout_ms);
+        this->update_timeout();
+    }
+
+    /**
+     * Adds a measured round-trip time. Only pass times of commands that were sent once, since the "ok:" to a resent
+     * one could answer either transmission (Karn's algorithm).
+     **/
+    void record(uint32_t rtt_ms) {
+        if (this->samples_ == 0) {
+            this->srtt_x8_ = rtt_ms * 8;
+            this->rttvar_x4_ = rtt_ms * 2;
+        } else {
+            const uint32_t srtt = this->srtt_x8_ / 8;
+            const uint32_t error = srtt > rtt_ms ? srtt - rtt_ms : rtt_ms - srtt;
+            // rttvar = 3/4 rttvar + 1/4 |srtt - rtt|, srtt = 7/8 srtt + 1/8 rtt:
+            this->rttvar_x4_ = this->rttvar_x4_ - this->rttvar_x4_ / 4 + error;
+            this->srtt_x8_ = this->srtt_x8_ - this->srtt_x8_ / 8 + rtt_ms;
+        }
+        ++this->samples_;
+        this->backoff_ = 0;
+        this->update_timeout();
+    }
+
+    /**
+     * Call in case a command did not get acknowledged in time.
+     **/
+    void on_timeout() {
+        if (this->samples_ > 0 && this->timeout_ms_ < this->max_timeout_ms_) {
+            ++this->backoff_;
+            this->update_timeout();
+        }
+    }
+
+    [[nodiscard]] uint32_t timeout_ms() const { return this->timeout_ms_; }
+    [[nodiscard]] uint32_t srtt_ms() const { return this->srtt_x8_ / 8; }
+    [[nodiscard]] uint32_t rttvar_ms() const { return this->rttvar_x4_ / 4; }
+    [[nodiscard]] uint32_t samples() const { return this->samples_; }
+
+ private:
+    void update_timeout() {
+        if (this->samples_ == 0) {
+            this->timeout_ms_ = this->max_timeout_ms_;
+            return;
+        }
+        uint64_t timeout = this->srtt_x8_ / 8 + std::max<uint32_t>(1, this->rttvar_x4_);
+        timeout <<= std::min<uint32_t>(this->backoff_, 16);
+        this->timeout_ms_ = static_cast<uint32_t>(
+            std::clamp<uint64_t>(timeout, this->min_timeout_ms_, this->max_timeout_ms_));
+    }
+
+    uint32_t min_timeout_ms_{DEFAULT_MIN_TIMEOUT_MS};
+    uint32_t max_timeout_ms_{DEFAULT_MAX_TIMEOUT_MS};
+    uint32_t timeout_ms_{DEFAULT_MAX_TIMEOUT_MS};
+    uint32_t srtt_x8_{0};
+    // 4 * rttvar scaled by 4 is exactly what the timeout needs.
+    uint32_t rttvar_x4_{0};
+    uint32_t samples_{0};
+    // Timeouts since the last sample.
+    uint32_t backoff_{0};
+};
+//---------------------------------------------------------------------------
+}  // namespace jutta_proto
+//---------------------------------------------------------------------------
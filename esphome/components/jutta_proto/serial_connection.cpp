@@ -1,14 +1,37 @@
 #include "serial_connection.hpp"
 
+#include "esphome/core/defines.h"
 #include "esphome/core/log.h"
+#include "esphome/core/time.h"
+#include <algorithm>
 #include <array>
 
+#if defined(USE_JUTTA_PROTOCOL_TASK) && defined(USE_ESP32)
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#endif
+
 //---------------------------------------------------------------------------
 namespace serial {
 //---------------------------------------------------------------------------
 
 static const char* TAG = "serial_connection";
 
+void Transport::wait_for_gap(uint32_t gap_us) const {
+    const uint32_t start = esphome::micros();
+#if defined(USE_JUTTA_PROTOCOL_TASK) && defined(USE_ESP32)
+    // All I/O runs on the protocol task, which can sleep the whole ticks of the gap instead. vTaskDelay(n) returns
+    // after at most n tick periods, the remainder below a tick gets busy-waited, so a calibrated gap stays exact.
+    const uint32_t tick_us = portTICK_PERIOD_MS * 1000;
+    if (gap_us >= tick_us) {
+        vTaskDelay(gap_us / tick_us);
+    }
+#endif
+    while (esphome::micros() - start < gap_us) {
+        // Busy-wait to preserve the required spacing between JUTTA bytes.
+    }
+}
+
 SerialConnection::SerialConnection(esphome::uart::UARTComponent* parent) : esphome::uart::UARTDevice(parent) {}
 
 void SerialConnection::init() {
@@ -25,7 +48,16 @@ size_t SerialConnection::read_serial(std::array<uint8_t, 4>& buffer) const {
         return 0;
     }
     auto* self = const_cast<SerialConnection*>(this);
-    return self->read_array(buffer.data(), buffer.size());
+    // read_array() only tells whether all requested bytes arrived, so never ask for more than are already there:
+    const int available = self->available();
+    if (available <= 0) {
+        return 0;
+    }
+    const size_t count = std::min(static_cast<size_t>(available), buffer.size());
+    if (!self->read_array(buffer.data(), count)) {
+        return 0;
+    }
+    return count;
 }
 
 bool SerialConnection::write_serial(const std::array<uint8_t, 4>& data) const {
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <array>
+#include <cstdint>
 #include <string>
 #include <vector>
 
@@ -9,7 +10,34 @@
 //---------------------------------------------------------------------------
 namespace serial {
 //---------------------------------------------------------------------------
-class SerialConnection : public esphome::uart::UARTDevice {
+/**
+ * Byte level transport the JuttaConnection talks through.
+ * Implemented by the UART backed SerialConnection and by decorators wrapping it.
+ **/
+class Transport {
+ public:
+    virtual ~Transport() = default;
+
+    /**
+     * Reads at maximum four bytes.
+     * Returns how many bytes have been actually read.
+     **/
+    [[nodiscard]] virtual size_t read_serial(std::array<uint8_t, 4>& buffer) const = 0;
+    /**
+     * Writes a single byte.
+     * Returns true on success.
+     **/
+    [[nodiscard]] virtual bool write_serial_byte(uint8_t byte) const = 0;
+    virtual void flush() const = 0;
+    /**
+     * Blocks for the given break between two bytes in microseconds.
+     * Busy-waits on micros() by default. Transports with their own notion of time (e.g. replaying a recording) override
+     * this to advance their clock instead.
+     **/
+    virtual void wait_for_gap(uint32_t gap_us) const;
+};
+
+class SerialConnection : public esphome::uart::UARTDevice, public Transport {
  public:
     explicit SerialConnection(esphome::uart::UARTComponent* parent);
 
@@ -23,7 +51,7 @@ class SerialConnection : public esphome::uart::UARTDevice {
      * Reads at maximum four bytes.
      * Returns how many bytes have been actually read.
      **/
-    [[nodiscard]] size_t read_serial(std::array<uint8_t, 4>& buffer) const;
+    [[nodiscard]] size_t read_serial(std::array<uint8_t, 4>& buffer) const override;
     /**
      * Writes the given data buffer to the serial connection.
      * Returns true on success.
@@ -33,8 +61,8 @@ class SerialConnection : public esphome::uart::UARTDevice {
      * Writes a single byte to the serial connection.
      * Returns true on success.
      **/
-    [[nodiscard]] bool write_serial_byte(uint8_t byte) const;
-    void flush() const;
+    [[nodiscard]] bool write_serial_byte(uint8_t byte) const override;
+    void flush() const override;
 
     /**
      * Returns all available serial port paths for this device.
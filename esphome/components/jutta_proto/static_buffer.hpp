@@ -0,0 +1,172 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <string>
+
+//---------------------------------------------------------------------------
+namespace jutta_proto {
+//---------------------------------------------------------------------------
+/**
+ * Fixed capacity replacement for the std::vector and std::deque buffers of the connection with "heap_free: true".
+ * Offers the subset of their interface the connection uses, so the same code works with either.
+ * Front operations move the remaining elements, which is fine for the few bytes these buffers hold.
+ * Elements that do not fit get dropped and counted in overflows().
+ **/
+template <typename T, size_t N>
+class StaticVector {
+ public:
+    using value_type = T;
+    using iterator = T*;
+    using const_iterator = const T*;
+
+    [[nodiscard]] size_t size() const { return this->size_; }
+    [[nodiscard]] static constexpr size_t capacity() { return N; }
+    [[nodiscard]] bool empty() const { return this->size_ == 0; }
+    [[nodiscard]] uint32_t overflows() const { return this->overflows_; }
+
+    T* data() { return this->items_.data(); }
+    const T* data() const { return this->items_.data(); }
+    iterator begin() { return this->items_.data(); }
+    iterator end() { return this->items_.data() + this->size_; }
+    const_iterator begin() const { return this->items_.data(); }
+    const_iterator end() const { return this->items_.data() + this->size_; }
+    T& operator[](size_t index) { return this->items_[index]; }
+    const T& operator[](size_t index) const { return this->items_[index]; }
+    T& front() { return this->items_[0]; }
+    const T& front() const { return this->items_[0]; }
+
+    void clear() { this->size_ = 0; }
+
+    void push_back(const T& item) {
+        if (this->size_ == N) {
+            ++this->overflows_;
+            return;
+        }
+        this->items_[this->size_++] = item;
+    }
+
+    void pop_front() { this->erase(this->begin(), this->begin() + 1); }
+
+    /**
+     * Inserts [first, last) in front of pos. Whatever does not fit anymore gets dropped from the end.
+     **/
+    template <typename InputIt>
+    iterator insert(const_iterator pos, InputIt first, InputIt last) {
+        const size_t offset = static_cast<size_t>(pos - this->begin());
+        const auto count = static_cast<size_t>(std::distance(first, last));
+        const size_t fits = std::min(count, N - offset);
+        // Elements behind pos that still fit after the inserted ones:
+        const size_t kept_tail = std::min(this->size_ - offset, N - offset - fits);
+        std::move_backward(this->begin() + offset, this->begin() + offset + kept_tail,
+                           this->begin() + offset + fits + kept_tail);
+        std::copy_n(first, fits, this->begin() + offset);
+        this->overflows_ += static_cast<uint32_t>((count - fits) + (this->size_ - offset - kept_tail));
+        this->size_ = offset + fits + kept_tail;
+        return this->begin() + offset;
+    }
+
+    iterator erase(const_iterator first, const_iterator last) {
+        const size_t offset = static_cast<size_t>(first - this->begin());
+        const size_t count = static_cast<size_t>(last - first);
+        std::move(this->begin() + offset + count, this->end(), this->begin() + offset);
+        this->size_ -= count;
+        return this->begin() + offset;
+    }
+
+ private:
+    std::array<T, N> items_{};
+    size_t size_{0};
+    uint32_t overflows_{0};
+};
+
+/**
+ * Fixed capacity replacement for the std::string windows the connection keeps while waiting for a response.
+ * Offers the subset of the std::string interface used there. Appending more than fits keeps the newest characters,
+ * which is what a window over the received data needs anyway.
+ **/
+template <size_t N>
+class StaticString {
+ public:
+    static constexpr size_t npos = std::string::npos;
+
+    StaticString() = default;
+    StaticString(const std::string& value) { this->assign(value.data(), value.size()); }  // NOLINT(google-explicit-constructor)
+    StaticString& operator=(const std::string& value) {
+        this->assign(value.data(), value.size());
+        return *this;
+    }
+
+    [[nodiscard]] size_t size() const { return this->size_; }
+    [[nodiscard]] static constexpr size_t capacity() { return N; }
+    [[nodiscard]] bool empty() const { return this->size_ == 0; }
+    [[nodiscard]] const char* data() const { return this->chars_.data(); }
+    [[nodiscard]] const char* c_str() const { return this->chars_.data(); }
+
+    void clear() {
+        this->size_ = 0;
+        this->chars_[0] = '\0';
+    }
+
+    void assign(const char* data, size_t size) {
+        this->clear();
+        this->append(data, size);
+    }
+
+    void append(const char* data, size_t size) {
+        if (size >= N) {
+            data += size - N;
+            size = N;
+        }
+        if (this->size_ + size > N) {
+            this->erase(0, this->size_ + size - N);
+        }
+        std::memcpy(this->chars_.data() + this->size_, data, size);
+        this->size_ += size;
+        this->chars_[this->size_] = '\0';
+    }
+    void append(const std::string& value) { this->append(value.data(), value.size()); }
+    template <typename InputIt>
+    void append(InputIt first, InputIt last) {
+        for (; first != last; ++first) {
+            const char c = static_cast<char>(*first);
+            this->append(&c, 1);
+        }
+    }
+
+    /**
+     * Erases count characters starting at pos, like std::string::erase().
+     **/
+    void erase(size_t pos, size_t count) {
+        count = std::min(count, this->size_ - pos);
+        std::memmove(this->chars_.data() + pos, this->chars_.data() + pos + count, this->size_ - pos - count);
+        this->size_ -= count;
+        this->chars_[this->size_] = '\0';
+    }
+
+    [[nodiscard]] size_t find(const std::string& needle, size_t pos = 0) const {
+        if (needle.size() > this->size_ || pos > this->size_ - needle.size()) {
+            return npos;
+        }
+        const char* end = this->chars_.data() + this->size_;
+        const char* found = std::search(this->chars_.data() + pos, end, needle.begin(), needle.end());
+        return found == end ? npos : static_cast<size_t>(found - this->chars_.data());
+    }
+
+    bool operator==(const std::string& other) const {
+        return other.size() == this->size_ && std::memcmp(other.data(), this->chars_.data(), this->size_) == 0;
+    }
+    bool operator!=(const std::string& other) const { return !(*this == other); }
+
+ private:
+    // One extra for the terminating '\0':
+    std::array<char, N + 1> chars_{};
+    size_t size_{0};
+};
+//---------------------------------------------------------------------------
+}  // namespace jutta_proto
+//---------------------------------------------------------------------------
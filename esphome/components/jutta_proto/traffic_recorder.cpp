@@ -0,0 +1,91 @@
+#include "traffic_recorder.hpp"
+
+#ifdef USE_JUTTA_TRAFFIC_RECORDER
+
+#include <algorithm>
+#include <array>
+
+//---------------------------------------------------------------------------
+namespace jutta_proto {
+//---------------------------------------------------------------------------
+TrafficRecorder::TrafficRecorder(size_t capacity)
+    : capacity_(std::max(capacity, MIN_CAPACITY)), buffer_(new uint8_t[std::max(capacity, MIN_CAPACITY)]) {}
+
+void TrafficRecorder::record(trace::Direction direction, uint8_t byte, uint32_t now_us) {
+    if (this->paused_) {
+        ++this->missed_;
+        return;
+    }
+    if (this->entries_ == 0) {
+        this->start_us_ = now_us;
+        this->last_us_ = now_us;
+    }
+    uint64_t value = (static_cast<uint64_t>(now_us - this->last_us_) << 1) | static_cast<uint8_t>(direction);
+    this->last_us_ = now_us;
+
+    std::array<uint8_t, MAX_ENTRY_SIZE> entry{};
+    size_t size = 0;
+    do {
+        entry[size] = static_cast<uint8_t>(value & 0x7F);
+        value >>= 7;
+        if (value != 0) {
+            entry[size] |= 0x80;
+        }
+        ++size;
+    } while (value != 0);
+    entry[size++] = byte;
+
+    while (this->capacity_ - this->used_ < size) {
+        this->drop_oldest();
+    }
+    size_t head = (this->tail_ + this->used_) % this->capacity_;
+    for (size_t i = 0; i < size; i++) {
+        this->buffer_[head] = entry[i];
+        if (++head == this->capacity_) {
+            head = 0;
+        }
+    }
+    this->used_ += size;
+    ++this->entries_;
+}
+
+void TrafficRecorder::drop_oldest() {
+    uint64_t value = 0;
+    size_t size = 0;
+    uint8_t part = 0;
+    do {
+        part = this->at(size);
+        value |= static_cast<uint64_t>(part & 0x7F) << (7 * size);
+        ++size;
+    } while ((part & 0x80) != 0);
+    // Skip the data byte:
+    ++size;
+
+    this->start_us_ += static_cast<uint32_t>(value >> 1);
+    this->tail_ = (this->tail_ + size) % this->capacity_;
+    this->used_ -= size;
+    --this->entries_;
+    ++this->overwritten_;
+}
+
+size_t TrafficRecorder::read(size_t offset, uint8_t* out, size_t length) const {
+    const std::array<uint32_t, 3> fields{this->start_us_, this->entries_, this->overwritten_};
+    std::array<uint8_t, HEADER_SIZE> header{'J', 'T', 'R', FORMAT_VERSION};
+    for (size_t i = 0; i < fields.size(); i++) {
+        for (size_t b = 0; b < 4; b++) {
+            header[4 + (i * 4) + b] = static_cast<uint8_t>(fields[i] >> (8 * b));
+        }
+    }
+
+    size_t copied = 0;
+    for (; copied < length && offset + copied < this->size(); copied++) {
+        size_t pos = offset + copied;
+        out[copied] = pos < HEADER_SIZE ? header[pos] : this->at(pos - HEADER_SIZE);
+    }
+    return copied;
+}
+//---------------------------------------------------------------------------
+}  // namespace jutta_proto
+//---------------------------------------------------------------------------
+
+#endif
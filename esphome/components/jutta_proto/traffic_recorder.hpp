@@ -0,0 +1,91 @@
+#pragma once
+
+#include "esphome/core/defines.h"
+
+#ifdef USE_JUTTA_TRAFFIC_RECORDER
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "jutta_trace.hpp"
+
+//---------------------------------------------------------------------------
+namespace jutta_proto {
+//---------------------------------------------------------------------------
+/**
+ * Fixed size ring buffer of the raw (encoded) bytes sent to and received from the coffee maker.
+ * The buffer gets allocated once, recording a byte takes constant time and never allocates.
+ * Once full, the oldest entries get overwritten.
+ *
+ * Every entry is a LEB128 varint of (delta_us << 1 | direction) followed by the raw byte, where delta_us is the time since the
+ * previous entry and direction is 0 for RX and 1 for TX. Bytes 8 ms apart take 3 byte per entry.
+ *
+ * The serialized form (see read()) is a 16 byte header followed by all entries, oldest first:
+ * "JTR", format version (1), start time in us, number of entries and number of overwritten entries.
+ * All header integers are uint32 little endian. The time of the first entry is start time + its delta.
+ **/
+class TrafficRecorder {
+ public:
+    static constexpr uint8_t FORMAT_VERSION = 1;
+    static constexpr size_t HEADER_SIZE = 16;
+    // Largest possible entry: 5 byte varint (33 bit) and the data byte.
+    static constexpr size_t MAX_ENTRY_SIZE = 6;
+    static constexpr size_t MIN_CAPACITY = 64;
+
+    explicit TrafficRecorder(size_t capacity);
+
+    void record(trace::Direction direction, uint8_t byte, uint32_t now_us);
+
+    /**
+     * While paused, bytes are not recorded but only counted.
+     * Used to keep the buffer stable while it is being dumped.
+     **/
+    void set_paused(bool paused) {
+        if (paused && !this->paused_) {
+            this->missed_ = 0;
+        }
+        this->paused_ = paused;
+    }
+    [[nodiscard]] bool is_paused() const { return this->paused_; }
+
+    /**
+     * Size of the serialized recording including the header.
+     **/
+    [[nodiscard]] size_t size() const { return HEADER_SIZE + this->used_; }
+    [[nodiscard]] size_t capacity() const { return this->capacity_; }
+    [[nodiscard]] uint32_t entries() const { return this->entries_; }
+    [[nodiscard]] uint32_t overwritten() const { return this->overwritten_; }
+    // Bytes seen during the current or last pause.
+    [[nodiscard]] uint32_t missed() const { return this->missed_; }
+
+    /**
+     * Copies up to length bytes of the serialized recording starting at offset into out.
+     * Returns the number of bytes copied.
+     **/
+    size_t read(size_t offset, uint8_t* out, size_t length) const;
+
+ private:
+    /**
+     * Drops the oldest entry and moves the start time to it.
+     **/
+    void drop_oldest();
+    [[nodiscard]] uint8_t at(size_t index) const { return this->buffer_[(this->tail_ + index) % this->capacity_]; }
+
+    size_t capacity_;
+    std::unique_ptr<uint8_t[]> buffer_;
+    // Position of the oldest entry and number of bytes in use.
+    size_t tail_{0};
+    size_t used_{0};
+    uint32_t start_us_{0};
+    uint32_t last_us_{0};
+    uint32_t entries_{0};
+    uint32_t overwritten_{0};
+    uint32_t missed_{0};
+    bool paused_{false};
+};
+//---------------------------------------------------------------------------
+}  // namespace jutta_proto
+//---------------------------------------------------------------------------
+
+#endif
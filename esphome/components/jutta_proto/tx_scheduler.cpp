@@ -0,0 +1,64 @@
+#include "tx_scheduler.hpp"
+
+#if JUTTA_TX_SCHEDULER_ENABLED
+
+#include <algorithm>
+
+#include "jutta_connection.hpp"
+
+//---------------------------------------------------------------------------
+namespace jutta_proto {
+//---------------------------------------------------------------------------
+TxScheduler& TxScheduler::shared() {
+    static TxScheduler scheduler;
+    return scheduler;
+}
+
+void TxScheduler::add(JuttaConnection* connection) {
+    Lane lane{};
+    lane.connection = connection;
+    this->lanes_.push_back(lane);
+}
+
+bool TxScheduler::service(uint32_t now_us) {
+    const size_t count = this->lanes_.size();
+    for (size_t i = 0; i < count; i++) {
+        const size_t index = (this->next_ + i) % count;
+        Lane& lane = this->lanes_[index];
+        if (!lane.connection->tx_pending()) {
+            lane.backlog = false;
+            continue;
+        }
+        const uint32_t since_us = now_us - lane.last_tx_us;
+        const uint32_t gap_us = lane.connection->get_byte_gap();
+        if (since_us < gap_us) {
+            continue;
+        }
+        if (lane.backlog) {
+            this->stats_.max_slot_delay_us = std::max(this->stats_.max_slot_delay_us, since_us - gap_us);
+        }
+        lane.connection->send_queued_byte();
+        lane.last_tx_us = now_us;
+        lane.backlog = lane.connection->tx_pending();
+        ++this->stats_.bytes_sent;
+        this->next_ = (index + 1) % count;
+        break;
+    }
+    return this->has_pending();
+}
+
+size_t TxScheduler::lane_index(const JuttaConnection* connection) const {
+    auto it = std::find_if(this->lanes_.begin(), this->lanes_.end(),
+                           [connection](const Lane& lane) { return lane.connection == connection; });
+    return static_cast<size_t>(it - this->lanes_.begin());
+}
+
+bool TxScheduler::has_pending() const {
+    return std::any_of(this->lanes_.begin(), this->lanes_.end(),
+                       [](const Lane& lane) { return lane.connection->tx_pending(); });
+}
+//---------------------------------------------------------------------------
+}  // namespace jutta_proto
+//---------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "esphome/core/defines.h"
+
+// With the protocol task every component sleeps through its own gaps, so there is nothing to interleave.
+#if defined(USE_JUTTA_TX_SCHEDULER) && !defined(USE_JUTTA_PROTOCOL_TASK)
+#define JUTTA_TX_SCHEDULER_ENABLED 1
+#else
+#define JUTTA_TX_SCHEDULER_ENABLED 0
+#endif
+
+#if JUTTA_TX_SCHEDULER_ENABLED
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#endif
+
+//---------------------------------------------------------------------------
+namespace jutta_proto {
+//---------------------------------------------------------------------------
+class JuttaConnection;
+
+#if JUTTA_TX_SCHEDULER_ENABLED
+/**
+ * Node-wide TX slot scheduler for several coffee makers on one node.
+ * Connections registered here queue their encoded bytes instead of writing them and spinning through the gap after
+ * each one (8 ms by default, see JuttaConnection::set_byte_gap()). Every call to service() hands out a single TX slot:
+ * the next byte of the first connection, in round-robin order, whose gap has passed. With N coffee makers their gaps overlap instead of adding up.
+ **/
+class TxScheduler {
+ public:
+    struct Stats {
+        // Encoded bytes sent over all connections.
+        uint32_t bytes_sent{0};
+        // How much later than its slot a queued byte went out at worst, e.g. because loop() was busy elsewhere.
+        uint32_t max_slot_delay_us{0};
+    };
+
+    /**
+     * The scheduler shared by all components of the node.
+     **/
+    static TxScheduler& shared();
+
+    void add(JuttaConnection* connection);
+    /**
+     * Sends at most one queued byte. Returns true in case bytes are still queued afterwards.
+     **/
+    bool service(uint32_t now_us);
+    [[nodiscard]] bool has_pending() const;
+    [[nodiscard]] size_t size() const { return this->lanes_.size(); }
+    /**
+     * Position of the connection in the order of registration, size() in case it is not registered.
+     **/
+    [[nodiscard]] size_t lane_index(const JuttaConnection* connection) const;
+    [[nodiscard]] const Stats& stats() const { return this->stats_; }
+
+ private:
+    struct Lane {
+        JuttaConnection* connection;
+        uint32_t last_tx_us{0};
+        // The byte after the last one sent was already queued, so its slot started one gap after last_tx_us.
+        bool backlog{false};
+    };
+
+    std::vector<Lane> lanes_{};
+    // Lane to check first on the next call.
+    size_t next_{0};
+    Stats stats_{};
+};
+#endif
+//---------------------------------------------------------------------------
+}  // namespace jutta_proto
+//---------------------------------------------------------------------------
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+
+/**
+ * Host stand-in for the ESPHome UART.
+ * There is no UART on the host. The tools pass all traffic through a serial::Transport installed with
+ * JuttaConnection::set_transport() instead, and tests queue received bytes with UARTComponent::receive().
+ * Writes are dropped. Reads behave like the real UART: read_array() only reports whether all requested bytes arrived.
+ **/
+namespace esphome::uart {
+class UARTComponent {
+ public:
+    void flush() {}
+
+    int available() const { return static_cast<int>(this->rx_.size()); }
+    bool read_array(uint8_t* data, size_t len) {
+        if (len > this->rx_.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < len; i++) {
+            data[i] = this->rx_.front();
+            this->rx_.pop_front();
+        }
+        return true;
+    }
+
+    /**
+     * Host only: queues the given bytes as if the UART had received them.
+     **/
+    void receive(const uint8_t* data, size_t len) { this->rx_.insert(this->rx_.end(), data, data + len); }
+
+ private:
+    std::deque<uint8_t> rx_{};
+};
+
+class UARTDevice {
+ public:
+    UARTDevice() = default;
+    explicit UARTDevice(UARTComponent* parent) : parent_(parent) {}
+
+    void write_byte(uint8_t /*data*/) {}
+    void write_array(const uint8_t* /*data*/, size_t /*len*/) {}
+    int available() { return this->parent_->available(); }
+    bool read_array(uint8_t* data, size_t len) { return this->parent_->read_array(data, len); }
+
+ protected:
+    UARTComponent* parent_{nullptr};
+};
+}  // namespace esphome::uart
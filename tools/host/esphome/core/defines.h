@@ -0,0 +1,3 @@
+#pragma once
+
+// Features of the component are enabled with -D on the compiler command line, e.g. -DUSE_JUTTA_FAULT_INJECTION.
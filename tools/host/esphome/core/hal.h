@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstdint>
+
+/**
+ * Host stand-in for the ESPHome HAL.
+ * The host tool linking the component sources has to define millis() and micros(), usually on top of a virtual clock.
+ **/
+namespace esphome {
+uint32_t millis();
+uint32_t micros();
+}  // namespace esphome
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cinttypes>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+
+#include "esphome/core/hal.h"
+
+/**
+ * Host stand-in for the ESPHome logger.
+ * Like on the device, messages above ESPHOME_LOG_LEVEL are compiled out. The rest gets printed to stderr, prefixed with
+ * millis() so the output lines up with the virtual clock of the host tool.
+ **/
+#define ESPHOME_LOG_LEVEL_NONE 0
+#define ESPHOME_LOG_LEVEL_ERROR 1
+#define ESPHOME_LOG_LEVEL_WARN 2
+#define ESPHOME_LOG_LEVEL_INFO 3
+#define ESPHOME_LOG_LEVEL_CONFIG 4
+#define ESPHOME_LOG_LEVEL_DEBUG 5
+#define ESPHOME_LOG_LEVEL_VERBOSE 6
+#define ESPHOME_LOG_LEVEL_VERY_VERBOSE 7
+
+#ifndef ESPHOME_LOG_LEVEL
+#define ESPHOME_LOG_LEVEL ESPHOME_LOG_LEVEL_INFO
+#endif
+
+namespace esphome::host {
+// Set to false to silence the component completely, e.g. for benchmarks.
+inline bool log_enabled = true;
+
+inline void log_printf(char level, const char* tag, const char* format, ...) __attribute__((format(printf, 3, 4)));
+inline void log_printf(char level, const char* tag, const char* format, ...) {
+    if (!log_enabled) {
+        return;
+    }
+    uint32_t now = esphome::millis();
+    std::fprintf(stderr, "%6" PRIu32 ".%03" PRIu32 " [%c][%s] ", now / 1000, now % 1000, level, tag);
+    va_list args;
+    va_start(args, format);
+    std::vfprintf(stderr, format, args);
+    va_end(args);
+    std::fputc('\n', stderr);
+}
+}  // namespace esphome::host
+
+#define ESP_HOST_LOG_(level, tag, ...) ::esphome::host::log_printf(level, tag, __VA_ARGS__)
+#define ESP_HOST_LOG_NONE_(tag, ...) \
+    do {                             \
+    } while (false)
+
+#if ESPHOME_LOG_LEVEL >= ESPHOME_LOG_LEVEL_ERROR
+#define ESP_LOGE(tag, ...) ESP_HOST_LOG_('E', tag, __VA_ARGS__)
+#else
+#define ESP_LOGE(tag, ...) ESP_HOST_LOG_NONE_(tag, __VA_ARGS__)
+#endif
+#if ESPHOME_LOG_LEVEL >= ESPHOME_LOG_LEVEL_WARN
+#define ESP_LOGW(tag, ...) ESP_HOST_LOG_('W', tag, __VA_ARGS__)
+#else
+#define ESP_LOGW(tag, ...) ESP_HOST_LOG_NONE_(tag, __VA_ARGS__)
+#endif
+#if ESPHOME_LOG_LEVEL >= ESPHOME_LOG_LEVEL_INFO
+#define ESP_LOGI(tag, ...) ESP_HOST_LOG_('I', tag, __VA_ARGS__)
+#else
+#define ESP_LOGI(tag, ...) ESP_HOST_LOG_NONE_(tag, __VA_ARGS__)
+#endif
+#if ESPHOME_LOG_LEVEL >= ESPHOME_LOG_LEVEL_CONFIG
+#define ESP_LOGCONFIG(tag, ...) ESP_HOST_LOG_('C', tag, __VA_ARGS__)
+#else
+#define ESP_LOGCONFIG(tag, ...) ESP_HOST_LOG_NONE_(tag, __VA_ARGS__)
+#endif
+#if ESPHOME_LOG_LEVEL >= ESPHOME_LOG_LEVEL_DEBUG
+#define ESP_LOGD(tag, ...) ESP_HOST_LOG_('D', tag, __VA_ARGS__)
+#else
+#define ESP_LOGD(tag, ...) ESP_HOST_LOG_NONE_(tag, __VA_ARGS__)
+#endif
+#if ESPHOME_LOG_LEVEL >= ESPHOME_LOG_LEVEL_VERBOSE
+#define ESP_LOGV(tag, ...) ESP_HOST_LOG_('V', tag, __VA_ARGS__)
+#else
+#define ESP_LOGV(tag, ...) ESP_HOST_LOG_NONE_(tag, __VA_ARGS__)
+#endif
+#if ESPHOME_LOG_LEVEL >= ESPHOME_LOG_LEVEL_VERY_VERBOSE
+#define ESP_LOGVV(tag, ...) ESP_HOST_LOG_('V', tag, __VA_ARGS__)
+#else
+#define ESP_LOGVV(tag, ...) ESP_HOST_LOG_NONE_(tag, __VA_ARGS__)
+#endif
@@ -0,0 +1,46 @@
+#!/bin/sh
+# Builds the host tools and tests and checks the component against recorded traffic.
+# Run from the repository root: sh tools/host_tests.sh [BUILD_DIR]
+set -eu
+
+SRC=esphome/components/jutta_proto
+OUT=${1:-build/host_tests}
+CXX=${CXX:-g++}
+CXXFLAGS="-std=c++17 -O1 -g -fsanitize=address,undefined -I tools/host -I $SRC"
+mkdir -p "$OUT"
+failed=0
+
+# replay NAME FILE ARGS...: The replay has to send exactly the recorded messages and deliver every recorded reply.
+replay() {
+    name=$1
+    file=$2
+    shift 2
+    if "$OUT/jutta_replay" --quiet --no-timeline "$@" "$file" > "$OUT/$name.log" 2>&1; then
+        echo "PASS replay $name"
+    else
+        echo "FAIL replay $name"
+        cat "$OUT/$name.log"
+        failed=1
+    fi
+}
+
+# unit NAME SOURCES...: Builds and runs a test from tools/tests/.
+unit() {
+    name=$1
+    shift
+    if ! $CXX $CXXFLAGS -o "$OUT/$name" "$@" || ! "$OUT/$name"; then
+        echo "FAIL $name"
+        failed=1
+    fi
+}
+
+unit heap_scope_test -DUSE_JUTTA_HEAP_FREE -pthread tools/tests/heap_scope_test.cpp $SRC/heap_report.cpp
+unit serial_connection_test tools/tests/serial_connection_test.cpp $SRC/jutta_connection.cpp $SRC/serial_connection.cpp
+
+$CXX $CXXFLAGS -o "$OUT/jutta_replay" tools/jutta_replay.cpp $SRC/coffee_maker.cpp $SRC/jutta_connection.cpp \
+    $SRC/serial_connection.cpp
+
+# The example of the README. Wire paced replies must not end early because the line looks idle between two frames.
+replay espresso tools/replays/espresso.txt --brew espresso
+
+exit $failed
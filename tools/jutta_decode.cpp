@@ -0,0 +1,340 @@
+/**
+ * Host side decoder for JURA UART captures.
+ * Uses the same codec as the ESPHome component, so captures get decoded exactly like on the device.
+ *
+ * Build (from the repository root):
+ *   g++ -std=c++17 -O2 -pthread -I esphome/components/jutta_proto -o jutta_decode tools/jutta_decode.cpp
+ *
+ * Usage:
+ *   jutta_decode [--format auto|text|raw] [--direction dongle|machine] [--threads N] FILE...
+ *
+ * Supported input formats:
+ *   text: The dumps in "protocol_snoops/". Lines like "0 1 0 1 0 1 0 0 -> 84 54 T" hold one decoded byte each,
+ *         lines like "22B 00100110 01010010 ..." hold raw bytes. "Dongle:" and "Coffee-Maker:" headers select the
+ *         direction of the following bytes.
+ *   raw:  Binary captures of one UART line, four encoded bytes per data byte.
+ *         The direction is taken from the last "--direction" argument before the file.
+ *         Large captures get decoded on "--threads" threads (default: all cores, 1 disables it).
+ *         The output is identical to decoding them on a single thread.
+ *
+ * "auto" picks "text" for ".md" and ".txt" files and "raw" for everything else.
+ * Neither format carries timestamps, so the printed time is derived from the position in the capture at the
+ * nominal JUTTA rate (one encoded byte every 8 ms plus 10 bit at 9600 baud).
+ **/
+#include "jutta_codec.hpp"
+#include "jutta_codec_parallel.hpp"
+#include "snoop_dump.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+using snoop_dump::contains;
+using snoop_dump::parse_bit_columns;
+using snoop_dump::parse_byte_row;
+
+// 10 bit (start, 8 data, stop) at 9600 baud:
+constexpr uint64_t UART_BYTE_US = 1042;
+// Every encoded byte is followed by an 8 ms break:
+constexpr uint64_t ENCODED_BYTE_US = UART_BYTE_US + 8000;
+constexpr uint64_t DECODED_BYTE_US = ENCODED_BYTE_US * jutta_proto::codec::FRAME_SIZE;
+
+enum class Direction { Dongle, Machine };
+enum class Format { Auto, Text, Raw };
+
+/**
+ * Read only memory mapping of a whole file.
+ **/
+class MappedFile {
+ public:
+    explicit MappedFile(const char* path) {
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+        struct stat st {};
+        if (fstat(fd, &st) == 0) {
+            size_ = static_cast<size_t>(st.st_size);
+            if (size_ == 0) {
+                valid_ = true;
+            } else {
+                void* mapped = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (mapped != MAP_FAILED) {
+                    data_ = static_cast<const uint8_t*>(mapped);
+                    madvise(mapped, size_, MADV_SEQUENTIAL);
+                    valid_ = true;
+                }
+            }
+        }
+        close(fd);
+    }
+    ~MappedFile() {
+        if (data_ != nullptr) {
+            munmap(const_cast<uint8_t*>(data_), size_);
+        }
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    [[nodiscard]] bool valid() const { return valid_; }
+    [[nodiscard]] const uint8_t* data() const { return data_; }
+    [[nodiscard]] size_t size() const { return size_; }
+
+ private:
+    const uint8_t* data_{nullptr};
+    size_t size_{0};
+    bool valid_{false};
+};
+
+/**
+ * Groups decoded bytes into messages and prints them.
+ * A message ends with "\r\n", a change of direction or an explicit flush.
+ **/
+class MessagePrinter {
+ public:
+    void push(Direction direction, uint64_t time_us, uint8_t byte) {
+        if (!message_.empty() && direction != direction_) {
+            flush();
+        }
+        if (message_.empty()) {
+            direction_ = direction;
+            start_us_ = time_us;
+        }
+        message_.push_back(byte);
+        if (message_.size() >= 2 && message_[message_.size() - 2] == '\r' && message_.back() == '\n') {
+            flush();
+        }
+    }
+
+    void flush() {
+        if (message_.empty()) {
+            return;
+        }
+        line_.clear();
+        append_time(start_us_);
+        line_ += direction_ == Direction::Dongle ? " s [D] " : " s [C] ";
+        for (uint8_t c : message_) {
+            append_escaped(c);
+        }
+        line_.push_back('\n');
+        std::fwrite(line_.data(), 1, line_.size(), stdout);
+        message_.clear();
+        ++messages_;
+    }
+
+    [[nodiscard]] size_t messages() const { return messages_; }
+
+ private:
+    /**
+     * Appends the time as right aligned "seconds.milliseconds" without going through printf.
+     **/
+    void append_time(uint64_t time_us) {
+        uint64_t ms = time_us / 1000;
+        char buffer[24];
+        size_t pos = sizeof(buffer);
+        for (size_t i = 0; i < 3; i++) {
+            buffer[--pos] = static_cast<char>('0' + ms % 10);
+            ms /= 10;
+        }
+        buffer[--pos] = '.';
+        do {
+            buffer[--pos] = static_cast<char>('0' + ms % 10);
+            ms /= 10;
+        } while (ms > 0);
+        while (sizeof(buffer) - pos < 12) {
+            buffer[--pos] = ' ';
+        }
+        line_.append(buffer + pos, sizeof(buffer) - pos);
+    }
+
+    void append_escaped(uint8_t c) {
+        static constexpr char HEX[] = "0123456789abcdef";
+        if (c >= 0x20 && c < 0x7F && c != '\\') {
+            line_.push_back(static_cast<char>(c));
+        } else if (c == '\r') {
+            line_ += "\\r";
+        } else if (c == '\n') {
+            line_ += "\\n";
+        } else if (c == '\\') {
+            line_ += "\\\\";
+        } else {
+            const char escaped[4] = {'\\', 'x', HEX[c >> 4], HEX[c & 0x0F]};
+            line_.append(escaped, sizeof(escaped));
+        }
+    }
+
+    std::vector<uint8_t> message_{};
+    std::string line_{};
+    Direction direction_{Direction::Dongle};
+    uint64_t start_us_{0};
+    size_t messages_{0};
+};
+
+struct Stats {
+    size_t decoded{0};
+    size_t skipped{0};
+};
+
+void decode_text(const MappedFile& file, MessagePrinter& printer, Stats& stats) {
+    const char* data = reinterpret_cast<const char*>(file.data());
+    const char* end = data + file.size();
+    Direction direction = Direction::Dongle;
+    uint64_t time_us = 0;
+
+    while (data < end) {
+        const char* eol = static_cast<const char*>(std::memchr(data, '\n', static_cast<size_t>(end - data)));
+        const char* line_end = eol != nullptr ? eol : end;
+        const char* line = data;
+        data = eol != nullptr ? eol + 1 : end;
+
+        while (line < line_end && (*line == ' ' || *line == '\t')) {
+            line++;
+        }
+        if (line == line_end || (line_end - line == 1 && *line == '\r')) {
+            // Empty lines separate messages in the dumps:
+            printer.flush();
+            continue;
+        }
+        if (contains(line, line_end, "Dongle:")) {
+            printer.flush();
+            direction = Direction::Dongle;
+            continue;
+        }
+        if (contains(line, line_end, "Coffee-Maker:")) {
+            printer.flush();
+            direction = Direction::Machine;
+            continue;
+        }
+
+        uint8_t byte = 0;
+        if (parse_bit_columns(line, line_end, &byte)) {
+            printer.push(direction, time_us, byte);
+            time_us += DECODED_BYTE_US;
+            ++stats.decoded;
+            continue;
+        }
+        parse_byte_row(line, line_end, [&](uint8_t decoded) {
+            printer.push(direction, time_us, decoded);
+            time_us += DECODED_BYTE_US;
+            ++stats.decoded;
+        });
+    }
+    printer.flush();
+}
+
+void decode_raw(const MappedFile& file, Direction direction, size_t threads, MessagePrinter& printer, Stats& stats) {
+    size_t decoded = 0;
+    auto on_byte = [&](size_t offset, uint8_t byte) {
+        printer.push(direction, offset * ENCODED_BYTE_US, byte);
+        ++decoded;
+    };
+    jutta_proto::codec::decode_stream_parallel(file.data(), file.size(), on_byte, threads);
+    printer.flush();
+    stats.decoded += decoded;
+    // Everything not part of a decoded frame, including an incomplete frame at the end:
+    stats.skipped += file.size() - decoded * jutta_proto::codec::FRAME_SIZE;
+}
+
+bool ends_with(const std::string& str, const char* suffix) {
+    size_t len = std::strlen(suffix);
+    return str.size() >= len && str.compare(str.size() - len, len, suffix) == 0;
+}
+
+void print_usage(const char* name) {
+    std::fprintf(stderr, "Usage: %s [--format auto|text|raw] [--direction dongle|machine] [--threads N] FILE...\n", name);
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+    static char out_buffer[1 << 20];
+    std::setvbuf(stdout, out_buffer, _IOFBF, sizeof(out_buffer));
+
+    Format format = Format::Auto;
+    Direction direction = Direction::Machine;
+    size_t threads = 0;
+    MessagePrinter printer;
+    Stats stats;
+    size_t total_bytes = 0;
+    size_t files = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--format" && i + 1 < argc) {
+            std::string value = argv[++i];
+            if (value == "auto") {
+                format = Format::Auto;
+            } else if (value == "text") {
+                format = Format::Text;
+            } else if (value == "raw") {
+                format = Format::Raw;
+            } else {
+                print_usage(argv[0]);
+                return 1;
+            }
+            continue;
+        }
+        if (arg == "--direction" && i + 1 < argc) {
+            std::string value = argv[++i];
+            if (value == "dongle") {
+                direction = Direction::Dongle;
+            } else if (value == "machine") {
+                direction = Direction::Machine;
+            } else {
+                print_usage(argv[0]);
+                return 1;
+            }
+            continue;
+        }
+        if (arg == "--threads" && i + 1 < argc) {
+            char* end = nullptr;
+            threads = std::strtoul(argv[++i], &end, 10);
+            if (end == argv[i] || *end != '\0') {
+                print_usage(argv[0]);
+                return 1;
+            }
+            continue;
+        }
+        if (arg == "-h" || arg == "--help") {
+            print_usage(argv[0]);
+            return 0;
+        }
+
+        MappedFile file(arg.c_str());
+        if (!file.valid()) {
+            std::fprintf(stderr, "Failed to map '%s'.\n", arg.c_str());
+            return 1;
+        }
+        bool text = format == Format::Text || (format == Format::Auto && (ends_with(arg, ".md") || ends_with(arg, ".txt")));
+        std::printf("# %s\n", arg.c_str());
+        if (text) {
+            decode_text(file, printer, stats);
+        } else {
+            decode_raw(file, direction, threads, printer, stats);
+        }
+        total_bytes += file.size();
+        ++files;
+    }
+
+    if (files == 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    std::fflush(stdout);
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::fprintf(stderr, "%zu file(s), %zu bytes, %zu decoded bytes, %zu skipped bytes, %zu messages in %.3f s (%.1f MB/s)\n",
+                 files, total_bytes, stats.decoded, stats.skipped, printer.messages(), seconds,
+                 seconds > 0 ? static_cast<double>(total_bytes) / seconds / 1e6 : 0.0);
+    return 0;
+}
@@ -0,0 +1,264 @@
+/**
+ * Fuzz harness for the receive path of the ESPHome component: the frame aligner (align_encoded_rx_buffer()) and the
+ * decoder (read_encoded_unsafe()) of JuttaConnection. The input gets fed in as the raw output of the coffee maker
+ * through a fake serial::Transport, in chunks the fuzzer picks. Besides the sanitizers it checks that the work done
+ * stays bounded by a constant per received byte, no matter how much garbage arrives.
+ *
+ * Build with libFuzzer (from the repository root):
+ *   clang++ -std=c++17 -O1 -g -fsanitize=fuzzer,address,undefined -I tools/host -I esphome/components/jutta_proto \
+ *       -o jutta_fuzz tools/jutta_fuzz.cpp esphome/components/jutta_proto/jutta_connection.cpp \
+ *       esphome/components/jutta_proto/serial_connection.cpp
+ * AFL++ builds the same with afl-clang-fast++ instead of clang++. Adding -DJUTTA_FUZZ_MAIN (and dropping "fuzzer" from
+ * -fsanitize) gives a standalone binary, which also builds with g++, runs the given inputs once and seeds the corpus.
+ *
+ * Usage:
+ *   jutta_fuzz --seed DIR SNOOP...   Writes inputs built from the coffee maker side of the dumps into DIR
+ *                                    (standalone build only).
+ *   jutta_fuzz [OPTION...] CORPUS    Fuzzes (libFuzzer build).
+ *   jutta_fuzz INPUT...              Runs the given inputs (both builds).
+ *
+ * Input format:
+ *   byte 0:      Tolerated filler bits per frame (see JuttaConnection::set_frame_tolerance()), taken modulo 5.
+ *   byte 1:      Length N of the chunk plan.
+ *   bytes 2..N+1: Chunk plan, used round robin. The n-th read of the transport returns up to plan[n % N] % 5 bytes,
+ *                0 being a quiet line. Bit 7 of plan[n % N] makes the n-th call of the harness read a single byte
+ *                instead of a whole buffer. Without a plan every read returns up to 4 bytes.
+ *   the rest:    The bytes the coffee maker sends, raw (encoded).
+ **/
+#include "jutta_codec.hpp"
+#include "jutta_connection.hpp"
+#include "recording.hpp"
+#include "serial_connection.hpp"
+#include "snoop_dump.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+// Bound on LinkStats::bytes_inspected: every discarded byte costs the aligner at most one plain and one frame check
+// (5 bytes), every read call at most two frame checks that do not discard anything.
+constexpr uint64_t MAX_INSPECTIONS_PER_BYTE = 5;
+constexpr uint64_t MAX_INSPECTIONS_PER_READ = 10;
+// Calls of the harness on top of one per input byte, so a plan full of quiet reads still ends.
+constexpr size_t EXTRA_CALLS = 16;
+
+uint64_t now_us = 0;
+}  // namespace
+
+namespace esphome {
+uint32_t millis() { return static_cast<uint32_t>(now_us / 1000); }
+uint32_t micros() { return static_cast<uint32_t>(now_us); }
+}  // namespace esphome
+
+namespace {
+/**
+ * Hands out the input in the chunks of the plan. Time only moves in the byte gaps.
+ **/
+class FuzzTransport : public serial::Transport {
+ public:
+    FuzzTransport(const uint8_t* plan, size_t plan_size, const uint8_t* data, size_t size)
+        : plan_(plan), plan_size_(plan_size), data_(data), size_(size) {}
+
+    [[nodiscard]] size_t read_serial(std::array<uint8_t, 4>& buffer) const override {
+        size_t chunk = buffer.size();
+        if (this->plan_size_ > 0) {
+            chunk = (this->plan_[this->reads_ % this->plan_size_] & 0x7F) % (buffer.size() + 1);
+        }
+        ++this->reads_;
+        size_t count = 0;
+        while (count < chunk && this->offset_ < this->size_) {
+            buffer[count++] = this->data_[this->offset_++];
+        }
+        return count;
+    }
+
+    [[nodiscard]] bool write_serial_byte(uint8_t /*byte*/) const override { return true; }
+    void flush() const override {}
+    void wait_for_gap(uint32_t gap_us) const override { now_us += gap_us; }
+
+    [[nodiscard]] size_t delivered() const { return this->offset_; }
+    [[nodiscard]] size_t reads() const { return this->reads_; }
+
+ private:
+    const uint8_t* plan_;
+    size_t plan_size_;
+    const uint8_t* data_;
+    size_t size_;
+    mutable size_t offset_{0};
+    mutable size_t reads_{0};
+};
+
+[[noreturn]] void fail(const char* what, uint64_t actual, uint64_t limit) {
+    std::fprintf(stderr, "jutta_fuzz: %s: %llu > %llu\n", what, static_cast<unsigned long long>(actual),
+                 static_cast<unsigned long long>(limit));
+    std::abort();
+}
+
+#ifdef JUTTA_FUZZ_MAIN
+/**
+ * Collects the coffee maker side of a dump from "protocol_snoops/", encoded like on the line: bit columns, byte rows
+ * and "[C]: ok:\r\n" transcript lines all hold decoded bytes. Byte rows outside of a "Dongle:" section count as coffee
+ * maker output.
+ * Dumps of the dongle side only give their dongle bytes instead, which are valid frames just the same.
+ **/
+std::vector<uint8_t> machine_bytes(const std::string& dump) {
+    std::array<std::vector<uint8_t>, 2> bytes;
+    auto push_decoded = [](std::vector<uint8_t>& out, uint8_t byte) {
+        for (uint8_t encoded : jutta_proto::codec::encode(byte)) {
+            out.push_back(encoded);
+        }
+    };
+    const char* data = dump.data();
+    const char* end = data + dump.size();
+    bool dongle = false;
+    while (data < end) {
+        const char* eol = static_cast<const char*>(std::memchr(data, '\n', static_cast<size_t>(end - data)));
+        const char* line_end = eol != nullptr ? eol : end;
+        const char* line = data;
+        data = eol != nullptr ? eol + 1 : end;
+        while (line < line_end && (*line == ' ' || *line == '\t')) {
+            line++;
+        }
+        if (snoop_dump::contains(line, line_end, "Dongle:")) {
+            dongle = true;
+            continue;
+        }
+        if (snoop_dump::contains(line, line_end, "Coffee-Maker:")) {
+            dongle = false;
+            continue;
+        }
+        std::vector<uint8_t>& out = bytes[dongle ? 1 : 0];
+        const size_t length = static_cast<size_t>(line_end - line);
+        if (length > 5 && (std::strncmp(line, "[C]: ", 5) == 0 || std::strncmp(line, "[D]: ", 5) == 0)) {
+            std::string text;
+            if (recording::parse_escaped(std::string(line + 5, line_end), &text)) {
+                for (char c : text) {
+                    push_decoded(bytes[line[1] == 'D' ? 1 : 0], static_cast<uint8_t>(c));
+                }
+            }
+            continue;
+        }
+        uint8_t byte = 0;
+        if (snoop_dump::parse_bit_columns(line, line_end, &byte)) {
+            push_decoded(out, byte);
+            continue;
+        }
+        snoop_dump::parse_byte_row(line, line_end, [&](uint8_t byte) { push_decoded(out, byte); });
+    }
+    return bytes[0].empty() ? bytes[1] : bytes[0];
+}
+
+bool write_input(const std::string& path, uint8_t tolerance, const std::vector<uint8_t>& plan,
+                 const std::vector<uint8_t>& payload) {
+    std::FILE* file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        return false;
+    }
+    std::vector<uint8_t> input{tolerance, static_cast<uint8_t>(plan.size())};
+    input.insert(input.end(), plan.begin(), plan.end());
+    input.insert(input.end(), payload.begin(), payload.end());
+    const bool written = std::fwrite(input.data(), 1, input.size(), file) == input.size();
+    return std::fclose(file) == 0 && written;
+}
+
+/**
+ * Writes three inputs per dump: whole frames, ragged chunks with quiet reads and single byte reads, and ragged chunks
+ * with a tolerance of one filler bit.
+ **/
+int seed_corpus(const char* directory, int count, char** paths) {
+    const std::vector<uint8_t> ragged_plan{1, 3, 0, 2 | 0x80, 4, 4};
+    for (int i = 0; i < count; i++) {
+        std::string dump;
+        if (!recording::read_file(paths[i], &dump)) {
+            std::fprintf(stderr, "Cannot read %s.\n", paths[i]);
+            return 2;
+        }
+        std::vector<uint8_t> payload = machine_bytes(dump);
+        std::string name = paths[i];
+        name = name.substr(name.find_last_of('/') + 1);
+        const std::string base = std::string(directory) + "/" + name;
+        if (!write_input(base + ".frames", 0, {}, payload) || !write_input(base + ".ragged", 0, ragged_plan, payload) ||
+            !write_input(base + ".tolerant", 1, ragged_plan, payload)) {
+            std::fprintf(stderr, "Cannot write the inputs for %s into %s.\n", paths[i], directory);
+            return 2;
+        }
+        std::printf("%s: %zu bytes\n", paths[i], payload.size());
+    }
+    return 0;
+}
+#endif
+}  // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    if (size < 2) {
+        return 0;
+    }
+    esphome::host::log_enabled = false;
+    now_us = 0;
+    const uint8_t tolerance = data[0] % 5;
+    const size_t plan_size = std::min<size_t>(data[1], size - 2);
+    const uint8_t* plan = data + 2;
+    const uint8_t* payload = plan + plan_size;
+    const size_t payload_size = size - 2 - plan_size;
+
+    FuzzTransport transport(plan, plan_size, payload, payload_size);
+    esphome::uart::UARTComponent uart;
+    jutta_proto::JuttaConnection connection(&uart);
+    connection.set_transport(&transport);
+    connection.set_frame_tolerance(tolerance);
+
+    std::vector<uint8_t> decoded;
+    for (size_t call = 0; call < payload_size + EXTRA_CALLS; call++) {
+        if (plan_size > 0 && (plan[call % plan_size] & 0x80) != 0) {
+            uint8_t byte = 0;
+            (void) connection.read_decoded(&byte);
+        } else {
+            decoded.clear();
+            (void) connection.read_decoded(decoded);
+        }
+    }
+
+    const auto& link = connection.get_link_stats();
+    const uint64_t delivered = transport.delivered();
+    // Every delivered byte ends up in at most one frame or gets discarded once:
+    const uint64_t consumed = uint64_t{link.frames_decoded} * jutta_proto::codec::FRAME_SIZE + link.stray_bytes;
+    if (consumed > delivered) {
+        fail("bytes decoded or discarded exceed the bytes received", consumed, delivered);
+    }
+    // Every read call either reads from the transport or takes a frame out of the buffer:
+    const uint64_t inspection_limit = MAX_INSPECTIONS_PER_BYTE * delivered +
+                                      MAX_INSPECTIONS_PER_READ * (transport.reads() + link.frames_decoded);
+    if (link.bytes_inspected > inspection_limit) {
+        fail("bytes inspected by the aligner", link.bytes_inspected, inspection_limit);
+    }
+    return 0;
+}
+
+#ifdef JUTTA_FUZZ_MAIN
+int main(int argc, char** argv) {
+    if (argc >= 3 && std::strcmp(argv[1], "--seed") == 0) {
+        return seed_corpus(argv[2], argc - 3, argv + 3);
+    }
+    if (argc < 2) {
+        std::fprintf(stderr, "Usage: %s --seed DIR SNOOP... | %s INPUT...\n", argv[0], argv[0]);
+        return 2;
+    }
+    for (int i = 1; i < argc; i++) {
+        std::string input;
+        if (!recording::read_file(argv[i], &input)) {
+            std::fprintf(stderr, "Cannot read %s.\n", argv[i]);
+            return 2;
+        }
+        LLVMFuzzerTestOneInput(reinterpret_cast<const uint8_t*>(input.data()), input.size());
+    }
+    std::printf("%d input(s) passed.\n", argc - 1);
+    return 0;
+}
+#endif
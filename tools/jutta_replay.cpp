@@ -0,0 +1,733 @@
+/**
+ * Replays recorded JURA UART traffic against the JuttaConnection and CoffeeMaker of the ESPHome component on the host.
+ * The coffee maker side of the recording gets fed back in while the component runs its state machines on a virtual
+ * clock, so a recording of several minutes replays in milliseconds. Afterwards the messages the component sent get
+ * compared to the recorded ones.
+ *
+ * Build (from the repository root):
+ *   g++ -std=c++17 -O2 -I tools/host -I esphome/components/jutta_proto -o jutta_replay tools/jutta_replay.cpp \
+ *       esphome/components/jutta_proto/coffee_maker.cpp esphome/components/jutta_proto/jutta_connection.cpp \
+ *       esphome/components/jutta_proto/serial_connection.cpp
+ * Add -DUSE_JUTTA_HEAP_FREE and esphome/components/jutta_proto/heap_report.cpp to count the heap allocations the
+ * component makes while replaying. Add -DUSE_JUTTA_FAULT_INJECTION, esphome/components/jutta_proto/fault_injection.cpp
+ * and esphome/components/jutta_proto/handshake.cpp for --fault.
+ *
+ * Usage:
+ *   jutta_replay [--brew COFFEE] [--custom GRIND_MS:WATER_MS] [--page N] [--skip N] [--tick MS] [--quiet]
+ *                [--no-timeline] [--fault NAME[:RATES] [--runs N]] FILE
+ *
+ * The actions (--brew, --custom, --page) get started in the given order, each one once the previous one finished.
+ * They should match what triggered the recorded traffic. --skip drops the first N messages the dongle sent in the
+ * recording (and everything before the next one), e.g. the handshake, which is not part of the CoffeeMaker.
+ *
+ * Supported input files (see recording.hpp):
+ *   - Recordings of the traffic recorder, either binary ("JTR" header) or the log output of
+ *     "jutta_proto.dump_traffic" ("Traffic 1/12: <base64>" lines, other lines are ignored).
+ *   - Transcripts, e.g. of the dumps in "protocol_snoops/". One message per line: "TX" for the dongle or "RX" for the
+ *     coffee maker, optionally "+<N>ms" for the pause before the message, and the text. "\r\n" gets appended, "\xNN"
+ *     escapes are supported and lines starting with "#" are ignored:
+ *       TX FA:04
+ *       RX +40ms ok:
+ *
+ * --fault runs a fault sweep instead of comparing the messages. Every given profile gets --runs runs (10 by default), the
+ * n-th one with seed + n. RATES is a comma separated list of flip, drop, dup, gap, gap_ms, lost_ok and seed, e.g.
+ * "noisy:flip=0.5%,drop=0.5%,lost_ok=5%", see serial::FaultProfile. The received bytes pass through the same
+ * FaultInjectingTransport as on the device, and the coffee maker answers every message with the reply recorded for it,
+ * so it keeps answering when the component repeats or gives up on a command. A recording holding the key exchange
+ * ("@T1") is run through the Handshake of the component first. Per profile it prints the frames lost before each resync, the time until the
+ * handshake succeeded and the share of failed brews.
+ *
+ * Returns 0 in case the component sent exactly the recorded messages, 1 if they differ and 2 on errors.
+ * A fault sweep returns 0 unless there was an error.
+ **/
+#include "coffee_maker.hpp"
+#include "fault_injection.hpp"
+#include "handshake.hpp"
+#include "heap_report.hpp"
+#include "jutta_codec.hpp"
+#include "jutta_commands.hpp"
+#include "recording.hpp"
+#include "serial_connection.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace {
+using recording::Direction;
+using recording::Entry;
+using recording::Message;
+
+// The replay ends once nothing happened for this long after the last action finished.
+constexpr uint64_t SETTLE_US = 2000000;
+// Upper bound on top of the recording duration, in case the component keeps waiting for something.
+constexpr uint64_t MAX_EXTRA_US = 60000000;
+// A fault sweep run without a finished handshake after this long counts as failed.
+constexpr uint64_t MAX_HANDSHAKE_US = 60000000;
+constexpr size_t DEFAULT_FAULT_RUNS = 10;
+
+/**
+ * Time source of the whole replay. Only moves when told to.
+ **/
+class VirtualClock {
+ public:
+    [[nodiscard]] uint64_t now_us() const { return now_us_; }
+    void advance(uint64_t us) { now_us_ += us; }
+
+ private:
+    uint64_t now_us_{0};
+};
+
+VirtualClock virtual_clock;
+}  // namespace
+
+namespace esphome {
+uint32_t millis() { return static_cast<uint32_t>(virtual_clock.now_us() / 1000); }
+uint32_t micros() { return static_cast<uint32_t>(virtual_clock.now_us()); }
+}  // namespace esphome
+
+namespace {
+/**
+ * Drops everything before the (count + 1)th message the dongle sent.
+ **/
+bool skip_messages(std::vector<Entry>* entries, size_t count) {
+    if (count == 0) {
+        return true;
+    }
+    std::vector<size_t> tx_indices;
+    for (size_t i = 0; i < entries->size(); i++) {
+        if ((*entries)[i].direction == Direction::TX) {
+            tx_indices.push_back(i);
+        }
+    }
+    std::vector<Message> messages = recording::decode_messages(recording::filter(*entries, Direction::TX), Direction::TX);
+    if (messages.size() <= count) {
+        std::fprintf(stderr, "Cannot skip %zu messages, the recording has %zu dongle messages.\n", count, messages.size());
+        return false;
+    }
+    entries->erase(entries->begin(), entries->begin() + static_cast<std::ptrdiff_t>(tx_indices[messages[count].raw_offset]));
+    return true;
+}
+
+//---------------------------------------------------------------------------
+// Replay
+//---------------------------------------------------------------------------
+/**
+ * Plays the coffee maker side of a recording.
+ * Received bytes are timed relative to the dongle message they answered: A byte recorded X us after the n-th dongle
+ * byte gets handed out X us after the component wrote its n-th byte. Bytes before the first dongle byte are timed
+ * relative to the start of the replay.
+ **/
+class ReplayTransport : public serial::Transport {
+ public:
+    explicit ReplayTransport(const std::vector<Entry>& entries) {
+        size_t tx_count = 0;
+        uint64_t anchor_us = entries.empty() ? 0 : entries.front().time_us;
+        for (const Entry& entry : entries) {
+            if (entry.direction == Direction::TX) {
+                ++tx_count;
+                anchor_us = entry.time_us;
+                expected_tx_.push_back(entry);
+            } else {
+                rx_.push_back({entry.byte, tx_count, entry.time_us - anchor_us});
+            }
+        }
+        // Up front, so the heap report only counts the component:
+        delivered_.reserve(rx_.size());
+        sent_.reserve(expected_tx_.size() * 2);
+        start_us_ = virtual_clock.now_us();
+    }
+
+    [[nodiscard]] size_t read_serial(std::array<uint8_t, 4>& buffer) const override {
+        size_t count = 0;
+        while (count < buffer.size() && next_rx_ < rx_.size() && released(rx_[next_rx_])) {
+            buffer[count++] = rx_[next_rx_].byte;
+            delivered_.push_back({virtual_clock.now_us(), Direction::RX, rx_[next_rx_].byte});
+            ++next_rx_;
+        }
+        if (count > 0) {
+            last_activity_us_ = virtual_clock.now_us();
+        }
+        return count;
+    }
+
+    [[nodiscard]] bool write_serial_byte(uint8_t byte) const override {
+        sent_.push_back({virtual_clock.now_us(), Direction::TX, byte});
+        last_activity_us_ = virtual_clock.now_us();
+        return true;
+    }
+
+    void flush() const override {}
+
+    void wait_for_gap(uint32_t gap_us) const override { virtual_clock.advance(gap_us); }
+
+    [[nodiscard]] bool all_delivered() const { return next_rx_ >= rx_.size(); }
+    [[nodiscard]] size_t pending() const { return rx_.size() - next_rx_; }
+    [[nodiscard]] uint64_t last_activity_us() const { return last_activity_us_; }
+    [[nodiscard]] const std::vector<Entry>& sent() const { return sent_; }
+    [[nodiscard]] const std::vector<Entry>& delivered() const { return delivered_; }
+    [[nodiscard]] const std::vector<Entry>& expected_tx() const { return expected_tx_; }
+
+ private:
+    struct RxByte {
+        uint8_t byte;
+        // Number of dongle bytes recorded before this one and the time since the last of them.
+        size_t tx_before;
+        uint64_t offset_us;
+    };
+
+    [[nodiscard]] bool released(const RxByte& rx) const {
+        if (rx.tx_before == 0) {
+            return virtual_clock.now_us() >= start_us_ + rx.offset_us;
+        }
+        return sent_.size() >= rx.tx_before && virtual_clock.now_us() >= sent_[rx.tx_before - 1].time_us + rx.offset_us;
+    }
+
+    std::vector<RxByte> rx_{};
+    std::vector<Entry> expected_tx_{};
+    uint64_t start_us_{0};
+    mutable size_t next_rx_{0};
+    mutable std::vector<Entry> sent_{};
+    mutable std::vector<Entry> delivered_{};
+    mutable uint64_t last_activity_us_{0};
+};
+
+struct Action {
+    enum class Type { BREW, CUSTOM, PAGE } type;
+    jutta_proto::CoffeeMaker::coffee_t coffee{jutta_proto::CoffeeMaker::coffee_t::ESPRESSO};
+    uint32_t grind_ms{0};
+    uint32_t water_ms{0};
+    size_t page{0};
+};
+
+bool parse_coffee(const std::string& name, jutta_proto::CoffeeMaker::coffee_t* coffee) {
+    using coffee_t = jutta_proto::CoffeeMaker::coffee_t;
+    static const std::map<std::string, coffee_t> COFFEES{
+        {"espresso", coffee_t::ESPRESSO},
+        {"coffee", coffee_t::COFFEE},
+        {"cappuccino", coffee_t::CAPPUCCINO},
+        {"milk_foam", coffee_t::MILK_FOAM},
+        {"caffe_barista", coffee_t::CAFFE_BARISTA},
+        {"lungo_barista", coffee_t::LUNGO_BARISTA},
+        {"espresso_doppio", coffee_t::ESPRESSO_DOPPIO},
+        {"macchiato", coffee_t::MACCHIATO},
+    };
+    auto it = COFFEES.find(name);
+    if (it == COFFEES.end()) {
+        return false;
+    }
+    *coffee = it->second;
+    return true;
+}
+
+// brew_custom_coffee() keeps going as long as this is true.
+bool custom_brew_running = true;
+
+/**
+ * Starts the actions in the given order, each one once the previous one finished, and runs the coffee maker until the
+ * line stayed quiet for SETTLE_US after the last one or until limit_us.
+ **/
+template <typename TransportT>
+void run_actions(jutta_proto::CoffeeMaker& coffee_maker, const TransportT& transport, const std::vector<Action>& actions,
+                 uint64_t tick_us, uint64_t limit_us) {
+    size_t next_action = 0;
+    uint64_t idle_since_us = 0;
+    while (virtual_clock.now_us() < limit_us) {
+        JUTTA_HEAP_SCOPE();
+        if (!coffee_maker.is_locked()) {
+            if (next_action < actions.size()) {
+                const Action& action = actions[next_action++];
+                switch (action.type) {
+                    case Action::Type::BREW:
+                        coffee_maker.brew_coffee(action.coffee);
+                        break;
+                    case Action::Type::CUSTOM:
+                        coffee_maker.brew_custom_coffee(&custom_brew_running, std::chrono::milliseconds{action.grind_ms},
+                                                        std::chrono::milliseconds{action.water_ms});
+                        break;
+                    case Action::Type::PAGE:
+                        coffee_maker.switch_page(action.page);
+                        break;
+                }
+                idle_since_us = 0;
+            } else {
+                if (idle_since_us == 0) {
+                    idle_since_us = std::max(virtual_clock.now_us(), transport.last_activity_us());
+                }
+                if (transport.last_activity_us() > idle_since_us) {
+                    idle_since_us = transport.last_activity_us();
+                }
+                if (virtual_clock.now_us() - idle_since_us >= SETTLE_US) {
+                    break;
+                }
+            }
+        }
+        coffee_maker.loop();
+        virtual_clock.advance(tick_us);
+    }
+}
+
+void print_timeline(const ReplayTransport& transport) {
+    std::vector<Message> messages = recording::decode_messages(transport.sent(), Direction::TX);
+    std::vector<Message> received = recording::decode_messages(transport.delivered(), Direction::RX);
+    messages.insert(messages.end(), received.begin(), received.end());
+    std::stable_sort(messages.begin(), messages.end(),
+                     [](const Message& lhs, const Message& rhs) { return lhs.time_us < rhs.time_us; });
+    for (const Message& message : messages) {
+        std::printf("%8llu.%03llu s [%c] %s\n", static_cast<unsigned long long>(message.time_us / 1000000),
+                    static_cast<unsigned long long>((message.time_us / 1000) % 1000),
+                    message.direction == Direction::TX ? 'D' : 'C', recording::escape(message.text).c_str());
+    }
+}
+
+/**
+ * Compares the messages sent by the component to the recorded ones. Returns the number of differences.
+ **/
+size_t diff_tx(const ReplayTransport& transport) {
+    std::vector<Message> expected = recording::decode_messages(transport.expected_tx(), Direction::TX);
+    std::vector<Message> actual = recording::decode_messages(transport.sent(), Direction::TX);
+    size_t differences = 0;
+    for (size_t i = 0; i < std::max(expected.size(), actual.size()); i++) {
+        const std::string* lhs = i < expected.size() ? &expected[i].text : nullptr;
+        const std::string* rhs = i < actual.size() ? &actual[i].text : nullptr;
+        if (lhs != nullptr && rhs != nullptr && *lhs == *rhs) {
+            continue;
+        }
+        ++differences;
+        std::printf("TX message %zu differs:\n", i + 1);
+        std::printf("  - %s\n", lhs != nullptr ? recording::escape(*lhs).c_str() : "(nothing)");
+        std::printf("  + %s\n", rhs != nullptr ? recording::escape(*rhs).c_str() : "(nothing)");
+    }
+    std::printf("TX: %zu recorded, %zu sent, %zu difference(s).\n", expected.size(), actual.size(), differences);
+    return differences;
+}
+
+#ifdef USE_JUTTA_FAULT_INJECTION
+//---------------------------------------------------------------------------
+// Fault sweep
+//---------------------------------------------------------------------------
+/**
+ * Plays the coffee maker by answering every message the component sends with the reply recorded for the same message,
+ * timed relative to the end of the message. Replies of a message get used in the recorded order, the last one repeats
+ * once they are used up. Messages the recording never answered stay unanswered. Unlike the ReplayTransport it keeps
+ * answering when the component repeats a command or gives up on one.
+ **/
+class ResponderTransport : public serial::Transport {
+ public:
+    explicit ResponderTransport(const std::vector<Entry>& entries) {
+        std::string message;
+        jutta_proto::codec::frame_t frame{};
+        size_t frame_size = 0;
+        Reply* reply = nullptr;
+        uint64_t end_us = 0;
+        for (const Entry& entry : entries) {
+            if (entry.direction == Direction::RX) {
+                if (reply != nullptr) {
+                    reply->push_back({entry.time_us - end_us, entry.byte});
+                }
+                continue;
+            }
+            // The reply ends with the next dongle byte:
+            reply = nullptr;
+            frame[frame_size++] = entry.byte;
+            if (frame_size < frame.size()) {
+                continue;
+            }
+            frame_size = 0;
+            message.push_back(static_cast<char>(jutta_proto::codec::decode(frame)));
+            if (message.back() == '\n') {
+                std::vector<Reply>& replies = replies_[message];
+                replies.emplace_back();
+                reply = &replies.back();
+                end_us = entry.time_us;
+                message.clear();
+            }
+        }
+    }
+
+    [[nodiscard]] size_t read_serial(std::array<uint8_t, 4>& buffer) const override {
+        size_t count = 0;
+        while (count < buffer.size() && !scheduled_.empty() && scheduled_.front().time_us <= virtual_clock.now_us()) {
+            buffer[count++] = scheduled_.front().byte;
+            scheduled_.pop_front();
+        }
+        if (count > 0) {
+            last_activity_us_ = virtual_clock.now_us();
+        }
+        return count;
+    }
+
+    [[nodiscard]] bool write_serial_byte(uint8_t byte) const override {
+        last_activity_us_ = virtual_clock.now_us();
+        frame_[frame_size_++] = byte;
+        if (frame_size_ < frame_.size()) {
+            return true;
+        }
+        frame_size_ = 0;
+        message_.push_back(static_cast<char>(jutta_proto::codec::decode(frame_)));
+        if (message_.back() == '\n') {
+            answer(message_);
+            message_.clear();
+        }
+        return true;
+    }
+
+    void flush() const override {}
+
+    void wait_for_gap(uint32_t gap_us) const override { virtual_clock.advance(gap_us); }
+
+    [[nodiscard]] bool answers(const std::string& message) const { return replies_.count(message) > 0; }
+    [[nodiscard]] uint64_t last_activity_us() const { return last_activity_us_; }
+
+ private:
+    struct RxByte {
+        // Time since the last byte of the answered message.
+        uint64_t offset_us;
+        uint8_t byte;
+    };
+    using Reply = std::vector<RxByte>;
+
+    void answer(const std::string& message) const {
+        auto it = replies_.find(message);
+        if (it == replies_.end()) {
+            return;
+        }
+        size_t& next = next_reply_[message];
+        const Reply& reply = it->second[std::min(next, it->second.size() - 1)];
+        ++next;
+        const uint64_t now_us = virtual_clock.now_us();
+        for (const RxByte& rx : reply) {
+            uint64_t time_us = now_us + rx.offset_us;
+            if (!scheduled_.empty()) {
+                time_us = std::max(time_us, scheduled_.back().time_us);
+            }
+            scheduled_.push_back({time_us, Direction::RX, rx.byte});
+        }
+    }
+
+    std::map<std::string, std::vector<Reply>> replies_{};
+    mutable std::map<std::string, size_t> next_reply_{};
+    mutable std::deque<Entry> scheduled_{};
+    mutable jutta_proto::codec::frame_t frame_{};
+    mutable size_t frame_size_{0};
+    mutable std::string message_{};
+    mutable uint64_t last_activity_us_{0};
+};
+
+struct NamedFaultProfile {
+    std::string name;
+    serial::FaultProfile profile;
+};
+
+/**
+ * Parses "NAME[:KEY=VALUE,...]". Rates are fractions or percentages, e.g. "0.005" or "0.5%".
+ **/
+bool parse_fault_profile(const std::string& spec, NamedFaultProfile* out) {
+    size_t colon = spec.find(':');
+    out->name = spec.substr(0, colon);
+    if (out->name.empty()) {
+        return false;
+    }
+    std::string rest = colon == std::string::npos ? std::string() : spec.substr(colon + 1);
+    while (!rest.empty()) {
+        size_t comma = rest.find(',');
+        std::string item = rest.substr(0, comma);
+        rest = comma == std::string::npos ? std::string() : rest.substr(comma + 1);
+        size_t equals = item.find('=');
+        if (equals == std::string::npos) {
+            return false;
+        }
+        const std::string key = item.substr(0, equals);
+        const char* text = item.c_str() + equals + 1;
+        char* end = nullptr;
+        double value = std::strtod(text, &end);
+        if (end == text || value < 0) {
+            return false;
+        }
+        if (*end == '%') {
+            value /= 100;
+            ++end;
+        }
+        if (*end != '\0') {
+            return false;
+        }
+        serial::FaultProfile& profile = out->profile;
+        float* rate = key == "flip"      ? &profile.bit_flip_rate
+                      : key == "drop"    ? &profile.drop_rate
+                      : key == "dup"     ? &profile.duplicate_rate
+                      : key == "gap"     ? &profile.gap_rate
+                      : key == "lost_ok" ? &profile.lost_ok_rate
+                                         : nullptr;
+        if (rate != nullptr) {
+            if (value > 1) {
+                return false;
+            }
+            *rate = static_cast<float>(value);
+        } else if (key == "gap_ms") {
+            profile.gap_ms = static_cast<uint32_t>(value);
+        } else if (key == "seed") {
+            profile.seed = static_cast<uint32_t>(value);
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Totals of all runs of one profile.
+ **/
+struct SweepResult {
+    uint32_t resync_events{0};
+    uint32_t frames_lost{0};
+    uint32_t max_frames_lost{0};
+    uint32_t handshakes{0};
+    uint32_t handshake_restarts{0};
+    uint64_t handshake_total_us{0};
+    uint64_t handshake_max_us{0};
+    uint32_t brews{0};
+    uint32_t brews_failed{0};
+    serial::FaultStats injected{};
+};
+
+/**
+ * Runs the actions once with the given profile, on a fresh connection and coffee maker.
+ **/
+void run_faulted(const std::vector<Entry>& entries, const std::vector<Action>& actions, const serial::FaultProfile& profile,
+                 bool with_handshake, uint64_t tick_us, uint64_t recorded_us, SweepResult* result) {
+    esphome::uart::UARTComponent uart;
+    ResponderTransport transport(entries);
+    auto connection = std::make_unique<jutta_proto::JuttaConnection>(&uart);
+    connection->set_transport(&transport);
+    connection->enable_fault_injection(profile);
+
+    const uint64_t start_us = virtual_clock.now_us();
+    bool linked = !with_handshake;
+    if (with_handshake) {
+        jutta_proto::Handshake handshake;
+        handshake.start();
+        while (virtual_clock.now_us() - start_us < MAX_HANDSHAKE_US) {
+            if (handshake.step(connection.get()) != jutta_proto::Handshake::Result::Pending) {
+                linked = true;
+                break;
+            }
+            virtual_clock.advance(tick_us);
+        }
+        result->handshake_restarts += handshake.get_restarts();
+        if (linked) {
+            const uint64_t took_us = virtual_clock.now_us() - start_us;
+            ++result->handshakes;
+            result->handshake_total_us += took_us;
+            result->handshake_max_us = std::max(result->handshake_max_us, took_us);
+        }
+    }
+
+    jutta_proto::CoffeeMaker coffee_maker(std::move(connection));
+    if (linked) {
+        run_actions(coffee_maker, transport, actions, tick_us, virtual_clock.now_us() + recorded_us + MAX_EXTRA_US);
+        result->brews += coffee_maker.get_brew_stats().finished;
+        result->brews_failed += coffee_maker.get_brew_stats().failed;
+    } else {
+        // Without a link none of the brews would even start:
+        for (const Action& action : actions) {
+            if (action.type != Action::Type::PAGE) {
+                ++result->brews;
+                ++result->brews_failed;
+            }
+        }
+    }
+
+    const auto& link = coffee_maker.connection->get_link_stats();
+    result->resync_events += link.resync_events;
+    result->frames_lost += link.frames_lost;
+    result->max_frames_lost = std::max(result->max_frames_lost, link.max_frames_lost);
+    const serial::FaultStats& injected = coffee_maker.connection->get_fault_injector()->stats();
+    result->injected.bytes_seen += injected.bytes_seen;
+    result->injected.bits_flipped += injected.bits_flipped;
+    result->injected.bytes_dropped += injected.bytes_dropped;
+    result->injected.bytes_duplicated += injected.bytes_duplicated;
+    result->injected.gaps_stretched += injected.gaps_stretched;
+    result->injected.oks_dropped += injected.oks_dropped;
+}
+
+/**
+ * Runs every profile "runs" times and prints the frames lost before resync, the handshake time and the brew failure
+ * rate of each.
+ **/
+void run_fault_sweep(const std::vector<Entry>& entries, const std::vector<Action>& actions,
+                     const std::vector<NamedFaultProfile>& profiles, size_t runs, uint64_t tick_us, uint64_t recorded_us) {
+    const bool with_handshake = ResponderTransport(entries).answers(jutta_proto::JUTTA_KEY_EXCHANGE_T1);
+    if (!with_handshake) {
+        std::printf("The recording holds no key exchange, skipping the handshake.\n");
+    }
+    auto wall_start = std::chrono::steady_clock::now();
+    for (const NamedFaultProfile& named : profiles) {
+        SweepResult result;
+        for (size_t run = 0; run < runs; run++) {
+            serial::FaultProfile profile = named.profile;
+            profile.seed = named.profile.seed + static_cast<uint32_t>(run);
+            run_faulted(entries, actions, profile, with_handshake, tick_us, recorded_us, &result);
+        }
+
+        const serial::FaultProfile& profile = named.profile;
+        std::printf("Profile %s (flip %.2f%%, drop %.2f%%, dup %.2f%%, gap %.2f%% x %u ms, lost ok %.2f%%), %zu run(s):\n",
+                    named.name.c_str(), profile.bit_flip_rate * 100, profile.drop_rate * 100,
+                    profile.duplicate_rate * 100, profile.gap_rate * 100, profile.gap_ms, profile.lost_ok_rate * 100,
+                    runs);
+        const serial::FaultStats& injected = result.injected;
+        std::printf("  Injected: %u bit flip(s), %u dropped, %u duplicated, %u gap(s), %u ok: dropped in %u byte(s).\n",
+                    injected.bits_flipped, injected.bytes_dropped, injected.bytes_duplicated, injected.gaps_stretched,
+                    injected.oks_dropped, injected.bytes_seen);
+        std::printf("  Frames lost before resync: %.1f on average, %u at most, %u resync(s).\n",
+                    result.resync_events > 0 ? static_cast<double>(result.frames_lost) / result.resync_events : 0.0,
+                    result.max_frames_lost, result.resync_events);
+        if (with_handshake) {
+            if (result.handshakes > 0) {
+                std::printf("  Handshake: %u/%zu succeeded after %.0f ms on average, %.0f ms at most, %u restart(s).\n",
+                            result.handshakes, runs, result.handshake_total_us / 1e3 / result.handshakes,
+                            result.handshake_max_us / 1e3, result.handshake_restarts);
+            } else {
+                std::printf("  Handshake: 0/%zu succeeded, %u restart(s).\n", runs, result.handshake_restarts);
+            }
+        }
+        if (result.brews > 0) {
+            std::printf("  Brews: %u/%u failed (%.1f%%).\n", result.brews_failed, result.brews,
+                        100.0 * result.brews_failed / result.brews);
+        } else {
+            std::printf("  Brews: none started.\n");
+        }
+    }
+    double wall_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - wall_start).count();
+    std::printf("Swept %zu profile(s) in %.3f s of virtual time, took %.1f ms.\n", profiles.size(),
+                virtual_clock.now_us() / 1e6, wall_ms);
+}
+#endif
+
+void print_usage(const char* name) {
+    std::fprintf(stderr,
+                 "Usage: %s [--brew COFFEE] [--custom GRIND_MS:WATER_MS] [--page N] [--skip N] [--tick MS] [--quiet] "
+                 "[--no-timeline] [--fault NAME[:RATES] [--runs N]] FILE\n",
+                 name);
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+    std::vector<Action> actions;
+    size_t skip = 0;
+    uint64_t tick_us = 1000;
+    bool timeline = true;
+    const char* path = nullptr;
+#ifdef USE_JUTTA_FAULT_INJECTION
+    std::vector<NamedFaultProfile> profiles;
+    size_t runs = DEFAULT_FAULT_RUNS;
+#endif
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--brew" && has_value) {
+            Action action{Action::Type::BREW};
+            if (!parse_coffee(argv[++i], &action.coffee)) {
+                std::fprintf(stderr, "Unknown coffee '%s'.\n", argv[i]);
+                return 2;
+            }
+            actions.push_back(action);
+        } else if (arg == "--custom" && has_value) {
+            Action action{Action::Type::CUSTOM};
+            if (std::sscanf(argv[++i], "%u:%u", &action.grind_ms, &action.water_ms) != 2) {
+                print_usage(argv[0]);
+                return 2;
+            }
+            actions.push_back(action);
+        } else if (arg == "--page" && has_value) {
+            Action action{Action::Type::PAGE};
+            action.page = std::strtoul(argv[++i], nullptr, 10);
+            actions.push_back(action);
+        } else if (arg == "--skip" && has_value) {
+            skip = std::strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--tick" && has_value) {
+            tick_us = std::max<uint64_t>(std::strtoull(argv[++i], nullptr, 10), 1) * 1000;
+        } else if (arg == "--quiet") {
+            esphome::host::log_enabled = false;
+        } else if (arg == "--no-timeline") {
+            timeline = false;
+        } else if ((arg == "--fault" || arg == "--runs") && has_value) {
+#ifdef USE_JUTTA_FAULT_INJECTION
+            if (arg == "--runs") {
+                runs = std::max<size_t>(std::strtoul(argv[++i], nullptr, 10), 1);
+                continue;
+            }
+            NamedFaultProfile profile;
+            if (!parse_fault_profile(argv[++i], &profile)) {
+                std::fprintf(stderr, "Invalid fault profile '%s'.\n", argv[i]);
+                return 2;
+            }
+            profiles.push_back(profile);
+#else
+            std::fprintf(stderr, "%s needs a build with -DUSE_JUTTA_FAULT_INJECTION.\n", arg.c_str());
+            return 2;
+#endif
+        } else if (arg == "-h" || arg == "--help") {
+            print_usage(argv[0]);
+            return 0;
+        } else if (path == nullptr && arg[0] != '-') {
+            path = argv[i];
+        } else {
+            print_usage(argv[0]);
+            return 2;
+        }
+    }
+    if (path == nullptr) {
+        print_usage(argv[0]);
+        return 2;
+    }
+
+    std::vector<Entry> entries;
+    if (!recording::load(path, &entries) || !skip_messages(&entries, skip)) {
+        return 2;
+    }
+    if (entries.empty()) {
+        std::fprintf(stderr, "Nothing to replay.\n");
+        return 2;
+    }
+    const uint64_t recorded_us = entries.back().time_us - entries.front().time_us;
+#ifdef USE_JUTTA_FAULT_INJECTION
+    if (!profiles.empty()) {
+        run_fault_sweep(entries, actions, profiles, runs, tick_us, recorded_us);
+        return 0;
+    }
+#endif
+
+    esphome::uart::UARTComponent uart;
+    ReplayTransport transport(entries);
+    auto connection = std::make_unique<jutta_proto::JuttaConnection>(&uart);
+    connection->set_transport(&transport);
+    jutta_proto::CoffeeMaker coffee_maker(std::move(connection));
+
+    auto wall_start = std::chrono::steady_clock::now();
+    run_actions(coffee_maker, transport, actions, tick_us, recorded_us + MAX_EXTRA_US);
+    double wall_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - wall_start).count();
+
+    if (timeline) {
+        print_timeline(transport);
+    }
+    size_t differences = diff_tx(transport);
+    const auto& stats = coffee_maker.get_brew_stats();
+    std::printf("Brews: %u finished, %u failed. %zu received byte(s) never delivered.\n", stats.finished, stats.failed,
+                transport.pending());
+#ifdef USE_JUTTA_HEAP_FREE
+    std::printf("Heap: %u allocation(s) made by the component.\n", jutta_proto::heap::allocations());
+#endif
+    std::printf("Replayed %.3f s of recorded traffic in %.3f s of virtual time, took %.1f ms.\n", recorded_us / 1e6,
+                virtual_clock.now_us() / 1e6, wall_ms);
+    return differences == 0 && transport.all_delivered() ? 0 : 1;
+}
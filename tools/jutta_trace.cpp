@@ -0,0 +1,389 @@
+/**
+ * Builds and queries indexed trace files (see trace_file.hpp) for long JURA UART captures.
+ * Queries only read the chunk headers and the chunk they land in through mmap, so jumping to the 500th "FN:22" or to
+ * 3h12m into a capture of a whole day takes about as long as for a capture of a minute.
+ *
+ * Build (from the repository root):
+ *   g++ -std=c++17 -O2 -I esphome/components/jutta_proto -o jutta_trace tools/jutta_trace.cpp
+ *
+ * Usage:
+ *   jutta_trace import [--append] OUT [--raw dongle|machine] INPUT...
+ *   jutta_trace info FILE
+ *   jutta_trace find [--nth N] [--count N] [--raw] FILE PREFIX
+ *   jutta_trace seek [--count N] [--raw] FILE TIME
+ *
+ * import: Inputs are the files jutta_replay understands (traffic recorder recordings, "jutta_proto.dump_traffic" logs
+ *         and transcripts, "-" reads stdin). Inputs following "--raw dongle" or "--raw machine" are binary captures of
+ *         one UART line instead, timed at the nominal JUTTA rate. Every input gets placed one second after the end of
+ *         the previous one, the first one starts at 0. "--append" continues an existing file, which can be queried
+ *         while it is being written.
+ * find:   Prints the nth (default: first) message starting with PREFIX ("\r", "\n" and "\xNN" escapes are supported)
+ *         and the messages following it, --count in total (default: 10).
+ * seek:   Prints --count (default: 20) messages starting at TIME, e.g. "3h12m", "95s", "1.5s" or "250ms".
+ * --raw prints the raw byte runs as well.
+ *
+ * Returns 0 on success, 1 in case nothing was found and 2 on errors.
+ **/
+#include "recording.hpp"
+#include "trace_file.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace {
+using recording::Direction;
+using recording::Entry;
+using recording::Message;
+
+// Raw bytes get stored in runs of up to this many bytes, split at pauses longer than RUN_GAP_US.
+constexpr size_t MAX_RUN_SIZE = 64;
+constexpr uint64_t RUN_GAP_US = 50000;
+// Pause between two imported inputs.
+constexpr uint64_t INPUT_GAP_US = 1000000;
+
+/**
+ * A record waiting to be written, kept until raw runs and messages of both directions got merged by time.
+ **/
+struct Pending {
+    uint64_t time_us;
+    Direction direction;
+    trace_file::RecordType type;
+    std::string data;
+};
+
+std::vector<Pending> raw_runs(const std::vector<Entry>& entries) {
+    std::vector<Pending> runs;
+    const Entry* previous = nullptr;
+    for (const Entry& entry : entries) {
+        if (previous == nullptr || previous->direction != entry.direction || entry.time_us - previous->time_us > RUN_GAP_US ||
+            runs.back().data.size() >= MAX_RUN_SIZE) {
+            runs.push_back({entry.time_us, entry.direction, trace_file::RecordType::RAW, std::string()});
+        }
+        runs.back().data.push_back(static_cast<char>(entry.byte));
+        previous = &entry;
+    }
+    return runs;
+}
+
+/**
+ * Writes the raw bytes and decoded messages of the given entries, shifted so the first one lands at start_us.
+ **/
+void write_entries(trace_file::Writer* writer, std::vector<Entry> entries, uint64_t start_us) {
+    if (entries.empty()) {
+        return;
+    }
+    const uint64_t first_us = entries.front().time_us;
+    for (Entry& entry : entries) {
+        entry.time_us = entry.time_us - first_us + start_us;
+    }
+    std::vector<Pending> records = raw_runs(entries);
+    for (Direction direction : {Direction::TX, Direction::RX}) {
+        for (Message& message : recording::decode_messages(recording::filter(entries, direction), direction)) {
+            records.push_back({message.time_us, direction, trace_file::RecordType::MESSAGE, std::move(message.text)});
+        }
+    }
+    // Messages come first at the same time, so printing from a message with --raw includes the run of its first byte:
+    std::stable_sort(records.begin(), records.end(), [](const Pending& lhs, const Pending& rhs) {
+        return lhs.time_us < rhs.time_us || (lhs.time_us == rhs.time_us && lhs.type > rhs.type);
+    });
+    for (const Pending& record : records) {
+        if (record.type == trace_file::RecordType::MESSAGE) {
+            writer->add_message(record.time_us, record.direction, record.data);
+        } else {
+            writer->add_raw(record.time_us, record.direction, reinterpret_cast<const uint8_t*>(record.data.data()),
+                            record.data.size());
+        }
+    }
+}
+
+/**
+ * Imports a binary capture of one line. Skips the Entry list, these can be large.
+ **/
+bool write_raw_capture(trace_file::Writer* writer, const char* path, Direction direction, uint64_t start_us) {
+    std::string data;
+    if (!recording::read_file(path, &data)) {
+        std::fprintf(stderr, "Failed to read '%s'.\n", path);
+        return false;
+    }
+    const auto* bytes = reinterpret_cast<const uint8_t*>(data.data());
+    auto time_of = [start_us](size_t offset) { return start_us + (offset * recording::ENCODED_BYTE_US); };
+
+    size_t written = 0;
+    auto write_runs_until = [&](size_t end) {
+        for (; written < end; written += MAX_RUN_SIZE) {
+            writer->add_raw(time_of(written), direction, bytes + written, std::min(MAX_RUN_SIZE, data.size() - written));
+        }
+    };
+    std::string message;
+    size_t message_offset = 0;
+    jutta_proto::codec::decode_stream(bytes, data.size(), [&](size_t offset, uint8_t byte) {
+        if (message.empty()) {
+            message_offset = offset;
+        }
+        message.push_back(static_cast<char>(byte));
+        if (byte == '\n') {
+            write_runs_until(message_offset);
+            writer->add_message(time_of(message_offset), direction, message);
+            message.clear();
+        }
+    });
+    if (!message.empty()) {
+        write_runs_until(message_offset);
+        writer->add_message(time_of(message_offset), direction, message);
+    }
+    write_runs_until(data.size());
+    return true;
+}
+
+int run_import(int argc, char** argv) {
+    bool append = false;
+    const char* out = nullptr;
+    int i = 0;
+    for (; i < argc && out == nullptr; i++) {
+        if (std::strcmp(argv[i], "--append") == 0) {
+            append = true;
+        } else {
+            out = argv[i];
+        }
+    }
+    if (out == nullptr || i >= argc) {
+        std::fprintf(stderr, "Expected an output file and at least one input.\n");
+        return 2;
+    }
+
+    trace_file::Writer writer;
+    std::string error;
+    if (!writer.open(out, append, &error)) {
+        std::fprintf(stderr, "%s\n", error.c_str());
+        return 2;
+    }
+    bool raw = false;
+    Direction raw_direction = Direction::RX;
+    bool empty = writer.messages() == 0 && writer.end_time_us() == 0;
+    for (; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--raw" && i + 1 < argc) {
+            std::string direction = argv[++i];
+            if (direction != "dongle" && direction != "machine") {
+                std::fprintf(stderr, "Unknown direction '%s'.\n", direction.c_str());
+                return 2;
+            }
+            raw = true;
+            raw_direction = direction == "dongle" ? Direction::TX : Direction::RX;
+            continue;
+        }
+        uint64_t start_us = empty ? 0 : writer.end_time_us() + INPUT_GAP_US;
+        if (raw) {
+            if (!write_raw_capture(&writer, argv[i], raw_direction, start_us)) {
+                return 2;
+            }
+        } else {
+            std::vector<Entry> entries;
+            if (!recording::load(argv[i], &entries)) {
+                return 2;
+            }
+            write_entries(&writer, std::move(entries), start_us);
+        }
+        empty = false;
+        writer.flush();
+    }
+    uint64_t messages = writer.messages();
+    if (!writer.close()) {
+        std::fprintf(stderr, "Failed to write '%s'.\n", out);
+        return 2;
+    }
+    std::printf("%llu messages in '%s'.\n", static_cast<unsigned long long>(messages), out);
+    return 0;
+}
+
+/**
+ * Parses "3h12m", "95s", "1.5s", "250ms" or "1500us". A plain number is in seconds.
+ **/
+bool parse_time(const char* text, uint64_t* time_us) {
+    double total = 0;
+    const char* pos = text;
+    while (*pos != '\0') {
+        char* end = nullptr;
+        double value = std::strtod(pos, &end);
+        if (end == pos || value < 0) {
+            return false;
+        }
+        pos = end;
+        if (std::strncmp(pos, "ms", 2) == 0) {
+            total += value * 1e3;
+            pos += 2;
+        } else if (std::strncmp(pos, "us", 2) == 0) {
+            total += value;
+            pos += 2;
+        } else if (*pos == 'h') {
+            total += value * 3600e6;
+            ++pos;
+        } else if (*pos == 'm') {
+            total += value * 60e6;
+            ++pos;
+        } else if (*pos == 's' || *pos == '\0') {
+            total += value * 1e6;
+            pos += *pos == 's' ? 1 : 0;
+        } else {
+            return false;
+        }
+    }
+    *time_us = static_cast<uint64_t>(total);
+    return pos != text;
+}
+
+void print_record(const trace_file::Record& record) {
+    char direction = record.direction == Direction::TX ? 'D' : 'C';
+    if (record.type == trace_file::RecordType::MESSAGE) {
+        std::printf("%8llu.%03llu s [%c] #%llu %s\n", static_cast<unsigned long long>(record.time_us / 1000000),
+                    static_cast<unsigned long long>((record.time_us / 1000) % 1000), direction,
+                    static_cast<unsigned long long>(record.message_index + 1), recording::escape(record.text()).c_str());
+        return;
+    }
+    std::string hex;
+    for (size_t i = 0; i < record.size; i++) {
+        char byte[4];
+        std::snprintf(byte, sizeof(byte), " %02X", record.data[i]);
+        hex += byte;
+    }
+    std::printf("%8llu.%03llu s  %c  raw%s\n", static_cast<unsigned long long>(record.time_us / 1000000),
+                static_cast<unsigned long long>((record.time_us / 1000) % 1000), direction, hex.c_str());
+}
+
+/**
+ * Prints up to count messages (and raw runs if requested), starting at the first record of the given chunk that
+ * is_start(record) returns true for.
+ **/
+template <typename Predicate>
+size_t print_from(const trace_file::Reader& reader, size_t chunk, Predicate is_start, size_t count, bool raw) {
+    size_t printed = 0;
+    bool started = false;
+    for (; chunk < reader.chunk_count() && printed < count; chunk++) {
+        reader.for_each_record(chunk, [&](const trace_file::Record& record) {
+            started = started || is_start(record);
+            if (!started) {
+                return true;
+            }
+            bool is_message = record.type == trace_file::RecordType::MESSAGE;
+            if (is_message || raw) {
+                print_record(record);
+            }
+            printed += is_message ? 1 : 0;
+            return printed < count;
+        });
+    }
+    return printed;
+}
+
+int run_info(const trace_file::Reader& reader) {
+    uint64_t records = 0;
+    std::map<std::string, uint64_t> keys;
+    for (size_t i = 0; i < reader.chunk_count(); i++) {
+        const trace_file::Reader::Chunk& chunk = reader.chunk(i);
+        records += chunk.header->record_count;
+        for (uint32_t k = 0; k < chunk.header->key_count; k++) {
+            const auto& key = chunk.keys[k].key;
+            keys[std::string(key.data(), std::find(key.begin(), key.end(), '\0'))] += chunk.keys[k].count;
+        }
+    }
+    std::printf("%zu bytes, %zu chunks (%s), %llu records, %llu messages, %.3f s to %.3f s\n", reader.file_size(),
+                reader.chunk_count(), reader.indexed() ? "indexed" : "no index, still being written?",
+                static_cast<unsigned long long>(records), static_cast<unsigned long long>(reader.message_count()),
+                reader.min_time_us() / 1e6, reader.max_time_us() / 1e6);
+    std::vector<std::pair<std::string, uint64_t>> sorted(keys.begin(), keys.end());
+    std::stable_sort(sorted.begin(), sorted.end(), [](const auto& lhs, const auto& rhs) { return lhs.second > rhs.second; });
+    for (const auto& key : sorted) {
+        std::printf("%10llu  %s\n", static_cast<unsigned long long>(key.second), recording::escape(key.first).c_str());
+    }
+    return 0;
+}
+
+void print_usage(const char* name) {
+    std::fprintf(stderr,
+                 "Usage: %s import [--append] OUT [--raw dongle|machine] INPUT...\n"
+                 "       %s info FILE\n"
+                 "       %s find [--nth N] [--count N] [--raw] FILE PREFIX\n"
+                 "       %s seek [--count N] [--raw] FILE TIME\n",
+                 name, name, name, name);
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        print_usage(argv[0]);
+        return 2;
+    }
+    std::string command = argv[1];
+    if (command == "import") {
+        return run_import(argc - 2, argv + 2);
+    }
+
+    uint64_t nth = 1;
+    size_t count = command == "find" ? 10 : 20;
+    bool raw = false;
+    std::vector<const char*> positional;
+    for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--nth" && has_value) {
+            nth = std::max<uint64_t>(std::strtoull(argv[++i], nullptr, 10), 1);
+        } else if (arg == "--count" && has_value) {
+            count = std::strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--raw") {
+            raw = true;
+        } else {
+            positional.push_back(argv[i]);
+        }
+    }
+    size_t expected = command == "info" ? 1 : 2;
+    if ((command != "info" && command != "find" && command != "seek") || positional.size() != expected) {
+        print_usage(argv[0]);
+        return 2;
+    }
+
+    trace_file::Reader reader;
+    std::string error;
+    if (!reader.open(positional[0], &error)) {
+        std::fprintf(stderr, "%s\n", error.c_str());
+        return 2;
+    }
+    if (command == "info") {
+        return run_info(reader);
+    }
+
+    if (command == "find") {
+        std::string prefix;
+        if (!recording::parse_escaped(positional[1], &prefix) || prefix.empty()) {
+            std::fprintf(stderr, "Invalid prefix '%s'.\n", positional[1]);
+            return 2;
+        }
+        trace_file::Record record{};
+        size_t chunk = 0;
+        if (!reader.find_message(prefix, nth, &record, &chunk)) {
+            std::fprintf(stderr, "Found %llu message(s) starting with '%s'.\n",
+                         static_cast<unsigned long long>(reader.count_messages(prefix)), positional[1]);
+            return 1;
+        }
+        print_from(
+            reader, chunk,
+            [&record](const trace_file::Record& other) {
+                return other.type == trace_file::RecordType::MESSAGE && other.message_index == record.message_index;
+            },
+            count, raw);
+        return 0;
+    }
+
+    uint64_t time_us = 0;
+    if (!parse_time(positional[1], &time_us)) {
+        std::fprintf(stderr, "Invalid time '%s'.\n", positional[1]);
+        return 2;
+    }
+    auto is_start = [time_us](const trace_file::Record& record) { return record.time_us >= time_us; };
+    return print_from(reader, reader.find_chunk(time_us), is_start, count, raw) > 0 ? 0 : 1;
+}
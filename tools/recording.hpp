@@ -0,0 +1,338 @@
+#pragma once
+
+/**
+ * Loading of recorded JURA UART traffic for the host tools.
+ * Supports the recordings of the traffic recorder of the ESPHome component, either binary ("JTR" header) or the log
+ * output of "jutta_proto.dump_traffic", and transcripts. See tools/jutta_replay.cpp for the transcript format.
+ **/
+#include "jutta_codec.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace recording {
+// Same values as jutta_proto::trace::Direction. TX is the dongle (us), RX the coffee maker.
+enum class Direction : uint8_t { RX = 0, TX = 1 };
+
+// Transcripts carry no timing. One encoded byte every 8 ms plus 10 bit at 9600 baud:
+constexpr uint64_t ENCODED_BYTE_US = 8000 + 1042;
+constexpr uint64_t DEFAULT_MESSAGE_PAUSE_US = 20000;
+
+/**
+ * A single raw (encoded) byte on the line.
+ **/
+struct Entry {
+    uint64_t time_us;
+    Direction direction;
+    uint8_t byte;
+};
+
+/**
+ * Reads the whole file, "-" reads stdin.
+ **/
+inline bool read_file(const char* path, std::string* content) {
+    if (std::strcmp(path, "-") == 0) {
+        content->assign(std::istreambuf_iterator<char>(std::cin), std::istreambuf_iterator<char>());
+        return true;
+    }
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+    content->assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return true;
+}
+
+inline int base64_value(char c) {
+    if (c >= 'A' && c <= 'Z') {
+        return c - 'A';
+    }
+    if (c >= 'a' && c <= 'z') {
+        return c - 'a' + 26;
+    }
+    if (c >= '0' && c <= '9') {
+        return c - '0' + 52;
+    }
+    if (c == '+') {
+        return 62;
+    }
+    if (c == '/') {
+        return 63;
+    }
+    return -1;
+}
+
+inline bool base64_decode(const std::string& text, std::string* out) {
+    uint32_t bits = 0;
+    int count = 0;
+    for (char c : text) {
+        if (c == '=') {
+            break;
+        }
+        int value = base64_value(c);
+        if (value < 0) {
+            return false;
+        }
+        bits = (bits << 6) | static_cast<uint32_t>(value);
+        count += 6;
+        if (count >= 8) {
+            count -= 8;
+            out->push_back(static_cast<char>((bits >> count) & 0xFF));
+        }
+    }
+    return true;
+}
+
+inline uint32_t read_u32(const std::string& data, size_t pos) {
+    uint32_t value = 0;
+    for (size_t i = 0; i < 4; i++) {
+        value |= static_cast<uint32_t>(static_cast<uint8_t>(data[pos + i])) << (8 * i);
+    }
+    return value;
+}
+
+/**
+ * Parses the binary format written by jutta_proto::TrafficRecorder.
+ **/
+inline bool parse_recording(const std::string& data, std::vector<Entry>* entries) {
+    constexpr size_t HEADER_SIZE = 16;
+    if (data.size() < HEADER_SIZE || data.compare(0, 3, "JTR") != 0 || data[3] != 1) {
+        std::fprintf(stderr, "Not a version 1 traffic recording.\n");
+        return false;
+    }
+    uint64_t time_us = read_u32(data, 4);
+    size_t pos = HEADER_SIZE;
+    while (pos < data.size()) {
+        uint64_t value = 0;
+        size_t shift = 0;
+        uint8_t part = 0;
+        do {
+            if (pos >= data.size() || shift > 35) {
+                std::fprintf(stderr, "Truncated traffic recording.\n");
+                return false;
+            }
+            part = static_cast<uint8_t>(data[pos++]);
+            value |= static_cast<uint64_t>(part & 0x7F) << shift;
+            shift += 7;
+        } while ((part & 0x80) != 0);
+        if (pos >= data.size()) {
+            std::fprintf(stderr, "Truncated traffic recording.\n");
+            return false;
+        }
+        time_us += value >> 1;
+        entries->push_back({time_us, (value & 1) != 0 ? Direction::TX : Direction::RX, static_cast<uint8_t>(data[pos++])});
+    }
+    if (entries->size() != read_u32(data, 8)) {
+        std::fprintf(stderr, "Warning: recording holds %zu entries, header says %u.\n", entries->size(), read_u32(data, 8));
+    }
+    return true;
+}
+
+/**
+ * Collects the base64 payload of "Traffic i/n: ..." log lines. Returns false in case there are none.
+ **/
+inline bool parse_traffic_log(const std::string& text, std::string* data) {
+    std::istringstream lines(text);
+    std::string line;
+    bool found = false;
+    while (std::getline(lines, line)) {
+        size_t pos = line.find("Traffic ");
+        if (pos == std::string::npos) {
+            continue;
+        }
+        size_t colon = line.find(": ", pos);
+        size_t slash = line.find('/', pos);
+        if (colon == std::string::npos || slash == std::string::npos || slash > colon) {
+            continue;
+        }
+        std::string payload = line.substr(colon + 2);
+        while (!payload.empty() && (payload.back() == '\r' || payload.back() == ' ')) {
+            payload.pop_back();
+        }
+        // Strip the color reset ESPHome appends to log lines:
+        size_t escape = payload.find('\x1b');
+        if (escape != std::string::npos) {
+            payload.resize(escape);
+        }
+        if (!base64_decode(payload, data)) {
+            std::fprintf(stderr, "Invalid base64 in line: %s\n", line.c_str());
+            return false;
+        }
+        found = true;
+    }
+    return found;
+}
+
+inline bool parse_escaped(const std::string& text, std::string* out) {
+    for (size_t i = 0; i < text.size(); i++) {
+        if (text[i] != '\\' || i + 1 >= text.size()) {
+            out->push_back(text[i]);
+            continue;
+        }
+        char c = text[++i];
+        if (c == 'r') {
+            out->push_back('\r');
+        } else if (c == 'n') {
+            out->push_back('\n');
+        } else if (c == '\\') {
+            out->push_back('\\');
+        } else if (c == 'x' && i + 2 < text.size()) {
+            out->push_back(static_cast<char>(std::strtoul(text.substr(i + 1, 2).c_str(), nullptr, 16)));
+            i += 2;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Parses a transcript and encodes it at the nominal JUTTA rate.
+ **/
+inline bool parse_transcript(const std::string& text, std::vector<Entry>* entries) {
+    std::istringstream lines(text);
+    std::string line;
+    uint64_t time_us = 0;
+    size_t line_number = 0;
+    while (std::getline(lines, line)) {
+        ++line_number;
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        Direction direction = Direction::TX;
+        if (line.compare(0, 3, "TX ") == 0) {
+            direction = Direction::TX;
+        } else if (line.compare(0, 3, "RX ") == 0) {
+            direction = Direction::RX;
+        } else {
+            std::fprintf(stderr, "Line %zu: expected \"TX\" or \"RX\".\n", line_number);
+            return false;
+        }
+        std::string rest = line.substr(3);
+        uint64_t pause_us = DEFAULT_MESSAGE_PAUSE_US;
+        if (!rest.empty() && rest[0] == '+') {
+            char* end = nullptr;
+            pause_us = std::strtoull(rest.c_str() + 1, &end, 10) * 1000;
+            if (std::strncmp(end, "ms ", 3) != 0) {
+                std::fprintf(stderr, "Line %zu: expected \"+<N>ms \".\n", line_number);
+                return false;
+            }
+            rest = std::string(end + 3);
+        }
+        std::string message;
+        if (!parse_escaped(rest, &message)) {
+            std::fprintf(stderr, "Line %zu: invalid escape sequence.\n", line_number);
+            return false;
+        }
+        message += "\r\n";
+        time_us += pause_us;
+        for (char c : message) {
+            for (uint8_t raw : jutta_proto::codec::encode(static_cast<uint8_t>(c))) {
+                entries->push_back({time_us, direction, raw});
+                time_us += ENCODED_BYTE_US;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * Loads a recording, a traffic dump log or a transcript. The format gets detected from the content.
+ **/
+inline bool load(const char* path, std::vector<Entry>* entries) {
+    std::string content;
+    if (!read_file(path, &content)) {
+        std::fprintf(stderr, "Failed to read '%s'.\n", path);
+        return false;
+    }
+    if (content.compare(0, 3, "JTR") == 0) {
+        return parse_recording(content, entries);
+    }
+    std::string recording;
+    if (parse_traffic_log(content, &recording)) {
+        return parse_recording(recording, entries);
+    }
+    return parse_transcript(content, entries);
+}
+
+/**
+ * A decoded message, including its "\r\n".
+ **/
+struct Message {
+    uint64_t time_us;
+    Direction direction;
+    std::string text;
+    // Index of the raw byte the message starts at, within the raw bytes of its direction.
+    size_t raw_offset;
+};
+
+/**
+ * Decodes raw bytes of one direction the same way the component does and splits them into "\r\n" terminated messages.
+ **/
+inline std::vector<Message> decode_messages(const std::vector<Entry>& raw, Direction direction) {
+    std::vector<uint8_t> data;
+    data.reserve(raw.size());
+    for (const Entry& entry : raw) {
+        data.push_back(entry.byte);
+    }
+    std::vector<Message> messages;
+    bool open = false;
+    jutta_proto::codec::decode_stream(data.data(), data.size(), [&](size_t offset, uint8_t byte) {
+        if (!open) {
+            messages.push_back({raw[offset].time_us, direction, std::string(), offset});
+            open = true;
+        }
+        messages.back().text.push_back(static_cast<char>(byte));
+        if (byte == '\n') {
+            open = false;
+        }
+    });
+    return messages;
+}
+
+/**
+ * Escapes control characters for printing, e.g. "ok:\\r\\n".
+ **/
+inline std::string escape(const std::string& text) {
+    std::string escaped;
+    for (char c : text) {
+        auto byte = static_cast<uint8_t>(c);
+        if (c == '\r') {
+            escaped += "\\r";
+        } else if (c == '\n') {
+            escaped += "\\n";
+        } else if (c == '\\') {
+            escaped += "\\\\";
+        } else if (byte >= 0x20 && byte < 0x7F) {
+            escaped.push_back(c);
+        } else {
+            char hex[5];
+            std::snprintf(hex, sizeof(hex), "\\x%02x", byte);
+            escaped += hex;
+        }
+    }
+    return escaped;
+}
+
+/**
+ * Returns the entries of the given direction only.
+ **/
+inline std::vector<Entry> filter(const std::vector<Entry>& entries, Direction direction) {
+    std::vector<Entry> result;
+    std::copy_if(entries.begin(), entries.end(), std::back_inserter(result),
+                 [direction](const Entry& entry) { return entry.direction == direction; });
+    return result;
+}
+}  // namespace recording
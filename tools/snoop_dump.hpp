@@ -0,0 +1,83 @@
+#pragma once
+
+/**
+ * Parsing of the text dumps in "protocol_snoops/" for the host tools.
+ * Lines like "0 1 0 1 0 1 0 0 -> 84 54 T" hold one decoded byte each, lines like "22B 00100110 01010010 ..." hold a
+ * whole decoded message ("&...\r\n" for the obfuscated ones). Neither holds the encoded bytes on the wire.
+ * "Dongle:" and "Coffee-Maker:" headers select the direction of the following bytes.
+ **/
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace snoop_dump {
+inline bool is_bit(char c) { return c == '0' || c == '1'; }
+
+/**
+ * Parses "0 1 0 1 0 1 0 0 -> ..." into a byte.
+ **/
+inline bool parse_bit_columns(const char* begin, const char* end, uint8_t* byte) {
+    const char* arrow = static_cast<const char*>(memmem(begin, static_cast<size_t>(end - begin), "->", 2));
+    if (arrow == nullptr) {
+        return false;
+    }
+    uint8_t value = 0;
+    size_t bits = 0;
+    for (const char* c = begin; c < arrow; c++) {
+        if (is_bit(*c)) {
+            value = static_cast<uint8_t>((value << 1) | (*c - '0'));
+            ++bits;
+        } else if (*c != ' ' && *c != '\t') {
+            return false;
+        }
+    }
+    if (bits != 8) {
+        return false;
+    }
+    *byte = value;
+    return true;
+}
+
+/**
+ * Parses "22B     00100110 01010010 ..." and calls on_byte for each byte.
+ **/
+template <typename Callback>
+bool parse_byte_row(const char* begin, const char* end, Callback&& on_byte) {
+    const char* c = begin;
+    if (c == end || *c < '0' || *c > '9') {
+        return false;
+    }
+    while (c < end && *c >= '0' && *c <= '9') {
+        c++;
+    }
+    if (c == end || *c != 'B') {
+        return false;
+    }
+    c++;
+    while (c < end) {
+        while (c < end && (*c == ' ' || *c == '\t' || *c == '\r')) {
+            c++;
+        }
+        if (c == end) {
+            break;
+        }
+        if (end - c < 8) {
+            return true;
+        }
+        uint8_t value = 0;
+        for (size_t i = 0; i < 8; i++) {
+            if (!is_bit(c[i])) {
+                return true;
+            }
+            value = static_cast<uint8_t>((value << 1) | (c[i] - '0'));
+        }
+        on_byte(value);
+        c += 8;
+    }
+    return true;
+}
+
+inline bool contains(const char* begin, const char* end, const char* needle) {
+    return memmem(begin, static_cast<size_t>(end - begin), needle, std::strlen(needle)) != nullptr;
+}
+}  // namespace snoop_dump
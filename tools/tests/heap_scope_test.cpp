@@ -0,0 +1,71 @@
+/**
+ * Checks that a heap::Scope only counts the allocations of its own thread, like the protocol task on the device while
+ * the main loop keeps allocating. Built and run by tools/host_tests.sh.
+ **/
+#include "heap_report.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <new>
+#include <thread>
+
+namespace {
+// Calls of ::operator new cannot be elided by the compiler, unlike new expressions.
+void allocate(int count) {
+    for (int i = 0; i < count; i++) {
+        ::operator delete(::operator new(16));
+    }
+}
+
+int failures = 0;
+
+void expect(const char* what, uint32_t actual, uint32_t expected) {
+    if (actual != expected) {
+        std::printf("%s: %u allocation(s) counted, expected %u\n", what, actual, expected);
+        ++failures;
+    }
+}
+}  // namespace
+
+int main() {
+    using jutta_proto::heap::allocations;
+    std::atomic<int> stage{0};
+    // Created up front, starting a thread allocates on the creating one:
+    std::thread other([&stage]() {
+        while (stage.load() != 1) {
+        }
+        allocate(100);
+        stage.store(2);
+        while (stage.load() != 3) {
+        }
+        {
+            jutta_proto::heap::Scope scope;
+            allocate(5);
+        }
+        stage.store(4);
+    });
+
+    uint32_t before = allocations();
+    {
+        jutta_proto::heap::Scope scope;
+        stage.store(1);
+        while (stage.load() != 2) {
+        }
+        expect("Other thread while a Scope is open", allocations() - before, 0);
+        allocate(3);
+        expect("Own thread", allocations() - before, 3);
+    }
+
+    before = allocations();
+    allocate(10);
+    expect("Without a Scope", allocations() - before, 0);
+    stage.store(3);
+    while (stage.load() != 4) {
+    }
+    expect("Scope on the other thread", allocations() - before, 5);
+    other.join();
+
+    std::printf("%s heap scope\n", failures == 0 ? "PASS" : "FAIL");
+    return failures == 0 ? 0 : 1;
+}
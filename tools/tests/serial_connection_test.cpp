@@ -0,0 +1,77 @@
+/**
+ * Checks that SerialConnection hands on every byte the UART received, although read_array() of the ESPHome UART only
+ * returns whether it got all requested bytes. Built and run by tools/host_tests.sh.
+ **/
+#include "jutta_codec.hpp"
+#include "jutta_connection.hpp"
+#include "serial_connection.hpp"
+
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+namespace {
+// The byte gaps busy-wait on micros(), so time moves on with every look at the clock.
+uint64_t now_us = 0;
+}  // namespace
+
+namespace esphome {
+uint32_t millis() { return static_cast<uint32_t>(now_us / 1000); }
+uint32_t micros() { return static_cast<uint32_t>(now_us += 100); }
+}  // namespace esphome
+
+namespace {
+int failures = 0;
+
+void expect(const char* what, size_t actual, size_t expected) {
+    if (actual != expected) {
+        std::printf("%s: %zu, expected %zu\n", what, actual, expected);
+        ++failures;
+    }
+}
+
+void receive_encoded(esphome::uart::UARTComponent* uart, const std::string& text) {
+    for (char c : text) {
+        const auto frame = jutta_proto::codec::encode(static_cast<uint8_t>(c));
+        uart->receive(frame.data(), frame.size());
+    }
+}
+}  // namespace
+
+int main() {
+    esphome::host::log_enabled = false;
+
+    // Fewer bytes than the buffer holds are there, then none:
+    esphome::uart::UARTComponent uart;
+    serial::SerialConnection serial(&uart);
+    const std::array<uint8_t, 6> received{1, 2, 3, 4, 5, 6};
+    uart.receive(received.data(), received.size());
+    std::array<uint8_t, 4> buffer{};
+    expect("bytes of the first read", serial.read_serial(buffer), 4);
+    expect("first byte of the first read", buffer[0], 1);
+    expect("last byte of the first read", buffer[3], 4);
+    expect("bytes of the second read", serial.read_serial(buffer), 2);
+    expect("first byte of the second read", buffer[0], 5);
+    expect("bytes of the third read", serial.read_serial(buffer), 0);
+
+    // Every encoded byte has to make it into a decoded one:
+    esphome::uart::UARTComponent machine;
+    jutta_proto::JuttaConnection connection(&machine);
+    receive_encoded(&machine, "ok:\r\n");
+    std::string decoded;
+    uint8_t byte = 0;
+    while (connection.read_decoded(&byte)) {
+        decoded.push_back(static_cast<char>(byte));
+    }
+    expect("decoded bytes", decoded.size(), 5);
+    if (decoded != "ok:\r\n") {
+        std::printf("decoded \"%s\" instead of \"ok:\\r\\n\"\n", decoded.c_str());
+        ++failures;
+    }
+
+    if (failures == 0) {
+        std::printf("PASS serial connection\n");
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,554 @@
+#pragma once
+
+/**
+ * Indexed container for long JURA UART captures ("JTC" files), used by tools/jutta_trace.cpp.
+ *
+ * A file holds raw (encoded) byte runs and decoded messages of both directions, grouped into chunks of up to 64 KiB.
+ * Every chunk starts with a header holding its time range, the index of its first message and how many messages of each
+ * "key" (the first 8 characters of a message, e.g. "FN:22" or "ty:EF532") it contains. Searching for the n-th message
+ * with a given prefix or for a point in time therefore only touches the chunk headers and a single chunk payload.
+ *
+ * Layout (all integers little endian):
+ *   FileHeader
+ *   Chunk:  ChunkHeader, KeyCount[key_count], payload[payload_size]
+ *   ...
+ *   Index:  IndexEntry[chunk_count], Footer      (only present once the writer got closed)
+ *
+ * Chunks are appended as a whole, so a file can be read while it is still being written. Without an index the reader
+ * walks the chunk headers instead. Appending to a closed file drops its index and writes a new one on close.
+ *
+ * Payload records:
+ *   uint8 flags (bit 0: 0 raw bytes, 1 message; bit 7: 0 coffee maker, 1 dongle)
+ *   zigzag varint: time in us relative to the previous record of the chunk (the chunk's first_time_us for the first)
+ *   varint: length
+ *   uint8[length]
+ **/
+#include "recording.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace trace_file {
+using recording::Direction;
+
+enum class RecordType : uint8_t { RAW = 0, MESSAGE = 1 };
+
+constexpr size_t KEY_SIZE = 8;
+constexpr uint32_t FORMAT_VERSION = 1;
+constexpr size_t MAX_CHUNK_PAYLOAD = 64 * 1024;
+
+struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+};
+
+struct ChunkHeader {
+    char magic[4];
+    uint32_t payload_size;
+    uint32_t record_count;
+    uint32_t key_count;
+    // Base of the first record's time delta, and the time range of all records in the chunk.
+    uint64_t first_time_us;
+    uint64_t min_time_us;
+    uint64_t max_time_us;
+    // Index of the first message in the file and the number of messages in this chunk.
+    uint64_t first_message;
+    uint32_t message_count;
+    uint32_t reserved;
+};
+
+struct KeyCount {
+    std::array<char, KEY_SIZE> key;
+    uint32_t count;
+};
+
+struct IndexEntry {
+    uint64_t offset;
+    uint64_t min_time_us;
+    uint64_t max_time_us;
+    uint64_t first_message;
+};
+
+struct Footer {
+    uint64_t index_offset;
+    uint32_t chunk_count;
+    char magic[4];
+};
+
+static_assert(sizeof(FileHeader) == 16, "Unexpected padding.");
+static_assert(sizeof(ChunkHeader) == 56, "Unexpected padding.");
+static_assert(sizeof(KeyCount) == 12, "Unexpected padding.");
+static_assert(sizeof(IndexEntry) == 32, "Unexpected padding.");
+static_assert(sizeof(Footer) == 16, "Unexpected padding.");
+
+constexpr char FILE_MAGIC[8] = {'J', 'T', 'C', '\0', '\r', '\n', 0x1A, '\n'};
+constexpr char CHUNK_MAGIC[4] = {'J', 'T', 'C', 'K'};
+constexpr char INDEX_MAGIC[4] = {'J', 'T', 'I', 'X'};
+
+/**
+ * The key of a message: Everything before the "\r\n", cut off after KEY_SIZE characters.
+ **/
+inline std::array<char, KEY_SIZE> make_key(const char* text, size_t size) {
+    std::array<char, KEY_SIZE> key{};
+    for (size_t i = 0; i < size && i < KEY_SIZE && text[i] != '\r' && text[i] != '\n'; i++) {
+        key[i] = text[i];
+    }
+    return key;
+}
+
+inline void put_varint(std::vector<uint8_t>* out, uint64_t value) {
+    do {
+        uint8_t part = value & 0x7F;
+        value >>= 7;
+        out->push_back(value != 0 ? (part | 0x80) : part);
+    } while (value != 0);
+}
+
+inline bool get_varint(const uint8_t** pos, const uint8_t* end, uint64_t* value) {
+    *value = 0;
+    for (size_t shift = 0; *pos < end && shift < 64; shift += 7) {
+        uint8_t part = *(*pos)++;
+        *value |= static_cast<uint64_t>(part & 0x7F) << shift;
+        if ((part & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * A record as seen by the reader. data points into the mapped file.
+ **/
+struct Record {
+    uint64_t time_us;
+    Direction direction;
+    RecordType type;
+    const uint8_t* data;
+    size_t size;
+    // Index of the message in the file, only valid for messages.
+    uint64_t message_index;
+
+    [[nodiscard]] std::string text() const { return std::string(reinterpret_cast<const char*>(data), size); }
+};
+
+//---------------------------------------------------------------------------
+// Writer
+//---------------------------------------------------------------------------
+class Writer {
+ public:
+    Writer() = default;
+    Writer(const Writer&) = delete;
+    Writer& operator=(const Writer&) = delete;
+    ~Writer() { close(); }
+
+    /**
+     * Creates a new file or, with append set, continues an existing one.
+     **/
+    bool open(const char* path, bool append, std::string* error) {
+        file_ = std::fopen(path, append ? "r+b" : "w+b");
+        if (file_ == nullptr && append) {
+            file_ = std::fopen(path, "w+b");
+        }
+        if (file_ == nullptr) {
+            *error = std::string("Failed to open '") + path + "'.";
+            return false;
+        }
+        std::fseek(file_, 0, SEEK_END);
+        long size = std::ftell(file_);
+        if (size <= 0) {
+            FileHeader header{};
+            std::memcpy(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC));
+            header.version = FORMAT_VERSION;
+            return std::fwrite(&header, sizeof(header), 1, file_) == 1;
+        }
+        return load_existing(static_cast<uint64_t>(size), error);
+    }
+
+    void add_raw(uint64_t time_us, Direction direction, const uint8_t* data, size_t size) {
+        add(time_us, direction, RecordType::RAW, data, size);
+    }
+
+    void add_message(uint64_t time_us, Direction direction, const std::string& text) {
+        add(time_us, direction, RecordType::MESSAGE, reinterpret_cast<const uint8_t*>(text.data()), text.size());
+        ++keys_[make_key(text.data(), text.size())];
+        ++pending_messages_;
+    }
+
+    /**
+     * Writes the pending records as a chunk, making them visible to readers.
+     **/
+    bool flush() {
+        if (file_ == nullptr || pending_records_ == 0) {
+            return true;
+        }
+        ChunkHeader header{};
+        std::memcpy(header.magic, CHUNK_MAGIC, sizeof(CHUNK_MAGIC));
+        header.payload_size = static_cast<uint32_t>(payload_.size());
+        header.record_count = pending_records_;
+        header.key_count = static_cast<uint32_t>(keys_.size());
+        header.first_time_us = first_time_us_;
+        header.min_time_us = min_time_us_;
+        header.max_time_us = max_time_us_;
+        header.first_message = messages_;
+        header.message_count = pending_messages_;
+
+        std::vector<KeyCount> keys;
+        keys.reserve(keys_.size());
+        for (const auto& key : keys_) {
+            keys.push_back({key.first, key.second});
+        }
+
+        std::fseek(file_, 0, SEEK_END);
+        uint64_t offset = static_cast<uint64_t>(std::ftell(file_));
+        bool ok = std::fwrite(&header, sizeof(header), 1, file_) == 1 &&
+                  std::fwrite(keys.data(), sizeof(KeyCount), keys.size(), file_) == keys.size() &&
+                  std::fwrite(payload_.data(), 1, payload_.size(), file_) == payload_.size() && std::fflush(file_) == 0;
+        index_.push_back({offset, min_time_us_, max_time_us_, messages_});
+        messages_ += pending_messages_;
+        payload_.clear();
+        keys_.clear();
+        pending_records_ = 0;
+        pending_messages_ = 0;
+        return ok;
+    }
+
+    /**
+     * Flushes and appends the index. Returns false in case anything could not be written.
+     **/
+    bool close() {
+        if (file_ == nullptr) {
+            return true;
+        }
+        bool ok = flush();
+        std::fseek(file_, 0, SEEK_END);
+        Footer footer{};
+        footer.index_offset = static_cast<uint64_t>(std::ftell(file_));
+        footer.chunk_count = static_cast<uint32_t>(index_.size());
+        std::memcpy(footer.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+        ok &= std::fwrite(index_.data(), sizeof(IndexEntry), index_.size(), file_) == index_.size();
+        ok &= std::fwrite(&footer, sizeof(footer), 1, file_) == 1;
+        ok &= std::fclose(file_) == 0;
+        file_ = nullptr;
+        return ok;
+    }
+
+    [[nodiscard]] uint64_t messages() const { return messages_ + pending_messages_; }
+    // Largest time stamp written so far, used to place appended data after the existing one.
+    [[nodiscard]] uint64_t end_time_us() const { return end_time_us_; }
+
+ private:
+    void add(uint64_t time_us, Direction direction, RecordType type, const uint8_t* data, size_t size) {
+        if (pending_records_ == 0) {
+            first_time_us_ = time_us;
+            previous_time_us_ = time_us;
+            min_time_us_ = time_us;
+            max_time_us_ = time_us;
+        }
+        int64_t delta = static_cast<int64_t>(time_us - previous_time_us_);
+        previous_time_us_ = time_us;
+        min_time_us_ = std::min(min_time_us_, time_us);
+        max_time_us_ = std::max(max_time_us_, time_us);
+        end_time_us_ = std::max(end_time_us_, time_us);
+
+        payload_.push_back(static_cast<uint8_t>(static_cast<uint8_t>(type) | (direction == Direction::TX ? 0x80 : 0)));
+        put_varint(&payload_, (static_cast<uint64_t>(delta) << 1) ^ static_cast<uint64_t>(delta >> 63));
+        put_varint(&payload_, size);
+        payload_.insert(payload_.end(), data, data + size);
+        ++pending_records_;
+        if (payload_.size() >= MAX_CHUNK_PAYLOAD) {
+            flush();
+        }
+    }
+
+    /**
+     * Reads the index of an existing file (or rebuilds it from the chunk headers) and cuts off everything after the
+     * last complete chunk.
+     **/
+    bool load_existing(uint64_t size, std::string* error) {
+        FileHeader header{};
+        std::fseek(file_, 0, SEEK_SET);
+        if (std::fread(&header, sizeof(header), 1, file_) != 1 || std::memcmp(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0 ||
+            header.version != FORMAT_VERSION) {
+            *error = "Not a version 1 trace file.";
+            return false;
+        }
+        uint64_t end = sizeof(FileHeader);
+        uint64_t offset = sizeof(FileHeader);
+        while (offset + sizeof(ChunkHeader) <= size) {
+            ChunkHeader chunk{};
+            std::fseek(file_, static_cast<long>(offset), SEEK_SET);
+            if (std::fread(&chunk, sizeof(chunk), 1, file_) != 1 || std::memcmp(chunk.magic, CHUNK_MAGIC, sizeof(CHUNK_MAGIC)) != 0) {
+                break;
+            }
+            uint64_t next = offset + sizeof(ChunkHeader) + (uint64_t{chunk.key_count} * sizeof(KeyCount)) + chunk.payload_size;
+            if (next > size) {
+                break;
+            }
+            index_.push_back({offset, chunk.min_time_us, chunk.max_time_us, chunk.first_message});
+            messages_ = chunk.first_message + chunk.message_count;
+            end_time_us_ = std::max(end_time_us_, chunk.max_time_us);
+            offset = next;
+            end = next;
+        }
+        // Drops the old index and a partially written chunk:
+        if (std::fflush(file_) != 0 || ftruncate(fileno(file_), static_cast<off_t>(end)) != 0) {
+            *error = "Failed to truncate the existing index.";
+            return false;
+        }
+        return true;
+    }
+
+    std::FILE* file_{nullptr};
+    std::vector<IndexEntry> index_{};
+    uint64_t messages_{0};
+    uint64_t end_time_us_{0};
+
+    std::vector<uint8_t> payload_{};
+    std::map<std::array<char, KEY_SIZE>, uint32_t> keys_{};
+    uint32_t pending_records_{0};
+    uint32_t pending_messages_{0};
+    uint64_t first_time_us_{0};
+    uint64_t previous_time_us_{0};
+    uint64_t min_time_us_{0};
+    uint64_t max_time_us_{0};
+};
+
+//---------------------------------------------------------------------------
+// Reader
+//---------------------------------------------------------------------------
+class Reader {
+ public:
+    struct Chunk {
+        const ChunkHeader* header;
+        const KeyCount* keys;
+        const uint8_t* payload;
+    };
+
+    Reader() = default;
+    Reader(const Reader&) = delete;
+    Reader& operator=(const Reader&) = delete;
+    ~Reader() {
+        if (data_ != nullptr) {
+            munmap(const_cast<uint8_t*>(data_), size_);
+        }
+    }
+
+    bool open(const char* path, std::string* error) {
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) {
+            *error = std::string("Failed to open '") + path + "'.";
+            return false;
+        }
+        struct stat st {};
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            size_ = static_cast<size_t>(st.st_size);
+            void* mapped = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED) {
+                data_ = static_cast<const uint8_t*>(mapped);
+            }
+        }
+        ::close(fd);
+        if (data_ == nullptr || size_ < sizeof(FileHeader)) {
+            *error = "Failed to map the file.";
+            return false;
+        }
+        const auto* header = reinterpret_cast<const FileHeader*>(data_);
+        if (std::memcmp(header->magic, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0 || header->version != FORMAT_VERSION) {
+            *error = "Not a version 1 trace file.";
+            return false;
+        }
+        if (!load_index()) {
+            walk_chunks();
+        }
+        return true;
+    }
+
+    [[nodiscard]] bool indexed() const { return indexed_; }
+    [[nodiscard]] size_t chunk_count() const { return chunks_.size(); }
+    [[nodiscard]] const Chunk& chunk(size_t i) const { return chunks_[i]; }
+    [[nodiscard]] uint64_t message_count() const {
+        return chunks_.empty() ? 0 : chunks_.back().header->first_message + chunks_.back().header->message_count;
+    }
+    [[nodiscard]] uint64_t min_time_us() const { return chunks_.empty() ? 0 : chunks_.front().header->min_time_us; }
+    [[nodiscard]] uint64_t max_time_us() const { return chunks_.empty() ? 0 : chunks_.back().header->max_time_us; }
+    [[nodiscard]] size_t file_size() const { return size_; }
+
+    /**
+     * Calls on_record(const Record&) for every record of the given chunk until it returns false.
+     * Returns false in case the payload is damaged.
+     **/
+    template <typename Callback>
+    bool for_each_record(size_t index, Callback&& on_record) const {
+        const Chunk& chunk = chunks_[index];
+        const uint8_t* pos = chunk.payload;
+        const uint8_t* end = chunk.payload + chunk.header->payload_size;
+        uint64_t time_us = chunk.header->first_time_us;
+        uint64_t message_index = chunk.header->first_message;
+        for (uint32_t i = 0; i < chunk.header->record_count; i++) {
+            if (pos >= end) {
+                return false;
+            }
+            uint8_t flags = *pos++;
+            uint64_t delta = 0;
+            uint64_t length = 0;
+            if (!get_varint(&pos, end, &delta) || !get_varint(&pos, end, &length) || length > static_cast<uint64_t>(end - pos)) {
+                return false;
+            }
+            time_us += static_cast<uint64_t>(static_cast<int64_t>(delta >> 1) ^ -static_cast<int64_t>(delta & 1));
+            Record record{time_us, (flags & 0x80) != 0 ? Direction::TX : Direction::RX,
+                          (flags & 0x01) != 0 ? RecordType::MESSAGE : RecordType::RAW, pos, static_cast<size_t>(length),
+                          message_index};
+            pos += length;
+            if (record.type == RecordType::MESSAGE) {
+                ++message_index;
+            }
+            if (!on_record(record)) {
+                break;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Number of messages in the given chunk starting with prefix.
+     * Exact in case the prefix fits into a key, an upper bound otherwise.
+     **/
+    [[nodiscard]] uint64_t count_candidates(size_t index, const std::string& prefix) const {
+        std::array<char, KEY_SIZE> key = make_key(prefix.data(), prefix.size());
+        size_t key_length = std::find(key.begin(), key.end(), '\0') - key.begin();
+        uint64_t count = 0;
+        const Chunk& chunk = chunks_[index];
+        for (uint32_t i = 0; i < chunk.header->key_count; i++) {
+            if (std::memcmp(chunk.keys[i].key.data(), key.data(), key_length) == 0) {
+                count += chunk.keys[i].count;
+            }
+        }
+        return count;
+    }
+
+    /**
+     * Total number of messages starting with prefix. Only reads the chunk headers, unless the prefix is longer than a key.
+     **/
+    [[nodiscard]] uint64_t count_messages(const std::string& prefix) const {
+        uint64_t total = 0;
+        for (size_t i = 0; i < chunks_.size(); i++) {
+            uint64_t candidates = count_candidates(i, prefix);
+            if (candidates == 0 || key_is_exact(prefix)) {
+                total += candidates;
+                continue;
+            }
+            for_each_record(i, [&](const Record& record) {
+                total += matches(record, prefix) ? 1 : 0;
+                return true;
+            });
+        }
+        return total;
+    }
+
+    /**
+     * Finds the nth (starting at 1) message starting with prefix.
+     **/
+    bool find_message(const std::string& prefix, uint64_t nth, Record* result, size_t* chunk_index) const {
+        uint64_t seen = 0;
+        for (size_t i = 0; i < chunks_.size(); i++) {
+            uint64_t candidates = count_candidates(i, prefix);
+            if (candidates == 0 || (key_is_exact(prefix) && seen + candidates < nth)) {
+                seen += key_is_exact(prefix) ? candidates : 0;
+                continue;
+            }
+            bool found = false;
+            for_each_record(i, [&](const Record& record) {
+                if (matches(record, prefix) && ++seen == nth) {
+                    *result = record;
+                    found = true;
+                }
+                return !found;
+            });
+            if (found) {
+                *chunk_index = i;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Returns the first chunk that might hold records at or after the given time.
+     **/
+    [[nodiscard]] size_t find_chunk(uint64_t time_us) const {
+        auto it = std::partition_point(chunks_.begin(), chunks_.end(),
+                                       [time_us](const Chunk& chunk) { return chunk.header->max_time_us < time_us; });
+        return static_cast<size_t>(it - chunks_.begin());
+    }
+
+ private:
+    static bool key_is_exact(const std::string& prefix) {
+        return prefix.size() <= KEY_SIZE && prefix.find_first_of("\r\n") == std::string::npos;
+    }
+
+    static bool matches(const Record& record, const std::string& prefix) {
+        return record.type == RecordType::MESSAGE && record.size >= prefix.size() &&
+               std::memcmp(record.data, prefix.data(), prefix.size()) == 0;
+    }
+
+    /**
+     * Adds the chunk at the given offset. Returns the offset of the next one or 0 in case it is damaged or incomplete.
+     **/
+    uint64_t add_chunk(uint64_t offset) {
+        if (offset + sizeof(ChunkHeader) > size_) {
+            return 0;
+        }
+        const auto* header = reinterpret_cast<const ChunkHeader*>(data_ + offset);
+        uint64_t keys = offset + sizeof(ChunkHeader);
+        uint64_t payload = keys + (uint64_t{header->key_count} * sizeof(KeyCount));
+        if (std::memcmp(header->magic, CHUNK_MAGIC, sizeof(CHUNK_MAGIC)) != 0 || payload + header->payload_size > size_) {
+            return 0;
+        }
+        chunks_.push_back({header, reinterpret_cast<const KeyCount*>(data_ + keys), data_ + payload});
+        return payload + header->payload_size;
+    }
+
+    bool load_index() {
+        if (size_ < sizeof(FileHeader) + sizeof(Footer)) {
+            return false;
+        }
+        const auto* footer = reinterpret_cast<const Footer*>(data_ + size_ - sizeof(Footer));
+        if (std::memcmp(footer->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 ||
+            footer->index_offset + (uint64_t{footer->chunk_count} * sizeof(IndexEntry)) + sizeof(Footer) != size_) {
+            return false;
+        }
+        const auto* index = reinterpret_cast<const IndexEntry*>(data_ + footer->index_offset);
+        for (uint32_t i = 0; i < footer->chunk_count; i++) {
+            if (add_chunk(index[i].offset) == 0) {
+                chunks_.clear();
+                return false;
+            }
+        }
+        indexed_ = true;
+        return true;
+    }
+
+    void walk_chunks() {
+        uint64_t offset = sizeof(FileHeader);
+        while ((offset = add_chunk(offset)) != 0) {
+        }
+    }
+
+    const uint8_t* data_{nullptr};
+    size_t size_{0};
+    bool indexed_{false};
+    std::vector<Chunk> chunks_{};
+};
+}  // namespace trace_file